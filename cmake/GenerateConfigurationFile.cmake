@@ -81,6 +81,32 @@ check_cxx_source_compiles(
   ]=]
   HAVE_AVX2)
 
+check_cxx_source_compiles(
+  [=[
+    #include <immintrin.h>
+    void func() __attribute__((target("avx512bw")));
+    void func() { _mm512_abs_epi8(_mm512_set1_epi32(42)); }
+    int main()
+    {
+      func();
+      return 0;
+    }
+  ]=]
+  HAVE_AVX512BW)
+
+check_cxx_source_compiles(
+  [=[
+    #include <emmintrin.h>
+    void func() __attribute__((target("sse2")));
+    void func() { _mm_movemask_epi8(_mm_set1_epi8(42)); }
+    int main()
+    {
+      func();
+      return 0;
+    }
+  ]=]
+  HAVE_SSE2)
+
 list(APPEND CMAKE_REQUIRED_LIBRARIES ws2_32)
 list(REMOVE_ITEM CMAKE_REQUIRED_LIBRARIES ws2_32)
 
@@ -47,10 +47,13 @@ namespace {
 
 enum class ConfigItem {
   absolute_paths_in_stderr,
+  background_cleanup,
   base_dir,
   cache_dir,
+  common_hash_cache,
   compiler,
   compiler_check,
+  compiler_check_cache,
   compiler_type,
   compression,
   compression_level,
@@ -60,6 +63,7 @@ enum class ConfigItem {
   depend_mode,
   direct_mode,
   disable,
+  eviction_policy,
   extra_files_to_hash,
   file_clone,
   hard_link,
@@ -81,6 +85,11 @@ enum class ConfigItem {
   recache,
   run_second_cpp,
   secondary_storage,
+  secondary_storage_async_upload,
+  secondary_storage_cool_down,
+  secondary_storage_failure_threshold,
+  secondary_storage_latency_budget,
+  secondary_storage_negative_cache_ttl,
   sloppiness,
   stats,
   stats_log,
@@ -90,10 +99,13 @@ enum class ConfigItem {
 
 const std::unordered_map<std::string, ConfigItem> k_config_key_table = {
   {"absolute_paths_in_stderr", ConfigItem::absolute_paths_in_stderr},
+  {"background_cleanup", ConfigItem::background_cleanup},
   {"base_dir", ConfigItem::base_dir},
   {"cache_dir", ConfigItem::cache_dir},
+  {"common_hash_cache", ConfigItem::common_hash_cache},
   {"compiler", ConfigItem::compiler},
   {"compiler_check", ConfigItem::compiler_check},
+  {"compiler_check_cache", ConfigItem::compiler_check_cache},
   {"compiler_type", ConfigItem::compiler_type},
   {"compression", ConfigItem::compression},
   {"compression_level", ConfigItem::compression_level},
@@ -103,6 +115,7 @@ const std::unordered_map<std::string, ConfigItem> k_config_key_table = {
   {"depend_mode", ConfigItem::depend_mode},
   {"direct_mode", ConfigItem::direct_mode},
   {"disable", ConfigItem::disable},
+  {"eviction_policy", ConfigItem::eviction_policy},
   {"extra_files_to_hash", ConfigItem::extra_files_to_hash},
   {"file_clone", ConfigItem::file_clone},
   {"hard_link", ConfigItem::hard_link},
@@ -124,6 +137,15 @@ const std::unordered_map<std::string, ConfigItem> k_config_key_table = {
   {"recache", ConfigItem::recache},
   {"run_second_cpp", ConfigItem::run_second_cpp},
   {"secondary_storage", ConfigItem::secondary_storage},
+  {"secondary_storage_async_upload",
+   ConfigItem::secondary_storage_async_upload},
+  {"secondary_storage_cool_down", ConfigItem::secondary_storage_cool_down},
+  {"secondary_storage_failure_threshold",
+   ConfigItem::secondary_storage_failure_threshold},
+  {"secondary_storage_latency_budget",
+   ConfigItem::secondary_storage_latency_budget},
+  {"secondary_storage_negative_cache_ttl",
+   ConfigItem::secondary_storage_negative_cache_ttl},
   {"sloppiness", ConfigItem::sloppiness},
   {"stats", ConfigItem::stats},
   {"stats_log", ConfigItem::stats_log},
@@ -133,11 +155,14 @@ const std::unordered_map<std::string, ConfigItem> k_config_key_table = {
 
 const std::unordered_map<std::string, std::string> k_env_variable_table = {
   {"ABSSTDERR", "absolute_paths_in_stderr"},
+  {"BACKGROUNDCLEANUP", "background_cleanup"},
   {"BASEDIR", "base_dir"},
   {"CC", "compiler"}, // Alias for CCACHE_COMPILER
   {"COMMENTS", "keep_comments_cpp"},
+  {"COMMONHASHCACHE", "common_hash_cache"},
   {"COMPILER", "compiler"},
   {"COMPILERCHECK", "compiler_check"},
+  {"COMPILERCHECKCACHE", "compiler_check_cache"},
   {"COMPILERTYPE", "compiler_type"},
   {"COMPRESS", "compression"},
   {"COMPRESSLEVEL", "compression_level"},
@@ -148,6 +173,7 @@ const std::unordered_map<std::string, std::string> k_env_variable_table = {
   {"DIR", "cache_dir"},
   {"DIRECT", "direct_mode"},
   {"DISABLE", "disable"},
+  {"EVICTIONPOLICY", "eviction_policy"},
   {"EXTENSION", "cpp_extension"},
   {"EXTRAFILES", "extra_files_to_hash"},
   {"FILECLONE", "file_clone"},
@@ -168,6 +194,13 @@ const std::unordered_map<std::string, std::string> k_env_variable_table = {
   {"READONLY_DIRECT", "read_only_direct"},
   {"RECACHE", "recache"},
   {"SECONDARY_STORAGE", "secondary_storage"},
+  {"SECONDARY_STORAGE_ASYNC_UPLOAD", "secondary_storage_async_upload"},
+  {"SECONDARY_STORAGE_COOL_DOWN", "secondary_storage_cool_down"},
+  {"SECONDARY_STORAGE_FAILURE_THRESHOLD",
+   "secondary_storage_failure_threshold"},
+  {"SECONDARY_STORAGE_LATENCY_BUDGET", "secondary_storage_latency_budget"},
+  {"SECONDARY_STORAGE_NEGATIVE_CACHE_TTL",
+   "secondary_storage_negative_cache_ttl"},
   {"SLOPPINESS", "sloppiness"},
   {"STATS", "stats"},
   {"STATSLOG", "stats_log"},
@@ -255,6 +288,17 @@ parse_compiler_type(const std::string& value)
   }
 }
 
+EvictionPolicy
+parse_eviction_policy(const std::string& value)
+{
+  if (value == "gdsf") {
+    return EvictionPolicy::gdsf;
+  } else {
+    // Allow any unknown value for forward compatibility.
+    return EvictionPolicy::lru;
+  }
+}
+
 uint32_t
 parse_sloppiness(const std::string& value)
 {
@@ -461,6 +505,20 @@ compiler_type_to_string(CompilerType compiler_type)
   ASSERT(false);
 }
 
+std::string
+eviction_policy_to_string(EvictionPolicy eviction_policy)
+{
+  switch (eviction_policy) {
+  case EvictionPolicy::gdsf:
+    return "gdsf";
+
+  case EvictionPolicy::lru:
+    return "lru";
+  }
+
+  ASSERT(false);
+}
+
 void
 Config::read()
 {
@@ -615,18 +673,27 @@ Config::get_string_value(const std::string& key) const
   case ConfigItem::absolute_paths_in_stderr:
     return format_bool(m_absolute_paths_in_stderr);
 
+  case ConfigItem::background_cleanup:
+    return format_bool(m_background_cleanup);
+
   case ConfigItem::base_dir:
     return m_base_dir;
 
   case ConfigItem::cache_dir:
     return m_cache_dir;
 
+  case ConfigItem::common_hash_cache:
+    return format_bool(m_common_hash_cache);
+
   case ConfigItem::compiler:
     return m_compiler;
 
   case ConfigItem::compiler_check:
     return m_compiler_check;
 
+  case ConfigItem::compiler_check_cache:
+    return format_bool(m_compiler_check_cache);
+
   case ConfigItem::compiler_type:
     return compiler_type_to_string(m_compiler_type);
 
@@ -654,6 +721,9 @@ Config::get_string_value(const std::string& key) const
   case ConfigItem::disable:
     return format_bool(m_disable);
 
+  case ConfigItem::eviction_policy:
+    return eviction_policy_to_string(m_eviction_policy);
+
   case ConfigItem::extra_files_to_hash:
     return m_extra_files_to_hash;
 
@@ -717,6 +787,21 @@ Config::get_string_value(const std::string& key) const
   case ConfigItem::secondary_storage:
     return m_secondary_storage;
 
+  case ConfigItem::secondary_storage_async_upload:
+    return format_bool(m_secondary_storage_async_upload);
+
+  case ConfigItem::secondary_storage_cool_down:
+    return FMT("{}", m_secondary_storage_cool_down);
+
+  case ConfigItem::secondary_storage_failure_threshold:
+    return FMT("{}", m_secondary_storage_failure_threshold);
+
+  case ConfigItem::secondary_storage_latency_budget:
+    return FMT("{}", m_secondary_storage_latency_budget);
+
+  case ConfigItem::secondary_storage_negative_cache_ttl:
+    return FMT("{}", m_secondary_storage_negative_cache_ttl);
+
   case ConfigItem::sloppiness:
     return format_sloppiness(m_sloppiness);
 
@@ -818,6 +903,10 @@ Config::set_item(const std::string& key,
     m_absolute_paths_in_stderr = parse_bool(value, env_var_key, negate);
     break;
 
+  case ConfigItem::background_cleanup:
+    m_background_cleanup = parse_bool(value, env_var_key, negate);
+    break;
+
   case ConfigItem::base_dir:
     m_base_dir = Util::expand_environment_variables(value);
     if (!m_base_dir.empty()) { // The empty string means "disable"
@@ -830,6 +919,10 @@ Config::set_item(const std::string& key,
     set_cache_dir(Util::expand_environment_variables(value));
     break;
 
+  case ConfigItem::common_hash_cache:
+    m_common_hash_cache = parse_bool(value, env_var_key, negate);
+    break;
+
   case ConfigItem::compiler:
     m_compiler = value;
     break;
@@ -838,6 +931,10 @@ Config::set_item(const std::string& key,
     m_compiler_check = value;
     break;
 
+  case ConfigItem::compiler_check_cache:
+    m_compiler_check_cache = parse_bool(value, env_var_key, negate);
+    break;
+
   case ConfigItem::compiler_type:
     m_compiler_type = parse_compiler_type(value);
     break;
@@ -876,6 +973,10 @@ Config::set_item(const std::string& key,
     m_disable = parse_bool(value, env_var_key, negate);
     break;
 
+  case ConfigItem::eviction_policy:
+    m_eviction_policy = parse_eviction_policy(value);
+    break;
+
   case ConfigItem::extra_files_to_hash:
     m_extra_files_to_hash = Util::expand_environment_variables(value);
     break;
@@ -960,6 +1061,30 @@ Config::set_item(const std::string& key,
     m_secondary_storage = Util::expand_environment_variables(value);
     break;
 
+  case ConfigItem::secondary_storage_async_upload:
+    m_secondary_storage_async_upload = parse_bool(value, env_var_key, negate);
+    break;
+
+  case ConfigItem::secondary_storage_cool_down:
+    m_secondary_storage_cool_down = Util::parse_unsigned(
+      value, nullopt, UINT32_MAX, "secondary_storage_cool_down");
+    break;
+
+  case ConfigItem::secondary_storage_failure_threshold:
+    m_secondary_storage_failure_threshold = Util::parse_unsigned(
+      value, nullopt, UINT32_MAX, "secondary_storage_failure_threshold");
+    break;
+
+  case ConfigItem::secondary_storage_latency_budget:
+    m_secondary_storage_latency_budget = Util::parse_unsigned(
+      value, nullopt, UINT32_MAX, "secondary_storage_latency_budget");
+    break;
+
+  case ConfigItem::secondary_storage_negative_cache_ttl:
+    m_secondary_storage_negative_cache_ttl = Util::parse_unsigned(
+      value, nullopt, UINT32_MAX, "secondary_storage_negative_cache_ttl");
+    break;
+
   case ConfigItem::sloppiness:
     m_sloppiness = parse_sloppiness(value);
     break;
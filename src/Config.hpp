@@ -34,6 +34,10 @@ enum class CompilerType { auto_guess, clang, gcc, nvcc, other, pump };
 
 std::string compiler_type_to_string(CompilerType compiler_type);
 
+enum class EvictionPolicy { gdsf, lru };
+
+std::string eviction_policy_to_string(EvictionPolicy eviction_policy);
+
 class Config : NonCopyable
 {
 public:
@@ -42,10 +46,13 @@ public:
   void read();
 
   bool absolute_paths_in_stderr() const;
+  bool background_cleanup() const;
   const std::string& base_dir() const;
   const std::string& cache_dir() const;
+  bool common_hash_cache() const;
   const std::string& compiler() const;
   const std::string& compiler_check() const;
+  bool compiler_check_cache() const;
   CompilerType compiler_type() const;
   bool compression() const;
   int8_t compression_level() const;
@@ -55,6 +62,7 @@ public:
   bool depend_mode() const;
   bool direct_mode() const;
   bool disable() const;
+  EvictionPolicy eviction_policy() const;
   const std::string& extra_files_to_hash() const;
   bool file_clone() const;
   bool hard_link() const;
@@ -76,6 +84,11 @@ public:
   bool recache() const;
   bool run_second_cpp() const;
   const std::string& secondary_storage() const;
+  bool secondary_storage_async_upload() const;
+  uint32_t secondary_storage_cool_down() const;
+  uint32_t secondary_storage_failure_threshold() const;
+  uint32_t secondary_storage_latency_budget() const;
+  uint32_t secondary_storage_negative_cache_ttl() const;
   uint32_t sloppiness() const;
   bool stats() const;
   const std::string& stats_log() const;
@@ -95,6 +108,7 @@ public:
   void set_max_files(uint64_t value);
   void set_max_size(uint64_t value);
   void set_run_second_cpp(bool value);
+  void set_secondary_storage_negative_cache_ttl(uint32_t value);
 
   // Where to write configuration changes.
   const std::string& primary_config_path() const;
@@ -136,10 +150,13 @@ private:
   std::string m_secondary_config_path;
 
   bool m_absolute_paths_in_stderr = false;
+  bool m_background_cleanup = false;
   std::string m_base_dir;
   std::string m_cache_dir;
+  bool m_common_hash_cache = false;
   std::string m_compiler;
   std::string m_compiler_check = "mtime";
+  bool m_compiler_check_cache = false;
   CompilerType m_compiler_type = CompilerType::auto_guess;
   bool m_compression = true;
   int8_t m_compression_level = 0; // Use default level
@@ -149,6 +166,7 @@ private:
   bool m_depend_mode = false;
   bool m_direct_mode = true;
   bool m_disable = false;
+  EvictionPolicy m_eviction_policy = EvictionPolicy::lru;
   std::string m_extra_files_to_hash;
   bool m_file_clone = false;
   bool m_hard_link = false;
@@ -170,6 +188,11 @@ private:
   bool m_recache = false;
   bool m_run_second_cpp = true;
   std::string m_secondary_storage;
+  bool m_secondary_storage_async_upload = false;
+  uint32_t m_secondary_storage_cool_down = 60;
+  uint32_t m_secondary_storage_failure_threshold = 0;
+  uint32_t m_secondary_storage_latency_budget = 0;
+  uint32_t m_secondary_storage_negative_cache_ttl = 0;
   uint32_t m_sloppiness = 0;
   bool m_stats = true;
   std::string m_stats_log;
@@ -195,6 +218,12 @@ Config::absolute_paths_in_stderr() const
   return m_absolute_paths_in_stderr;
 }
 
+inline bool
+Config::background_cleanup() const
+{
+  return m_background_cleanup;
+}
+
 inline const std::string&
 Config::base_dir() const
 {
@@ -207,6 +236,12 @@ Config::cache_dir() const
   return m_cache_dir;
 }
 
+inline bool
+Config::common_hash_cache() const
+{
+  return m_common_hash_cache;
+}
+
 inline const std::string&
 Config::compiler() const
 {
@@ -219,6 +254,12 @@ Config::compiler_check() const
   return m_compiler_check;
 }
 
+inline bool
+Config::compiler_check_cache() const
+{
+  return m_compiler_check_cache;
+}
+
 inline CompilerType
 Config::compiler_type() const
 {
@@ -273,6 +314,12 @@ Config::disable() const
   return m_disable;
 }
 
+inline EvictionPolicy
+Config::eviction_policy() const
+{
+  return m_eviction_policy;
+}
+
 inline const std::string&
 Config::extra_files_to_hash() const
 {
@@ -399,6 +446,36 @@ Config::secondary_storage() const
   return m_secondary_storage;
 }
 
+inline bool
+Config::secondary_storage_async_upload() const
+{
+  return m_secondary_storage_async_upload;
+}
+
+inline uint32_t
+Config::secondary_storage_cool_down() const
+{
+  return m_secondary_storage_cool_down;
+}
+
+inline uint32_t
+Config::secondary_storage_failure_threshold() const
+{
+  return m_secondary_storage_failure_threshold;
+}
+
+inline uint32_t
+Config::secondary_storage_latency_budget() const
+{
+  return m_secondary_storage_latency_budget;
+}
+
+inline uint32_t
+Config::secondary_storage_negative_cache_ttl() const
+{
+  return m_secondary_storage_negative_cache_ttl;
+}
+
 inline uint32_t
 Config::sloppiness() const
 {
@@ -509,3 +586,9 @@ Config::set_run_second_cpp(bool value)
 {
   m_run_second_cpp = value;
 }
+
+inline void
+Config::set_secondary_storage_negative_cache_ttl(uint32_t value)
+{
+  m_secondary_storage_negative_cache_ttl = value;
+}
@@ -20,12 +20,184 @@
 
 #include "Fd.hpp"
 #include "Logging.hpp"
+#include "ThreadPool.hpp"
 #include "fmtmacros.hpp"
 
+extern "C" {
+#include "third_party/blake3/blake3_impl.h"
+}
+
+#include <algorithm>
+#include <thread>
+#include <vector>
+
 using nonstd::string_view;
 
 const string_view HASH_DELIMITER("\000cCaChE\000", 8);
 
+namespace {
+
+// Buffers at least this large are hashed on several threads.
+const size_t k_min_size_for_parallel_hashing = 4 * 1024 * 1024;
+
+// Size of the subtrees hashed by each thread. Must be a power of two number of
+// chunks.
+const size_t k_parallel_subtree_size = 256 * 1024;
+
+// Maximum number of threads used for hashing a buffer.
+const unsigned k_max_hashing_threads = 8;
+
+// The helpers below mirror the static functions in blake3.c that maintain the
+// chaining value stack of a hasher. This makes it possible to hash aligned
+// subtrees of the input independently and then add their chaining values to
+// the hasher in order, which is what blake3_hasher_update does serially.
+
+// Compute the chaining value of the (complete, non-root) chunk in `chunk`.
+void
+chunk_chaining_value(const blake3_chunk_state& chunk,
+                     uint8_t cv[BLAKE3_OUT_LEN])
+{
+  uint32_t cv_words[8];
+  memcpy(cv_words, chunk.cv, sizeof(cv_words));
+  const uint8_t flags = chunk.flags
+                        | (chunk.blocks_compressed == 0 ? CHUNK_START : 0)
+                        | CHUNK_END;
+  blake3_compress_in_place(
+    cv_words, chunk.buf, chunk.buf_len, chunk.chunk_counter, flags);
+  store_cv_words(cv, cv_words);
+}
+
+// Push the chaining value of a subtree starting at chunk `chunk_counter` onto
+// the stack of `hasher`, lazily merging completed subtrees first.
+void
+push_chaining_value(blake3_hasher& hasher,
+                    const uint8_t cv[BLAKE3_OUT_LEN],
+                    uint64_t chunk_counter)
+{
+  const size_t post_merge_stack_len = popcnt(chunk_counter);
+  while (hasher.cv_stack_len > post_merge_stack_len) {
+    uint8_t* parent_node =
+      &hasher.cv_stack[(hasher.cv_stack_len - 2) * BLAKE3_OUT_LEN];
+    uint32_t cv_words[8];
+    memcpy(cv_words, hasher.key, sizeof(cv_words));
+    blake3_compress_in_place(
+      cv_words, parent_node, BLAKE3_BLOCK_LEN, 0, hasher.chunk.flags | PARENT);
+    store_cv_words(parent_node, cv_words);
+    --hasher.cv_stack_len;
+  }
+  memcpy(&hasher.cv_stack[hasher.cv_stack_len * BLAKE3_OUT_LEN],
+         cv,
+         BLAKE3_OUT_LEN);
+  ++hasher.cv_stack_len;
+}
+
+// Reset the chunk state of `hasher` to an empty chunk at `chunk_counter`.
+void
+reset_chunk_state(blake3_hasher& hasher, uint64_t chunk_counter)
+{
+  memcpy(hasher.chunk.cv, hasher.key, sizeof(hasher.chunk.cv));
+  hasher.chunk.chunk_counter = chunk_counter;
+  memset(hasher.chunk.buf, 0, sizeof(hasher.chunk.buf));
+  hasher.chunk.buf_len = 0;
+  hasher.chunk.blocks_compressed = 0;
+}
+
+struct Subtree
+{
+  const uint8_t* input;
+  size_t size; // Power of two number of chunks.
+  uint64_t chunk_counter;
+  uint8_t cvs[2 * BLAKE3_OUT_LEN];
+  size_t num_cvs;
+};
+
+// Hash `subtree` into one chaining value (a single chunk) or the two chaining
+// values of its halves, just like blake3_hasher_update does for the subtrees
+// it hashes.
+void
+hash_subtree(const blake3_hasher& parent, Subtree& subtree)
+{
+  blake3_hasher hasher = parent;
+  hasher.cv_stack_len = 0;
+  reset_chunk_state(hasher, subtree.chunk_counter);
+  blake3_hasher_update(&hasher, subtree.input, subtree.size);
+  if (subtree.size == BLAKE3_CHUNK_LEN) {
+    // A single chunk is left in the chunk state.
+    chunk_chaining_value(hasher.chunk, subtree.cvs);
+    subtree.num_cvs = 1;
+  } else {
+    // The chaining values of the two halves are left on the stack.
+    memcpy(subtree.cvs, hasher.cv_stack, 2 * BLAKE3_OUT_LEN);
+    subtree.num_cvs = 2;
+  }
+}
+
+// Equivalent to blake3_hasher_update but hashes subtrees of the input on up to
+// `threads` threads.
+void
+blake3_hasher_update_parallel(blake3_hasher& hasher,
+                              const uint8_t* input,
+                              size_t input_len,
+                              unsigned threads)
+{
+  // Complete a partial chunk first so that the chunk state is empty.
+  const size_t chunk_len =
+    BLAKE3_BLOCK_LEN * hasher.chunk.blocks_compressed + hasher.chunk.buf_len;
+  if (chunk_len > 0) {
+    const size_t take = BLAKE3_CHUNK_LEN - chunk_len;
+    blake3_hasher_update(&hasher, input, take);
+    input += take;
+    input_len -= take;
+    uint8_t cv[BLAKE3_OUT_LEN];
+    chunk_chaining_value(hasher.chunk, cv);
+    push_chaining_value(hasher, cv, hasher.chunk.chunk_counter);
+    reset_chunk_state(hasher, hasher.chunk.chunk_counter + 1);
+  }
+
+  // Split the input into subtrees the same way as blake3_hasher_update but
+  // limit their size so that there is work for all threads. The last partial
+  // chunk is left for the chunk state.
+  std::vector<Subtree> subtrees;
+  uint64_t chunk_counter = hasher.chunk.chunk_counter;
+  while (input_len > BLAKE3_CHUNK_LEN) {
+    size_t subtree_len = std::min<size_t>(
+      round_down_to_power_of_2(input_len), k_parallel_subtree_size);
+    while (((subtree_len - 1) & (chunk_counter * BLAKE3_CHUNK_LEN)) != 0) {
+      subtree_len /= 2;
+    }
+    subtrees.push_back({input, subtree_len, chunk_counter, {}, 0});
+    chunk_counter += subtree_len / BLAKE3_CHUNK_LEN;
+    input += subtree_len;
+    input_len -= subtree_len;
+  }
+
+  if (threads < 2) {
+    for (auto& subtree : subtrees) {
+      hash_subtree(hasher, subtree);
+    }
+  } else {
+    ThreadPool thread_pool(std::min<size_t>(threads, subtrees.size()));
+    for (auto& subtree : subtrees) {
+      thread_pool.enqueue([&] { hash_subtree(hasher, subtree); });
+    }
+  }
+
+  for (const auto& subtree : subtrees) {
+    push_chaining_value(hasher, subtree.cvs, subtree.chunk_counter);
+    if (subtree.num_cvs == 2) {
+      push_chaining_value(hasher,
+                          &subtree.cvs[BLAKE3_OUT_LEN],
+                          subtree.chunk_counter
+                            + subtree.size / BLAKE3_CHUNK_LEN / 2);
+    }
+  }
+  reset_chunk_state(hasher, chunk_counter);
+
+  blake3_hasher_update(&hasher, input, input_len);
+}
+
+} // namespace
+
 Hash::Hash()
 {
   blake3_hasher_init(&m_hasher);
@@ -54,6 +226,23 @@ Hash::digest() const
   return digest;
 }
 
+std::string
+Hash::state() const
+{
+  return std::string(reinterpret_cast<const char*>(&m_hasher),
+                     sizeof(m_hasher));
+}
+
+bool
+Hash::set_state(string_view state)
+{
+  if (state.size() != sizeof(m_hasher)) {
+    return false;
+  }
+  memcpy(&m_hasher, state.data(), sizeof(m_hasher));
+  return true;
+}
+
 Hash&
 Hash::hash_delimiter(string_view type)
 {
@@ -118,6 +307,22 @@ Hash::hash_file(const std::string& path)
     return false;
   }
 
+  // Hash large files in one go to make use of parallel hashing.
+  struct stat st;
+  if (fstat(*fd, &st) == 0 && S_ISREG(st.st_mode)
+      && static_cast<size_t>(st.st_size) >= k_min_size_for_parallel_hashing) {
+    std::string data;
+    data.reserve(st.st_size);
+    if (!Util::read_fd(*fd, [&data](const void* buffer, size_t size) {
+          data.append(static_cast<const char*>(buffer), size);
+        })) {
+      LOG("Failed to read {}: {}", path, strerror(errno));
+      return false;
+    }
+    hash(data.data(), data.size());
+    return true;
+  }
+
   bool ret = hash_fd(*fd);
   return ret;
 }
@@ -125,7 +330,15 @@ Hash::hash_file(const std::string& path)
 void
 Hash::hash_buffer(string_view buffer)
 {
-  blake3_hasher_update(&m_hasher, buffer.data(), buffer.size());
+  if (buffer.size() >= k_min_size_for_parallel_hashing) {
+    blake3_hasher_update_parallel(
+      m_hasher,
+      reinterpret_cast<const uint8_t*>(buffer.data()),
+      buffer.size(),
+      std::min(std::thread::hardware_concurrency(), k_max_hashing_threads));
+  } else {
+    blake3_hasher_update(&m_hasher, buffer.data(), buffer.size());
+  }
   if (!buffer.empty() && m_debug_binary) {
     (void)fwrite(buffer.data(), 1, buffer.size(), m_debug_binary);
   }
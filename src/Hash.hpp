@@ -25,6 +25,8 @@
 #include "third_party/blake3/blake3.h"
 #include "third_party/nonstd/string_view.hpp"
 
+#include <string>
+
 // This class represents a hash state.
 class Hash
 {
@@ -44,6 +46,15 @@ public:
   // Retrieve the digest.
   Digest digest() const;
 
+  // Retrieve the raw hash state, e.g. for storing it persistently. The state is
+  // only valid for the same ccache version on the same platform. Debug logging
+  // is not part of the state.
+  std::string state() const;
+
+  // Restore a hash state retrieved by `state`. Returns false if `state` has an
+  // unexpected size, otherwise true.
+  bool set_state(nonstd::string_view state);
+
   // Hash some data that is unlikely to occur in the input. The idea is twofold:
   //
   // - Delimit things like arguments from each other (e.g., so that -I -O2 and
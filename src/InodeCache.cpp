@@ -19,18 +19,18 @@
 #include "InodeCache.hpp"
 
 #include "Config.hpp"
-#include "Fd.hpp"
 #include "Finalizer.hpp"
 #include "Hash.hpp"
 #include "Logging.hpp"
+#include "SharedBuckets.hpp"
 #include "Stat.hpp"
-#include "TemporaryFile.hpp"
 #include "Util.hpp"
 #include "fmtmacros.hpp"
 
 #include <libgen.h>
 #include <sys/mman.h>
 
+#include <algorithm>
 #include <atomic>
 #include <type_traits>
 
@@ -40,11 +40,16 @@
 // that are sorted in LRU order. Entries map from keys representing files to
 // cached hash results.
 //
-// Concurrent access is guarded by a mutex in each bucket.
+// Modifications of a bucket are guarded by a mutex in the bucket. Lookups don't
+// take the mutex but read the bucket optimistically: a sequence number in the
+// bucket is odd while the bucket is being modified and incremented when the
+// modification is done, so a reader that sees the same even sequence number
+// before and after copying the entries got a consistent copy.
 //
-// Current cache size is fixed and the given constants are considered large
-// enough for most projects. The size could be made configurable if there is a
-// demand for it.
+// The number of buckets is stored in the file header. When too many entries
+// have been evicted, one process builds a cache file with twice as many buckets
+// from the current one, renames it over the current file and marks the old one
+// as retired, which makes other processes map the new file.
 
 namespace {
 
@@ -54,13 +59,26 @@ namespace {
 // Note: The key is hashed using the main hash algorithm, so the version number
 // does not need to be incremented if said algorithm is changed (except if the
 // digest size changes since that affects the entry format).
-const uint32_t k_version = 1;
+const uint32_t k_version = 2;
 
 // Note: Increment the version number if constants affecting storage size are
 // changed.
-const uint32_t k_num_buckets = 32 * 1024;
 const uint32_t k_num_entries = 4;
 
+// The cache doesn't grow beyond this number of buckets (about 60 MB).
+const uint32_t k_max_num_buckets = 256 * 1024;
+
+// The cache grows when this fraction of its capacity has been evicted.
+const uint32_t k_eviction_fraction_to_grow = 4;
+
+// Another process may take over growing the cache if the previous attempt
+// started this many seconds ago.
+const int64_t k_grow_timeout = 60;
+
+// Number of attempts to read a bucket without locking before falling back to
+// taking the lock.
+const int k_max_optimistic_reads = 8;
+
 static_assert(Digest::size() == 20,
               "Increment version number if size of digest is changed.");
 static_assert(IS_TRIVIALLY_COPYABLE(Digest),
@@ -79,6 +97,14 @@ static_assert(
   static_cast<int>(InodeCache::ContentType::precompiled_header) == 3,
   "Numeric value is part of key, increment version number if changed.");
 
+bool
+is_unused(const Digest& key_digest)
+{
+  return std::all_of(key_digest.bytes(),
+                     key_digest.bytes() + Digest::size(),
+                     [](uint8_t byte) { return byte == 0; });
+}
+
 } // namespace
 
 struct InodeCache::Key
@@ -103,7 +129,7 @@ struct InodeCache::Key
 
 struct InodeCache::Entry
 {
-  Digest key_digest;  // Hashed key
+  Digest key_digest;  // Hashed key, all zeros if unused
   Digest file_digest; // Cached file hash
   int return_value;   // Cached return value
 };
@@ -111,61 +137,53 @@ struct InodeCache::Entry
 struct InodeCache::Bucket
 {
   pthread_mutex_t mt;
+  std::atomic<uint32_t> sequence; // Odd while the entries are modified
   Entry entries[k_num_entries];
 };
 
 struct InodeCache::SharedRegion
 {
   uint32_t version;
+  uint32_t num_buckets;
+  std::atomic<uint32_t> retired; // Nonzero if replaced by a larger file
   std::atomic<int64_t> hits;
   std::atomic<int64_t> misses;
   std::atomic<int64_t> errors;
-  Bucket buckets[k_num_buckets];
+  std::atomic<int64_t> evictions;
+  std::atomic<int64_t> grow_start_time; // Zero if not growing
+  // Followed by num_buckets buckets.
 };
 
-bool
+size_t
+InodeCache::region_size(uint32_t num_buckets)
+{
+  return sizeof(SharedRegion) + size_t{num_buckets} * sizeof(Bucket);
+}
+
+InodeCache::SharedRegion*
 InodeCache::mmap_file(const std::string& inode_cache_file)
 {
-  if (m_sr) {
-    munmap(m_sr, sizeof(SharedRegion));
-    m_sr = nullptr;
-  }
-  Fd fd(open(inode_cache_file.c_str(), O_RDWR));
-  if (!fd) {
-    LOG("Failed to open inode cache {}: {}", inode_cache_file, strerror(errno));
-    return false;
+  size_t size = 0;
+  SharedRegion* sr = static_cast<SharedRegion*>(SharedBuckets::map_file(
+    inode_cache_file, "inode cache", k_version, sizeof(SharedRegion), size));
+  if (!sr) {
+    return nullptr;
   }
-  bool is_nfs;
-  if (Util::is_nfs_fd(*fd, &is_nfs) == 0 && is_nfs) {
-    LOG(
-      "Inode cache not supported because the cache file is located on nfs: {}",
-      inode_cache_file);
-    return false;
-  }
-  SharedRegion* sr = reinterpret_cast<SharedRegion*>(mmap(
-    nullptr, sizeof(SharedRegion), PROT_READ | PROT_WRITE, MAP_SHARED, *fd, 0));
-  fd.close();
-  if (sr == reinterpret_cast<void*>(-1)) {
-    LOG("Failed to mmap {}: {}", inode_cache_file, strerror(errno));
-    return false;
-  }
-  // Drop the file from disk if the found version is not matching. This will
-  // allow a new file to be generated.
-  if (sr->version != k_version) {
-    LOG(
-      "Dropping inode cache because found version {} does not match expected"
-      " version {}",
-      sr->version,
-      k_version);
-    munmap(sr, sizeof(SharedRegion));
+  if (sr->num_buckets == 0 || region_size(sr->num_buckets) != size) {
+    LOG("Dropping inode cache {} because {} buckets don't match size {}",
+        inode_cache_file,
+        sr->num_buckets,
+        size);
+    munmap(sr, size);
     unlink(inode_cache_file.c_str());
-    return false;
+    return nullptr;
   }
-  m_sr = sr;
   if (m_config.debug()) {
-    LOG("inode cache file loaded: {}", inode_cache_file);
+    LOG("inode cache file loaded: {} ({} buckets)",
+        inode_cache_file,
+        sr->num_buckets);
   }
-  return true;
+  return sr;
 }
 
 bool
@@ -178,7 +196,13 @@ InodeCache::hash_inode(const std::string& path,
     LOG("Could not stat {}: {}", path, strerror(stat.error_number()));
     return false;
   }
+  digest = hash_inode(stat, type);
+  return true;
+}
 
+Digest
+InodeCache::hash_inode(const Stat& stat, ContentType type)
+{
   Key key;
   memset(&key, 0, sizeof(Key));
   key.type = type;
@@ -199,158 +223,232 @@ InodeCache::hash_inode(const std::string& path,
 
   Hash hash;
   hash.hash(&key, sizeof(Key));
-  digest = hash.digest();
-  return true;
+  return hash.digest();
 }
 
-bool
-InodeCache::with_bucket(const Digest& key_digest,
-                        const BucketHandler& bucket_handler)
+InodeCache::Bucket*
+InodeCache::get_bucket(SharedRegion* sr, uint32_t index)
+{
+  return reinterpret_cast<Bucket*>(sr + 1) + index;
+}
+
+uint32_t
+InodeCache::get_bucket_index(const SharedRegion* sr, const Digest& key_digest)
 {
   uint32_t hash;
   Util::big_endian_to_int(key_digest.bytes(), hash);
-  const uint32_t index = hash % k_num_buckets;
-  Bucket* bucket = &m_sr->buckets[index];
-  int err = pthread_mutex_lock(&bucket->mt);
-#ifdef HAVE_PTHREAD_MUTEX_ROBUST
-  if (err == EOWNERDEAD) {
-    if (m_config.debug()) {
-      ++m_sr->errors;
+  return hash % sr->num_buckets;
+}
+
+bool
+InodeCache::read_bucket(const Bucket* bucket, Entry* entries)
+{
+  // Note: The entries may be modified while being copied, in which case the
+  // sequence number will have changed and the copy is discarded.
+  for (int i = 0; i < k_max_optimistic_reads; ++i) {
+    const uint32_t sequence = bucket->sequence.load(std::memory_order_acquire);
+    if (sequence % 2 != 0) {
+      continue;
     }
-    err = pthread_mutex_consistent(&bucket->mt);
-    if (err) {
-      LOG(
-        "Can't consolidate stale mutex at index {}: {}", index, strerror(err));
-      LOG_RAW("Consider removing the inode cache file if the problem persists");
-      return false;
+    memcpy(entries, bucket->entries, sizeof(Bucket::entries));
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (bucket->sequence.load(std::memory_order_relaxed) == sequence) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool
+InodeCache::with_bucket(SharedRegion* sr,
+                        uint32_t index,
+                        const BucketHandler& bucket_handler,
+                        bool wait)
+{
+  Bucket* bucket = get_bucket(sr, index);
+  switch (SharedBuckets::lock(&bucket->mt, wait, "inode cache", index)) {
+  case SharedBuckets::LockResult::locked:
+    break;
+
+  case SharedBuckets::LockResult::stale:
+    if (m_config.debug()) {
+      ++sr->errors;
     }
-    LOG("Wiping bucket at index {} because of stale mutex", index);
     memset(bucket->entries, 0, sizeof(Bucket::entries));
-  } else {
-#endif
-    if (err != 0) {
-      LOG("Failed to lock mutex at index {}: {}", index, strerror(err));
-      LOG_RAW("Consider removing the inode cache file if problem persists");
-      ++m_sr->errors;
-      return false;
+    // The owner may have died in the middle of a modification.
+    if (bucket->sequence.load(std::memory_order_relaxed) % 2 != 0) {
+      bucket->sequence.fetch_add(1, std::memory_order_release);
     }
-#ifdef HAVE_PTHREAD_MUTEX_ROBUST
+    break;
+
+  case SharedBuckets::LockResult::busy:
+    return false;
+
+  case SharedBuckets::LockResult::failed:
+    ++sr->errors;
+    return false;
   }
-#endif
 
-  try {
-    bucket_handler(bucket);
-  } catch (...) {
+  bucket->sequence.fetch_add(1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  Finalizer unlocker([&] {
+    bucket->sequence.fetch_add(1, std::memory_order_release);
     pthread_mutex_unlock(&bucket->mt);
-    throw;
-  }
-  pthread_mutex_unlock(&bucket->mt);
+  });
+  bucket_handler(bucket);
   return true;
 }
 
 bool
-InodeCache::create_new_file(const std::string& filename)
+InodeCache::create_new_file(const std::string& filename,
+                            uint32_t num_buckets,
+                            const RegionHandler& populate)
 {
-  LOG_RAW("Creating a new inode cache");
-
-  // Create the new file to a temporary name to prevent other processes from
-  // mapping it before it is fully initialized.
-  TemporaryFile tmp_file(filename);
-
-  Finalizer temp_file_remover([&] { unlink(tmp_file.path.c_str()); });
+  LOG("Creating a new inode cache with {} buckets", num_buckets);
+
+  // A populated file replaces the current one. Processes that have the old
+  // file mapped will switch when they see that it has been retired.
+  return SharedBuckets::create_file(
+    filename,
+    "inode cache",
+    k_version,
+    region_size(num_buckets),
+    [&](void* region) {
+      SharedRegion* sr = static_cast<SharedRegion*>(region);
+      sr->num_buckets = num_buckets;
+      SharedBuckets::initialize_mutexes(
+        num_buckets, [&](uint32_t i) { return &get_bucket(sr, i)->mt; });
+      if (populate) {
+        populate(sr);
+      }
+    },
+    bool(populate));
+}
 
-  bool is_nfs;
-  if (Util::is_nfs_fd(*tmp_file.fd, &is_nfs) == 0 && is_nfs) {
-    LOG(
-      "Inode cache not supported because the cache file would be located on"
-      " nfs: {}",
-      filename);
-    return false;
-  }
-  int err = Util::fallocate(*tmp_file.fd, sizeof(SharedRegion));
-  if (err) {
-    LOG("Failed to allocate file space for inode cache: {}", strerror(err));
-    return false;
-  }
-  SharedRegion* sr =
-    reinterpret_cast<SharedRegion*>(mmap(nullptr,
-                                         sizeof(SharedRegion),
-                                         PROT_READ | PROT_WRITE,
-                                         MAP_SHARED,
-                                         *tmp_file.fd,
-                                         0));
-  if (sr == reinterpret_cast<void*>(-1)) {
-    LOG("Failed to mmap new inode cache: {}", strerror(errno));
-    return false;
+void
+InodeCache::grow(SharedRegion* sr)
+{
+  const uint32_t num_buckets = sr->num_buckets;
+  if (num_buckets >= k_max_num_buckets) {
+    return;
   }
 
-  // Initialize new shared region.
-  sr->version = k_version;
-  pthread_mutexattr_t mattr;
-  pthread_mutexattr_init(&mattr);
-  pthread_mutexattr_setpshared(&mattr, PTHREAD_PROCESS_SHARED);
-#ifdef HAVE_PTHREAD_MUTEX_ROBUST
-  pthread_mutexattr_setrobust(&mattr, PTHREAD_MUTEX_ROBUST);
-#endif
-  for (auto& bucket : sr->buckets) {
-    pthread_mutex_init(&bucket.mt, &mattr);
+  // Only one process grows the cache, but don't let one that died while doing
+  // so stop the cache from growing forever.
+  const int64_t now = time(nullptr);
+  int64_t start_time = sr->grow_start_time.load();
+  if ((start_time != 0 && now - start_time < k_grow_timeout)
+      || !sr->grow_start_time.compare_exchange_strong(start_time, now)) {
+    return;
   }
 
-  munmap(sr, sizeof(SharedRegion));
-  tmp_file.fd.close();
+  const uint32_t new_num_buckets =
+    std::min(2 * num_buckets, k_max_num_buckets);
+  LOG("Growing inode cache from {} to {} buckets after {} evictions",
+      num_buckets,
+      new_num_buckets,
+      sr->evictions.load());
+
+  const bool success =
+    create_new_file(get_file(), new_num_buckets, [&](SharedRegion* new_sr) {
+      for (uint32_t i = 0; i < num_buckets; ++i) {
+        Entry entries[k_num_entries];
+        if (!read_bucket(get_bucket(sr, i), entries)) {
+          continue;
+        }
+        // Entries are visited in LRU order, so the most recently used entries
+        // are kept if the new bucket gets full.
+        for (const auto& entry : entries) {
+          if (is_unused(entry.key_digest)) {
+            continue;
+          }
+          Bucket* new_bucket =
+            get_bucket(new_sr, get_bucket_index(new_sr, entry.key_digest));
+          for (auto& new_entry : new_bucket->entries) {
+            if (is_unused(new_entry.key_digest)) {
+              new_entry = entry;
+              break;
+            }
+          }
+        }
+      }
+      new_sr->hits = sr->hits.load();
+      new_sr->misses = sr->misses.load();
+      new_sr->errors = sr->errors.load();
+    });
 
-  // link() will fail silently if a file with the same name already exists.
-  // This will be the case if two processes try to create a new file
-  // simultaneously. Thus close the current file handle and reopen a new one,
-  // which will make us use the first created file even if we didn't win the
-  // race.
-  if (link(tmp_file.path.c_str(), filename.c_str()) != 0) {
-    LOG("Failed to link new inode cache: {}", strerror(errno));
-    return false;
+  if (success) {
+    sr->retired = 1;
+  } else {
+    sr->grow_start_time = 0;
   }
-
-  return true;
 }
 
-bool
+InodeCache::SharedRegion*
 InodeCache::initialize()
 {
-  if (m_failed || !m_config.inode_cache()) {
-    return false;
+  if (!m_config.inode_cache()) {
+    return nullptr;
+  }
+
+  // Files may be hashed by several threads, e.g. when verifying a manifest.
+  std::lock_guard<std::mutex> lock(m_initialization_mutex);
+
+  if (m_failed) {
+    return nullptr;
   }
 
   if (m_sr) {
-    return true;
+    if (!m_sr->retired.load(std::memory_order_relaxed)) {
+      return m_sr;
+    }
+    LOG_RAW("Inode cache has been replaced by a larger one");
+    m_retired_regions.push_back(m_sr);
+    m_sr = nullptr;
   }
 
   std::string filename = get_file();
-  if (m_sr || mmap_file(filename)) {
-    return true;
+  m_sr = mmap_file(filename);
+  if (m_sr) {
+    return m_sr;
   }
 
   // Try to create a new cache if we failed to map an existing file.
-  create_new_file(filename);
+  if (create_new_file(filename, m_initial_num_buckets)) {
+    // Files with an older layout are no longer used.
+    for (uint32_t version = 1; version < k_version; ++version) {
+      Util::unlink_tmp(
+        FMT("{}/inode-cache.v{}", m_config.temporary_dir(), version),
+        Util::UnlinkLog::ignore_failure);
+    }
+  }
 
   // Concurrent processes could try to create new files simultaneously and the
   // file that actually landed on disk will be from the process that won the
   // race. Thus we try to open the file from disk instead of reusing the file
   // handle to the file we just created.
-  if (mmap_file(filename)) {
-    return true;
+  m_sr = mmap_file(filename);
+  if (m_sr) {
+    return m_sr;
   }
 
   m_failed = true;
-  return false;
+  return nullptr;
 }
 
-InodeCache::InodeCache(const Config& config) : m_config(config)
+InodeCache::InodeCache(const Config& config, uint32_t initial_num_buckets)
+  : m_config(config),
+    m_initial_num_buckets(initial_num_buckets)
 {
 }
 
 InodeCache::~InodeCache()
 {
   if (m_sr) {
-    munmap(m_sr, sizeof(SharedRegion));
+    munmap(m_sr, region_size(m_sr->num_buckets));
+  }
+  for (auto sr : m_retired_regions) {
+    munmap(sr, region_size(sr->num_buckets));
   }
 }
 
@@ -360,50 +458,85 @@ InodeCache::get(const std::string& path,
                 Digest& file_digest,
                 int* return_value)
 {
-  if (!initialize()) {
+  if (!m_config.inode_cache()) {
     return false;
   }
 
-  Digest key_digest;
-  if (!hash_inode(path, type, key_digest)) {
+  Stat stat = Stat::stat(path);
+  if (!stat) {
+    LOG("Could not stat {}: {}", path, strerror(stat.error_number()));
     return false;
   }
+  return get(path, stat, type, file_digest, return_value);
+}
 
-  bool found = false;
-  const bool success = with_bucket(key_digest, [&](const auto bucket) {
-    for (uint32_t i = 0; i < k_num_entries; ++i) {
-      if (bucket->entries[i].key_digest == key_digest) {
-        if (i > 0) {
-          Entry tmp = bucket->entries[i];
-          memmove(&bucket->entries[1], &bucket->entries[0], sizeof(Entry) * i);
-          bucket->entries[0] = tmp;
-        }
+bool
+InodeCache::get(const std::string& path,
+                const Stat& stat,
+                ContentType type,
+                Digest& file_digest,
+                int* return_value)
+{
+  SharedRegion* sr = initialize();
+  if (!sr) {
+    return false;
+  }
 
-        file_digest = bucket->entries[0].file_digest;
-        if (return_value) {
-          *return_value = bucket->entries[0].return_value;
-        }
-        found = true;
-        break;
+  const Digest key_digest = hash_inode(stat, type);
+  const uint32_t index = get_bucket_index(sr, key_digest);
+  Entry entries[k_num_entries];
+  if (!read_bucket(get_bucket(sr, index), entries)
+      && !with_bucket(sr, index, [&](const auto bucket) {
+           memcpy(entries, bucket->entries, sizeof(Bucket::entries));
+         })) {
+    return false;
+  }
+
+  bool found = false;
+  for (uint32_t i = 0; i < k_num_entries; ++i) {
+    if (entries[i].key_digest == key_digest) {
+      file_digest = entries[i].file_digest;
+      if (return_value) {
+        *return_value = entries[i].return_value;
       }
+      found = true;
+
+      // Move the entry first in LRU order unless someone else is busy with the
+      // bucket, in which case it's not worth waiting.
+      if (i > 0) {
+        with_bucket(
+          sr,
+          index,
+          [&](const auto bucket) {
+            for (uint32_t j = 1; j < k_num_entries; ++j) {
+              if (bucket->entries[j].key_digest == key_digest) {
+                Entry tmp = bucket->entries[j];
+                memmove(&bucket->entries[1],
+                        &bucket->entries[0],
+                        sizeof(Entry) * j);
+                bucket->entries[0] = tmp;
+                break;
+              }
+            }
+          },
+          false);
+      }
+      break;
     }
-  });
-  if (!success) {
-    return false;
   }
 
   LOG("inode cache {}: {}", found ? "hit" : "miss", path);
 
   if (m_config.debug()) {
     if (found) {
-      ++m_sr->hits;
+      ++sr->hits;
     } else {
-      ++m_sr->misses;
+      ++sr->misses;
     }
     LOG("Accumulated stats for inode cache: hits={}, misses={}, errors={}",
-        m_sr->hits.load(),
-        m_sr->misses.load(),
-        m_sr->errors.load());
+        sr->hits.load(),
+        sr->misses.load(),
+        sr->errors.load());
   }
   return found;
 }
@@ -414,7 +547,8 @@ InodeCache::put(const std::string& path,
                 const Digest& file_digest,
                 int return_value)
 {
-  if (!initialize()) {
+  SharedRegion* sr = initialize();
+  if (!sr) {
     return false;
   }
 
@@ -423,15 +557,23 @@ InodeCache::put(const std::string& path,
     return false;
   }
 
-  const bool success = with_bucket(key_digest, [&](const auto bucket) {
-    memmove(&bucket->entries[1],
-            &bucket->entries[0],
-            sizeof(Entry) * (k_num_entries - 1));
+  bool evicted = false;
+  const bool success = with_bucket(
+    sr, get_bucket_index(sr, key_digest), [&](const auto bucket) {
+      uint32_t i = 0;
+      while (i < k_num_entries - 1
+             && bucket->entries[i].key_digest != key_digest) {
+        ++i;
+      }
+      // Either replace the existing entry or evict the least recently used one.
+      evicted = bucket->entries[i].key_digest != key_digest
+                && !is_unused(bucket->entries[i].key_digest);
+      memmove(&bucket->entries[1], &bucket->entries[0], sizeof(Entry) * i);
 
-    bucket->entries[0].key_digest = key_digest;
-    bucket->entries[0].file_digest = file_digest;
-    bucket->entries[0].return_value = return_value;
-  });
+      bucket->entries[0].key_digest = key_digest;
+      bucket->entries[0].file_digest = file_digest;
+      bucket->entries[0].return_value = return_value;
+    });
 
   if (!success) {
     return false;
@@ -439,6 +581,13 @@ InodeCache::put(const std::string& path,
 
   LOG("inode cache insert: {}", path);
 
+  if (evicted) {
+    const int64_t capacity = int64_t{sr->num_buckets} * k_num_entries;
+    if (++sr->evictions >= capacity / k_eviction_fraction_to_grow) {
+      grow(sr);
+    }
+  }
+
   return true;
 }
 
@@ -449,8 +598,9 @@ InodeCache::drop()
   if (unlink(file.c_str()) != 0) {
     return false;
   }
+  std::lock_guard<std::mutex> lock(m_initialization_mutex);
   if (m_sr) {
-    munmap(m_sr, sizeof(SharedRegion));
+    munmap(m_sr, region_size(m_sr->num_buckets));
     m_sr = nullptr;
   }
   return true;
@@ -465,17 +615,54 @@ InodeCache::get_file()
 int64_t
 InodeCache::get_hits()
 {
-  return initialize() ? m_sr->hits.load() : -1;
+  SharedRegion* sr = initialize();
+  return sr ? sr->hits.load() : -1;
 }
 
 int64_t
 InodeCache::get_misses()
 {
-  return initialize() ? m_sr->misses.load() : -1;
+  SharedRegion* sr = initialize();
+  return sr ? sr->misses.load() : -1;
 }
 
 int64_t
 InodeCache::get_errors()
 {
-  return initialize() ? m_sr->errors.load() : -1;
+  SharedRegion* sr = initialize();
+  return sr ? sr->errors.load() : -1;
+}
+
+int64_t
+InodeCache::get_capacity()
+{
+  SharedRegion* sr = initialize();
+  return sr ? int64_t{sr->num_buckets} * k_num_entries : -1;
+}
+
+int64_t
+InodeCache::get_occupancy()
+{
+  SharedRegion* sr = initialize();
+  if (!sr) {
+    return -1;
+  }
+  int64_t occupancy = 0;
+  for (uint32_t i = 0; i < sr->num_buckets; ++i) {
+    Entry entries[k_num_entries];
+    if (read_bucket(get_bucket(sr, i), entries)) {
+      occupancy += std::count_if(
+        entries, entries + k_num_entries, [](const Entry& entry) {
+          return !is_unused(entry.key_digest);
+        });
+    }
+  }
+  return occupancy;
+}
+
+int64_t
+InodeCache::get_evictions()
+{
+  SharedRegion* sr = initialize();
+  return sr ? sr->evictions.load() : -1;
 }
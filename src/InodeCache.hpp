@@ -23,11 +23,14 @@
 #include "config.h"
 
 #include <functional>
+#include <mutex>
 #include <string>
+#include <vector>
 
 class Config;
 class Context;
 class Digest;
+class Stat;
 
 class InodeCache
 {
@@ -42,7 +45,12 @@ public:
     precompiled_header = 3,
   };
 
-  InodeCache(const Config& config);
+  // Number of buckets in a newly created cache file. The cache grows from there
+  // when entries are evicted too often.
+  static const uint32_t k_initial_num_buckets = 32 * 1024;
+
+  InodeCache(const Config& config,
+             uint32_t initial_num_buckets = k_initial_num_buckets);
   ~InodeCache();
 
   // Get saved hash digest and return value from a previous call to
@@ -55,6 +63,14 @@ public:
            Digest& file_digest,
            int* return_value = nullptr);
 
+  // Like above but for a file that has already been stat-ed. `path` is only
+  // used for logging.
+  bool get(const std::string& path,
+           const Stat& stat,
+           ContentType type,
+           Digest& file_digest,
+           int* return_value = nullptr);
+
   // Put hash digest and return value from a successful call to
   // hash_source_code_file().
   //
@@ -90,22 +106,49 @@ public:
   // Counters are incremented in debug mode only.
   int64_t get_errors();
 
+  // Returns the number of entries that the cache can hold.
+  int64_t get_capacity();
+
+  // Returns the number of used entries.
+  int64_t get_occupancy();
+
+  // Returns the number of entries that have been evicted to make room for new
+  // ones since the cache file was created.
+  int64_t get_evictions();
+
 private:
   struct Bucket;
   struct Entry;
   struct Key;
   struct SharedRegion;
   using BucketHandler = std::function<void(Bucket* bucket)>;
+  using RegionHandler = std::function<void(SharedRegion* sr)>;
 
-  bool mmap_file(const std::string& inode_cache_file);
+  static size_t region_size(uint32_t num_buckets);
+  SharedRegion* mmap_file(const std::string& inode_cache_file);
   static bool
   hash_inode(const std::string& path, ContentType type, Digest& digest);
-  bool with_bucket(const Digest& key_digest,
-                   const BucketHandler& bucket_handler);
-  static bool create_new_file(const std::string& filename);
-  bool initialize();
+  static Digest hash_inode(const Stat& stat, ContentType type);
+  static Bucket* get_bucket(SharedRegion* sr, uint32_t index);
+  static uint32_t get_bucket_index(const SharedRegion* sr,
+                                   const Digest& key_digest);
+  static bool read_bucket(const Bucket* bucket, Entry* entries);
+  bool with_bucket(SharedRegion* sr,
+                   uint32_t index,
+                   const BucketHandler& bucket_handler,
+                   bool wait = true);
+  static bool create_new_file(const std::string& filename,
+                              uint32_t num_buckets,
+                              const RegionHandler& populate = nullptr);
+  void grow(SharedRegion* sr);
+  SharedRegion* initialize();
 
   const Config& m_config;
-  struct SharedRegion* m_sr = nullptr;
+  const uint32_t m_initial_num_buckets;
+  SharedRegion* m_sr = nullptr;
+  // Regions replaced by a larger cache file. They stay mapped until
+  // destruction since other threads may still use them.
+  std::vector<SharedRegion*> m_retired_regions;
   bool m_failed = false;
+  std::mutex m_initialization_mutex; // Guards m_sr and m_retired_regions.
 };
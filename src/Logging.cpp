@@ -45,10 +45,15 @@
 #  include <tchar.h>
 #endif
 
+#include <mutex>
+
 using nonstd::string_view;
 
 namespace {
 
+// Serializes logging from helper threads.
+std::mutex log_mutex;
+
 // Logfile path and file handle, read from Config::log_file().
 std::string logfile_path;
 File logfile;
@@ -78,6 +83,8 @@ print_fatal_error_and_exit()
 void
 do_log(string_view message, bool bulk)
 {
+  std::lock_guard<std::mutex> lock(log_mutex);
+
   static char prefix[200];
 
   if (!bulk) {
@@ -29,10 +29,16 @@
 #include "Hash.hpp"
 #include "Logging.hpp"
 #include "Sloppiness.hpp"
+#include "ThreadPool.hpp"
 #include "fmtmacros.hpp"
 #include "hashutil.hpp"
 
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
 #include <memory>
+#include <mutex>
+#include <thread>
 
 // Manifest data format
 // ====================
@@ -284,13 +290,6 @@ private:
   }
 };
 
-struct FileStats
-{
-  uint64_t size;
-  int64_t mtime;
-  int64_t ctime;
-};
-
 std::unique_ptr<ManifestData>
 read_manifest(const std::string& path, FILE* dump_stream = nullptr)
 {
@@ -412,13 +411,55 @@ write_manifest(const Config& config,
   return true;
 }
 
+// Hash include files on worker threads if at least this many need hashing.
+const size_t k_min_files_for_parallel_hashing = 4;
+
+// Maximum number of worker threads used for hashing include files.
+const unsigned k_max_hashing_threads = 8;
+
+struct FileToHash
+{
+  const std::string* path;
+  const FileInfo* fi;
+  size_t size;
+};
+
+// Hash `file` and record its digest in `hashed_files` (guarded by `mutex`).
+// Returns true if the digest matches the one recorded in the manifest.
+bool
+hash_and_compare(const Context& ctx,
+                 const FileToHash& file,
+                 std::unordered_map<std::string, Digest>& hashed_files,
+                 std::mutex& mutex)
+{
+  Hash hash;
+  int ret = hash_source_code_file(ctx, hash, *file.path, file.size);
+  if (ret & HASH_SOURCE_CODE_ERROR) {
+    LOG("Failed hashing {}", *file.path);
+    return false;
+  }
+  if (ret & HASH_SOURCE_CODE_FOUND_TIME) {
+    return false;
+  }
+
+  Digest actual = hash.digest();
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    hashed_files.emplace(*file.path, actual);
+  }
+  return file.fi->digest == actual;
+}
+
 bool
 verify_result(const Context& ctx,
               const ManifestData& mf,
               const ResultEntry& result,
-              std::unordered_map<std::string, FileStats>& stated_files,
-              std::unordered_map<std::string, Digest>& hashed_files)
+              std::unordered_map<std::string, Stat>& stated_files,
+              std::unordered_map<std::string, Digest>& hashed_files,
+              std::unique_ptr<ThreadPool>& thread_pool)
 {
+  std::vector<FileToHash> files_to_hash;
+
   for (uint32_t file_info_index : result.file_info_indexes) {
     const auto& fi = mf.file_infos[file_info_index];
     const auto& path = mf.files[fi.index];
@@ -429,15 +470,11 @@ verify_result(const Context& ctx,
       if (!file_stat) {
         return false;
       }
-      FileStats st;
-      st.size = file_stat.size();
-      st.mtime = file_stat.mtime();
-      st.ctime = file_stat.ctime();
-      stated_files_iter = stated_files.emplace(path, st).first;
+      stated_files_iter = stated_files.emplace(path, file_stat).first;
     }
-    const FileStats& fs = stated_files_iter->second;
+    const Stat& fs = stated_files_iter->second;
 
-    if (fi.fsize != fs.size) {
+    if (fi.fsize != static_cast<uint64_t>(fs.size())) {
       return false;
     }
 
@@ -446,21 +483,21 @@ verify_result(const Context& ctx,
     if ((ctx.config.compiler_type() == CompilerType::clang
          || ctx.config.compiler_type() == CompilerType::other)
         && ctx.args_info.output_is_precompiled_header
-        && !ctx.args_info.fno_pch_timestamp && fi.mtime != fs.mtime) {
+        && !ctx.args_info.fno_pch_timestamp && fi.mtime != fs.mtime()) {
       LOG("Precompiled header includes {}, which has a new mtime", path);
       return false;
     }
 
     if (ctx.config.sloppiness() & SLOPPY_FILE_STAT_MATCHES) {
       if (!(ctx.config.sloppiness() & SLOPPY_FILE_STAT_MATCHES_CTIME)) {
-        if (fi.mtime == fs.mtime && fi.ctime == fs.ctime) {
+        if (fi.mtime == fs.mtime() && fi.ctime == fs.ctime()) {
           LOG("mtime/ctime hit for {}", path);
           continue;
         } else {
           LOG("mtime/ctime miss for {}", path);
         }
       } else {
-        if (fi.mtime == fs.mtime) {
+        if (fi.mtime == fs.mtime()) {
           LOG("mtime hit for {}", path);
           continue;
         } else {
@@ -471,26 +508,65 @@ verify_result(const Context& ctx,
 
     auto hashed_files_iter = hashed_files.find(path);
     if (hashed_files_iter == hashed_files.end()) {
+      // Resolve the digest from the inode cache using the file status we
+      // already have, which avoids opening the file on a hit.
       Hash hash;
-      int ret = hash_source_code_file(ctx, hash, path, fs.size);
-      if (ret & HASH_SOURCE_CODE_ERROR) {
-        LOG("Failed hashing {}", path);
-        return false;
+      const auto ret = hash_source_code_file_cached(ctx, hash, path, fs);
+      if (!ret) {
+        files_to_hash.push_back({&path, &fi, static_cast<size_t>(fs.size())});
+        continue;
       }
-      if (ret & HASH_SOURCE_CODE_FOUND_TIME) {
+      if (*ret & HASH_SOURCE_CODE_FOUND_TIME) {
         return false;
       }
-
-      Digest actual = hash.digest();
-      hashed_files_iter = hashed_files.emplace(path, actual).first;
+      hashed_files_iter = hashed_files.emplace(path, hash.digest()).first;
     }
-
     if (fi.digest != hashed_files_iter->second) {
       return false;
     }
   }
 
-  return true;
+  // The cheap checks have passed, so now hash the files that need it. The
+  // results are kept in hashed_files so that they can be reused when verifying
+  // older results in the manifest.
+  std::mutex mutex;
+  const unsigned hardware_threads = std::thread::hardware_concurrency();
+
+  if (files_to_hash.size() < k_min_files_for_parallel_hashing
+      || hardware_threads < 2) {
+    for (const auto& file : files_to_hash) {
+      if (!hash_and_compare(ctx, file, hashed_files, mutex)) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  if (!thread_pool) {
+    thread_pool = std::make_unique<ThreadPool>(
+      std::min(hardware_threads, k_max_hashing_threads));
+  }
+
+  // Tasks that have not started yet are skipped once a mismatch is found.
+  std::atomic<bool> mismatch(false);
+  size_t remaining = files_to_hash.size();
+  std::condition_variable all_done;
+
+  for (const auto& file : files_to_hash) {
+    thread_pool->enqueue([&, file] {
+      if (!mismatch && !hash_and_compare(ctx, file, hashed_files, mutex)) {
+        mismatch = true;
+      }
+      std::lock_guard<std::mutex> lock(mutex);
+      if (--remaining == 0) {
+        all_done.notify_one();
+      }
+    });
+  }
+
+  std::unique_lock<std::mutex> lock(mutex);
+  all_done.wait(lock, [&] { return remaining == 0; });
+  return !mismatch;
 }
 
 } // namespace
@@ -517,13 +593,18 @@ get(const Context& ctx, const std::string& path)
     return nullopt;
   }
 
-  std::unordered_map<std::string, FileStats> stated_files;
+  std::unordered_map<std::string, Stat> stated_files;
   std::unordered_map<std::string, Digest> hashed_files;
+  std::unique_ptr<ThreadPool> thread_pool;
 
   // Check newest result first since it's a bit more likely to match.
   for (uint32_t i = mf->results.size(); i > 0; i--) {
-    if (verify_result(
-          ctx, *mf, mf->results[i - 1], stated_files, hashed_files)) {
+    if (verify_result(ctx,
+                      *mf,
+                      mf->results[i - 1],
+                      stated_files,
+                      hashed_files,
+                      thread_pool)) {
       return mf->results[i - 1].key;
     }
   }
@@ -0,0 +1,112 @@
+// Copyright (C) 2021 Joel Rosdahl and other contributors
+//
+// See doc/AUTHORS.adoc for a complete list of contributors.
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc., 51
+// Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#include "MappedFile.hpp"
+
+#include "Fd.hpp"
+#include "Logging.hpp"
+#include "Util.hpp"
+
+#ifndef _WIN32
+#  include <sys/mman.h>
+#endif
+
+namespace {
+
+// Smaller files are cheaper to read than to map.
+const size_t k_min_size_to_map = 64 * 1024;
+
+} // namespace
+
+MappedFile::MappedFile(const std::string& path,
+                       size_t size_hint,
+                       Mapping mapping)
+{
+  if (mapping == Mapping::if_large
+      && (size_hint == 0 || size_hint >= k_min_size_to_map) && map(path)) {
+    return;
+  }
+  m_buffer = Util::read_file(path, size_hint);
+  m_size = m_buffer.size();
+}
+
+MappedFile::~MappedFile()
+{
+#ifndef _WIN32
+  if (m_map) {
+    munmap(m_map, m_map_size);
+  }
+#endif
+}
+
+bool
+MappedFile::map(const std::string& path)
+{
+#ifdef _WIN32
+  (void)path;
+  return false;
+#else
+  Fd fd(open(path.c_str(), O_RDONLY | O_BINARY));
+  if (!fd) {
+    return false;
+  }
+  struct stat st;
+  if (fstat(*fd, &st) != 0 || !S_ISREG(st.st_mode)
+      || static_cast<size_t>(st.st_size) < k_min_size_to_map) {
+    return false;
+  }
+  bool is_nfs;
+  if (Util::is_nfs_fd(*fd, &is_nfs) == 0 && is_nfs) {
+    return false;
+  }
+
+  const size_t size = st.st_size;
+
+  // Reserve one byte more than the file size with an anonymous mapping and map
+  // the file on top of it. The byte after the content is then zero, either
+  // from the file's last page or from the anonymous page following it.
+  const size_t map_size = size + 1;
+  void* region = mmap(nullptr,
+                      map_size,
+                      PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS,
+                      -1,
+                      0);
+  if (region == MAP_FAILED) {
+    LOG("Failed to reserve memory for mapping {}: {}", path, strerror(errno));
+    return false;
+  }
+  if (mmap(region,
+           size,
+           PROT_READ | PROT_WRITE,
+           MAP_PRIVATE | MAP_FIXED,
+           *fd,
+           0)
+      == MAP_FAILED) {
+    LOG("Failed to mmap {}: {}", path, strerror(errno));
+    munmap(region, map_size);
+    return false;
+  }
+  posix_madvise(region, size, POSIX_MADV_SEQUENTIAL);
+
+  m_map = static_cast<char*>(region);
+  m_map_size = map_size;
+  m_size = size;
+  return true;
+#endif
+}
@@ -0,0 +1,100 @@
+// Copyright (C) 2021 Joel Rosdahl and other contributors
+//
+// See doc/AUTHORS.adoc for a complete list of contributors.
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc., 51
+// Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#pragma once
+
+#include "system.hpp"
+
+#include "NonCopyable.hpp"
+
+#include "third_party/nonstd/string_view.hpp"
+
+#include <string>
+
+// Content of a file, either mapped into memory or read into a buffer.
+//
+// If requested, regular files of at least 64 KiB that are not on NFS are
+// mapped privately with mmap(2), which avoids allocating and copying large
+// files like preprocessor output when they are only scanned and hashed. Other
+// files, and all files on Windows, are read with Util::read_file.
+//
+// The content is always followed by a NUL byte and may be modified in place;
+// modifications are never written back to the file.
+class MappedFile : NonCopyable
+{
+public:
+  enum class Mapping {
+    // Always read the file.
+    never,
+    // Map the file if it's large enough. Accessing a mapped file that someone
+    // else truncates raises SIGBUS, so only use this for files owned by
+    // ccache, like temporary files.
+    if_large,
+  };
+
+  // Throws Error on failure.
+  explicit MappedFile(const std::string& path,
+                      size_t size_hint = 0,
+                      Mapping mapping = Mapping::never);
+  ~MappedFile();
+
+  char* data();
+  const char* data() const;
+  size_t size() const;
+  nonstd::string_view view() const;
+
+  bool is_mapped() const;
+
+private:
+  std::string m_buffer;
+  char* m_map = nullptr;
+  size_t m_map_size = 0;
+  size_t m_size = 0;
+
+  bool map(const std::string& path);
+};
+
+inline char*
+MappedFile::data()
+{
+  return m_map ? m_map : &m_buffer[0];
+}
+
+inline const char*
+MappedFile::data() const
+{
+  return m_map ? m_map : m_buffer.data();
+}
+
+inline size_t
+MappedFile::size() const
+{
+  return m_size;
+}
+
+inline nonstd::string_view
+MappedFile::view() const
+{
+  return nonstd::string_view(data(), m_size);
+}
+
+inline bool
+MappedFile::is_mapped() const
+{
+  return m_map != nullptr;
+}
@@ -0,0 +1,196 @@
+// Copyright (C) 2021 Joel Rosdahl and other contributors
+//
+// See doc/AUTHORS.adoc for a complete list of contributors.
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc., 51
+// Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#include "SharedBuckets.hpp"
+
+#include "Fd.hpp"
+#include "Finalizer.hpp"
+#include "Logging.hpp"
+#include "TemporaryFile.hpp"
+#include "Util.hpp"
+
+#include <sys/mman.h>
+
+namespace SharedBuckets {
+
+void*
+map_file(const std::string& path,
+         const char* description,
+         uint32_t version,
+         size_t min_size,
+         size_t& size)
+{
+  Fd fd(open(path.c_str(), O_RDWR));
+  if (!fd) {
+    LOG("Failed to open {} {}: {}", description, path, strerror(errno));
+    return nullptr;
+  }
+  bool is_nfs;
+  if (Util::is_nfs_fd(*fd, &is_nfs) == 0 && is_nfs) {
+    LOG("{} not supported because the file is located on nfs: {}",
+        description,
+        path);
+    return nullptr;
+  }
+  struct stat st;
+  if (fstat(*fd, &st) != 0 || static_cast<size_t>(st.st_size) < min_size
+      || static_cast<size_t>(st.st_size) < sizeof(uint32_t)) {
+    LOG("Dropping {} {} because of unexpected size", description, path);
+    unlink(path.c_str());
+    return nullptr;
+  }
+  void* region =
+    mmap(nullptr, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, *fd, 0);
+  fd.close();
+  if (region == MAP_FAILED) {
+    LOG("Failed to mmap {}: {}", path, strerror(errno));
+    return nullptr;
+  }
+  // Drop the file from disk if the found version is not matching. This will
+  // allow a new file to be generated.
+  const uint32_t found_version = *static_cast<uint32_t*>(region);
+  if (found_version != version) {
+    LOG("Dropping {} because found version {} does not match expected version"
+        " {}",
+        description,
+        found_version,
+        version);
+    munmap(region, st.st_size);
+    unlink(path.c_str());
+    return nullptr;
+  }
+  size = st.st_size;
+  return region;
+}
+
+bool
+create_file(const std::string& path,
+            const char* description,
+            uint32_t version,
+            size_t size,
+            const std::function<void(void* region)>& initialize,
+            bool replace)
+{
+  // Create the new file to a temporary name to prevent other processes from
+  // mapping it before it is fully initialized.
+  TemporaryFile tmp_file(path);
+
+  Finalizer temp_file_remover([&] { unlink(tmp_file.path.c_str()); });
+
+  bool is_nfs;
+  if (Util::is_nfs_fd(*tmp_file.fd, &is_nfs) == 0 && is_nfs) {
+    LOG("{} not supported because the file would be located on nfs: {}",
+        description,
+        path);
+    return false;
+  }
+  int err = Util::fallocate(*tmp_file.fd, size);
+  if (err) {
+    LOG("Failed to allocate file space for {}: {}", description, strerror(err));
+    return false;
+  }
+  void* region = mmap(
+    nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, *tmp_file.fd, 0);
+  if (region == MAP_FAILED) {
+    LOG("Failed to mmap new {}: {}", description, strerror(errno));
+    return false;
+  }
+
+  *static_cast<uint32_t*>(region) = version;
+  initialize(region);
+
+  munmap(region, size);
+  tmp_file.fd.close();
+
+  if (replace) {
+    // Replace the current file atomically. Processes that have the old file
+    // mapped keep using it until they notice that it has been replaced.
+    if (rename(tmp_file.path.c_str(), path.c_str()) != 0) {
+      LOG("Failed to rename new {}: {}", description, strerror(errno));
+      return false;
+    }
+    return true;
+  }
+
+  // link() will fail silently if a file with the same name already exists.
+  // This will be the case if two processes try to create a new file
+  // simultaneously, so callers should map the file that landed on disk instead
+  // of assuming that it is the one created here.
+  if (link(tmp_file.path.c_str(), path.c_str()) != 0) {
+    LOG("Failed to link new {}: {}", description, strerror(errno));
+    return false;
+  }
+  return true;
+}
+
+void
+initialize_mutexes(
+  uint32_t count, const std::function<pthread_mutex_t*(uint32_t)>& get_mutex)
+{
+  pthread_mutexattr_t mattr;
+  pthread_mutexattr_init(&mattr);
+  pthread_mutexattr_setpshared(&mattr, PTHREAD_PROCESS_SHARED);
+#ifdef HAVE_PTHREAD_MUTEX_ROBUST
+  pthread_mutexattr_setrobust(&mattr, PTHREAD_MUTEX_ROBUST);
+#endif
+  for (uint32_t i = 0; i < count; ++i) {
+    pthread_mutex_init(get_mutex(i), &mattr);
+  }
+  pthread_mutexattr_destroy(&mattr);
+}
+
+LockResult
+lock(pthread_mutex_t* mutex,
+     bool wait,
+     const char* description,
+     uint32_t index)
+{
+  int err = wait ? pthread_mutex_lock(mutex) : pthread_mutex_trylock(mutex);
+#ifdef HAVE_PTHREAD_MUTEX_ROBUST
+  if (err == EOWNERDEAD) {
+    err = pthread_mutex_consistent(mutex);
+    if (err) {
+      LOG("Can't consolidate stale {} mutex at index {}: {}",
+          description,
+          index,
+          strerror(err));
+      LOG("Consider removing the {} file if the problem persists",
+          description);
+      return LockResult::failed;
+    }
+    LOG("Wiping {} bucket at index {} because of stale mutex",
+        description,
+        index);
+    return LockResult::stale;
+  }
+#endif
+  if (err == EBUSY && !wait) {
+    return LockResult::busy;
+  }
+  if (err != 0) {
+    LOG("Failed to lock {} mutex at index {}: {}",
+        description,
+        index,
+        strerror(err));
+    LOG("Consider removing the {} file if the problem persists", description);
+    return LockResult::failed;
+  }
+  return LockResult::locked;
+}
+
+} // namespace SharedBuckets
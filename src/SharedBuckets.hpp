@@ -0,0 +1,80 @@
+// Copyright (C) 2021 Joel Rosdahl and other contributors
+//
+// See doc/AUTHORS.adoc for a complete list of contributors.
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc., 51
+// Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#pragma once
+
+#include "system.hpp"
+
+#include "config.h"
+
+#include <pthread.h>
+
+#include <functional>
+#include <string>
+
+// Support for hash tables of mutex guarded buckets that reside in a file mapped
+// into shared memory by all running ccache processes, like the inode cache and
+// the negative lookup cache. The file starts with a uint32_t version number.
+// The mutexes are shared between processes and, if supported, robust so that a
+// process dying while holding one doesn't block the others.
+namespace SharedBuckets {
+
+enum class LockResult {
+  locked, // The mutex was locked.
+  stale,  // The mutex was locked but its previous owner died while holding it,
+          // so the data it guards may be inconsistent.
+  busy,   // The mutex is held by someone else (only when not waiting).
+  failed, // The mutex could not be locked.
+};
+
+// Map the file `path` into shared memory. Returns nullptr if the file can't be
+// mapped. If the file is smaller than `min_size` or doesn't start with
+// `version`, it is also removed so that it can be recreated. On success, `size`
+// is set to the size of the mapping. `description` is used for logging.
+void* map_file(const std::string& path,
+               const char* description,
+               uint32_t version,
+               size_t min_size,
+               size_t& size);
+
+// Create a file of `size` bytes at `path`, starting with `version`. The rest of
+// the content is zero-filled and then set up by `initialize`, which is called
+// with the mapped content before the file gets its final name so that other
+// processes never see a partially initialized file. If `replace` is false, an
+// existing file (e.g. created by another process that won a race) is kept and
+// false is returned. `description` is used for logging.
+bool create_file(const std::string& path,
+                 const char* description,
+                 uint32_t version,
+                 size_t size,
+                 const std::function<void(void* region)>& initialize,
+                 bool replace = false);
+
+// Initialize `count` mutexes, the i-th one given by `get_mutex(i)`, to be
+// shared between processes.
+void initialize_mutexes(
+  uint32_t count, const std::function<pthread_mutex_t*(uint32_t)>& get_mutex);
+
+// Lock `mutex`, guarding bucket `index`. Failures are logged using
+// `description`.
+LockResult lock(pthread_mutex_t* mutex,
+                bool wait,
+                const char* description,
+                uint32_t index);
+
+} // namespace SharedBuckets
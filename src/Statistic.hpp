@@ -53,6 +53,12 @@ enum class Statistic {
   unsupported_code_directive = 30,
   stats_zeroed_timestamp = 31,
   could_not_use_modules = 32,
+  secondary_storage_upload_queued = 33,
+  secondary_storage_upload_failed = 34,
+  secondary_storage_upload_dropped = 35,
+  secondary_storage_error = 36,
+  secondary_storage_timeout = 37,
+  secondary_storage_skipped = 38,
 
   END
 };
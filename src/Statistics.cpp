@@ -178,6 +178,15 @@ const StatisticsField k_statistics_fields[] = {
   STATISTICS_FIELD(bad_output_file, "could not write to output file"),
   STATISTICS_FIELD(no_input_file, "no input file"),
   STATISTICS_FIELD(error_hashing_extra_file, "error hashing extra file"),
+  STATISTICS_FIELD(secondary_storage_upload_queued,
+                   "secondary storage uploads queued"),
+  STATISTICS_FIELD(secondary_storage_upload_failed,
+                   "secondary storage uploads failed"),
+  STATISTICS_FIELD(secondary_storage_upload_dropped,
+                   "secondary storage uploads lost"),
+  STATISTICS_FIELD(secondary_storage_error, "secondary storage errors"),
+  STATISTICS_FIELD(secondary_storage_timeout, "secondary storage timeouts"),
+  STATISTICS_FIELD(secondary_storage_skipped, "secondary storage skipped"),
   STATISTICS_FIELD(
     cleanups_performed, "cleanups performed", FLAG_NOSTATSLOG | FLAG_ALWAYS),
   STATISTICS_FIELD(files_in_cache,
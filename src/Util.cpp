@@ -24,6 +24,7 @@
 #include "FormatNonstdStringView.hpp"
 #include "Logging.hpp"
 #include "TemporaryFile.hpp"
+#include "ThreadPool.hpp"
 #include "fmtmacros.hpp"
 
 #include <util/Tokenizer.hpp>
@@ -34,7 +35,11 @@ extern "C" {
 }
 
 #include <algorithm>
+#include <array>
+#include <exception>
 #include <fstream>
+#include <mutex>
+#include <numeric>
 
 #ifndef HAVE_DIRENT_H
 #  include <filesystem>
@@ -61,6 +66,7 @@ extern "C" {
 #endif
 
 #ifdef __linux__
+#  include <sys/syscall.h>
 #  ifdef HAVE_SYS_IOCTL_H
 #    include <sys/ioctl.h>
 #  endif
@@ -211,11 +217,10 @@ change_extension(string_view path, string_view new_ext)
   return std::string(without_ext).append(new_ext.data(), new_ext.length());
 }
 
-#ifdef FILE_CLONING_SUPPORTED
 void
 clone_file(const std::string& src, const std::string& dest, bool via_tmp_file)
 {
-#  if defined(__linux__)
+#if defined(FILE_CLONING_SUPPORTED) && defined(__linux__)
   Fd src_fd(open(src.c_str(), O_RDONLY));
   if (!src_fd) {
     throw Error("{}: {}", src, strerror(errno));
@@ -236,7 +241,11 @@ clone_file(const std::string& src, const std::string& dest, bool via_tmp_file)
   }
 
   if (ioctl(*dest_fd, FICLONE, *src_fd) != 0) {
-    throw Error(strerror(errno));
+    const int saved_errno = errno;
+    if (via_tmp_file) {
+      Util::unlink_tmp(tmp_file);
+    }
+    throw Error(strerror(saved_errno));
   }
 
   dest_fd.close();
@@ -245,19 +254,18 @@ clone_file(const std::string& src, const std::string& dest, bool via_tmp_file)
   if (via_tmp_file) {
     Util::rename(tmp_file, dest);
   }
-#  elif defined(__APPLE__)
+#elif defined(FILE_CLONING_SUPPORTED) && defined(__APPLE__)
   (void)via_tmp_file;
   if (clonefile(src.c_str(), dest.c_str(), CLONE_NOOWNERCOPY) != 0) {
     throw Error(strerror(errno));
   }
-#  else
+#else
   (void)src;
   (void)dest;
   (void)via_tmp_file;
   throw Error(strerror(EOPNOTSUPP));
-#  endif
+#endif
 }
-#endif // FILE_CLONING_SUPPORTED
 
 void
 clone_hard_link_or_copy_file(const Context& ctx,
@@ -499,16 +507,52 @@ fallocate(int fd, long new_size)
 void
 for_each_level_1_subdir(const std::string& cache_dir,
                         const SubdirVisitor& visitor,
-                        const ProgressReceiver& progress_receiver)
-{
-  for (int i = 0; i <= 0xF; i++) {
-    double progress = 1.0 * i / 16;
-    progress_receiver(progress);
-    std::string subdir_path = FMT("{}/{:x}", cache_dir, i);
-    visitor(subdir_path, [&](double inner_progress) {
-      progress_receiver(progress + inner_progress / 16);
+                        const ProgressReceiver& progress_receiver,
+                        size_t threads)
+{
+  if (threads <= 1) {
+    for (int i = 0; i <= 0xF; i++) {
+      double progress = 1.0 * i / 16;
+      progress_receiver(progress);
+      std::string subdir_path = FMT("{}/{:x}", cache_dir, i);
+      visitor(subdir_path, [&](double inner_progress) {
+        progress_receiver(progress + inner_progress / 16);
+      });
+    }
+    progress_receiver(1.0);
+    return;
+  }
+
+  std::mutex mutex; // Protects the variables below.
+  std::array<double, 16> subdir_progress{};
+  std::exception_ptr exception;
+
+  ThreadPool thread_pool(std::min(threads, subdir_progress.size()));
+  progress_receiver(0.0);
+  for (size_t i = 0; i < subdir_progress.size(); ++i) {
+    thread_pool.enqueue([&, i] {
+      try {
+        visitor(FMT("{}/{:x}", cache_dir, i), [&](double inner_progress) {
+          std::lock_guard<std::mutex> lock(mutex);
+          subdir_progress[i] = inner_progress;
+          progress_receiver(std::accumulate(subdir_progress.begin(),
+                                            subdir_progress.end(),
+                                            0.0)
+                            / subdir_progress.size());
+        });
+      } catch (...) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!exception) {
+          exception = std::current_exception();
+        }
+      }
     });
   }
+  thread_pool.shut_down();
+
+  if (exception) {
+    std::rethrow_exception(exception);
+  }
   progress_receiver(1.0);
 }
 
@@ -657,7 +701,8 @@ get_level_1_files(const std::string& dir,
 
   Util::traverse(dir, [&](const std::string& path, bool is_dir) {
     auto name = Util::base_name(path);
-    if (name == "CACHEDIR.TAG" || name == "stats" || name.starts_with(".nfs")) {
+    if (name == "CACHEDIR.TAG" || name == "stats" || name == "lru"
+        || name == "levels" || name.starts_with(".nfs")) {
       return;
     }
 
@@ -846,6 +891,30 @@ localtime(optional<time_t> time)
   }
 }
 
+void
+lower_process_priority()
+{
+#ifndef _WIN32
+  errno = 0;
+  if (nice(19) == -1 && errno != 0) {
+    LOG("Failed to lower CPU priority: {}", strerror(errno));
+  }
+#endif
+#if defined(__linux__) && defined(SYS_ioprio_set)
+  // Values from linux/ioprio.h, which isn't available everywhere.
+  const int ioprio_who_process = 1;
+  const int ioprio_class_idle = 3;
+  const int ioprio_class_shift = 13;
+  if (syscall(SYS_ioprio_set,
+              ioprio_who_process,
+              0,
+              ioprio_class_idle << ioprio_class_shift)
+      != 0) {
+    LOG("Failed to lower I/O priority: {}", strerror(errno));
+  }
+#endif
+}
+
 std::string
 make_relative_path(const std::string& base_dir,
                    const std::string& actual_cwd,
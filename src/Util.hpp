@@ -158,9 +158,14 @@ int fallocate(int fd, long new_size);
 // - visitor: Function to call with directory path and progress_receiver as
 //   arguments.
 // - progress_receiver: Function that will be called for progress updates.
+// - threads: Number of subdirectories to visit concurrently. If more than one,
+//   `visitor` must be thread-safe. Calls to `progress_receiver` are serialized
+//   and the first exception thrown by `visitor` is rethrown when all visits are
+//   done.
 void for_each_level_1_subdir(const std::string& cache_dir,
                              const SubdirVisitor& visitor,
-                             const ProgressReceiver& progress_receiver);
+                             const ProgressReceiver& progress_receiver,
+                             size_t threads = 1);
 
 // Format `argv` as a simple string for logging purposes. That is, the result is
 // not intended to be machine parsable. `argv` must be terminated by a nullptr.
@@ -203,6 +208,8 @@ nonstd::string_view get_extension(nonstd::string_view path);
 // Files ignored:
 // - CACHEDIR.TAG
 // - stats
+// - lru
+// - levels
 // - .nfs* (temporary NFS files that may be left for open but deleted files).
 //
 // Parameters:
@@ -305,6 +312,10 @@ bool is_precompiled_header(nonstd::string_view path);
 // time of day is used.
 nonstd::optional<tm> localtime(nonstd::optional<time_t> time = {});
 
+// Lower the CPU and (where supported) I/O scheduling priority of the current
+// process so that it interferes as little as possible with other work.
+void lower_process_priority();
+
 // Make a relative path from current working directory (either `actual_cwd` or
 // `apparent_cwd`) to `path` if `path` is under `base_dir`.
 std::string make_relative_path(const std::string& base_dir,
@@ -21,6 +21,7 @@
 
 #include "Args.hpp"
 #include "ArgsInfo.hpp"
+#include "AtomicFile.hpp"
 #include "Checksum.hpp"
 #include "Compression.hpp"
 #include "Context.hpp"
@@ -33,6 +34,7 @@
 #include "Lockfile.hpp"
 #include "Logging.hpp"
 #include "Manifest.hpp"
+#include "MappedFile.hpp"
 #include "MiniTrace.hpp"
 #include "ProgressBar.hpp"
 #include "Result.hpp"
@@ -42,6 +44,7 @@
 #include "SignalHandler.hpp"
 #include "Statistics.hpp"
 #include "TemporaryFile.hpp"
+#include "ThreadPool.hpp"
 #include "UmaskScope.hpp"
 #include "Util.hpp"
 #include "argprocessing.hpp"
@@ -76,9 +79,13 @@ extern "C" {
 #endif
 
 #include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <cmath>
+#include <functional>
 #include <limits>
 #include <memory>
+#include <thread>
 
 #ifndef MYNAME
 #  define MYNAME "ccache"
@@ -122,12 +129,18 @@ Common options:
                                with a d (days) or s (seconds) suffix)
     -F, --max-files NUM        set maximum number of files in cache to NUM (use
                                0 for no limit)
+    -j, --jobs NUM             use NUM threads for --cleanup, --clear,
+                               --evict-older-than and --recompress given after
+                               this option; default: number of CPUs
     -M, --max-size SIZE        set maximum size of cache to SIZE (use 0 for no
                                limit); available suffixes: k, M, G, T (decimal)
                                and Ki, Mi, Gi, Ti (binary); default suffix: G
     -X, --recompress LEVEL     recompress the cache to level LEVEL (integer or
                                "uncompressed") using the Zstandard algorithm;
                                see "Cache compression" in the manual for details
+        --reshard              move entries in file secondary storage backends
+                               to the directory layout given by their levels
+                               and level-width attributes
     -o, --set-config KEY=VAL   set configuration item KEY to value VAL
     -x, --show-compression     show compression statistics
     -p, --show-config          show current configuration options in
@@ -153,6 +166,10 @@ Options for scripting or debugging:
                                PATH
         --print-stats          print statistics counter IDs and corresponding
                                values in machine-parsable format
+        --simulate-eviction SIZE
+                               replay the uses of cache entries recorded in the
+                               cache in a simulated cache of size SIZE with each
+                               eviction policy and print the hit rates
 
 See also the manual on <https://ccache.dev/documentation.html>.
 )";
@@ -330,6 +347,104 @@ include_file_too_new(const Context& ctx,
   return false;
 }
 
+// Maximum number of worker threads used for hashing include files.
+const unsigned k_max_include_hashing_threads = 8;
+
+// Hashes include files for the direct mode on worker threads while the
+// preprocessed output is still being scanned. Include files are registered in
+// ctx.included_files when enqueued, so duplicates are skipped, and their
+// digests are filled in by finish().
+class IncludeFileHasher
+{
+public:
+  explicit IncludeFileHasher(Context& ctx);
+  ~IncludeFileHasher();
+
+  void enqueue(const std::string& path);
+
+  // Wait for all include files to be hashed. Returns false if any of them
+  // could not be used for the direct mode.
+  bool finish();
+
+private:
+  struct Job
+  {
+    std::string path;
+    Digest digest;
+    bool ok = false;
+  };
+
+  Context& m_ctx;
+  std::vector<std::unique_ptr<Job>> m_jobs;
+  std::atomic<bool> m_failed;
+  std::unique_ptr<ThreadPool> m_thread_pool; // Destroyed first.
+
+  void hash(Job& job);
+};
+
+IncludeFileHasher::IncludeFileHasher(Context& ctx) : m_ctx(ctx), m_failed(false)
+{
+}
+
+IncludeFileHasher::~IncludeFileHasher()
+{
+  // Skip pending jobs if the scan was aborted.
+  m_failed = true;
+}
+
+void
+IncludeFileHasher::enqueue(const std::string& path)
+{
+  m_ctx.included_files.emplace(path, Digest());
+  m_jobs.push_back(std::make_unique<Job>());
+  Job* job = m_jobs.back().get();
+  job->path = path;
+
+  const unsigned threads = std::min(std::thread::hardware_concurrency(),
+                                    k_max_include_hashing_threads);
+  if (threads < 2) {
+    hash(*job);
+    return;
+  }
+  if (!m_thread_pool) {
+    m_thread_pool = std::make_unique<ThreadPool>(threads);
+  }
+  m_thread_pool->enqueue([this, job] { hash(*job); });
+}
+
+void
+IncludeFileHasher::hash(Job& job)
+{
+  if (m_failed) {
+    return;
+  }
+  Hash fhash;
+  int result = hash_source_code_file(m_ctx, fhash, job.path);
+  if (result & HASH_SOURCE_CODE_ERROR || result & HASH_SOURCE_CODE_FOUND_TIME) {
+    m_failed = true;
+    return;
+  }
+  job.digest = fhash.digest();
+  job.ok = true;
+}
+
+bool
+IncludeFileHasher::finish()
+{
+  if (m_thread_pool) {
+    m_thread_pool->shut_down();
+    m_thread_pool.reset();
+  }
+  if (m_failed) {
+    return false;
+  }
+  for (const auto& job : m_jobs) {
+    m_ctx.included_files[job->path] = job->digest;
+  }
+  m_jobs.clear();
+  return true;
+}
+
 // Returns false if the include file was "too new" and therefore should disable
 // the direct mode (or, in the case of a preprocessed header, fall back to just
 // running the real compiler), otherwise true.
@@ -338,7 +453,8 @@ do_remember_include_file(Context& ctx,
                          std::string path,
                          Hash& cpp_hash,
                          bool system,
-                         Hash* depend_mode_hash)
+                         Hash* depend_mode_hash,
+                         IncludeFileHasher* include_file_hasher)
 {
   if (path.length() >= 2 && path[0] == '<' && path[path.length() - 1] == '>') {
     // Typically <built-in> or <command-line>.
@@ -441,6 +557,10 @@ do_remember_include_file(Context& ctx,
   }
 
   if (ctx.config.direct_mode()) {
+    if (!is_pch && include_file_hasher) {
+      include_file_hasher->enqueue(path);
+      return true;
+    }
     if (!is_pch) { // else: the file has already been hashed.
       int result = hash_source_code_file(ctx, fhash, path);
       if (result & HASH_SOURCE_CODE_ERROR
@@ -465,15 +585,18 @@ enum class RememberIncludeFileResult { ok, cannot_use_pch };
 
 // This function hashes an include file and stores the path and hash in
 // ctx.included_files. If the include file is a PCH, cpp_hash is also updated.
+// Other include files are hashed asynchronously if `include_file_hasher` is
+// given.
 static RememberIncludeFileResult
 remember_include_file(Context& ctx,
                       const std::string& path,
                       Hash& cpp_hash,
                       bool system,
-                      Hash* depend_mode_hash)
+                      Hash* depend_mode_hash,
+                      IncludeFileHasher* include_file_hasher = nullptr)
 {
   if (!do_remember_include_file(
-        ctx, path, cpp_hash, system, depend_mode_hash)) {
+        ctx, path, cpp_hash, system, depend_mode_hash, include_file_hasher)) {
     if (Util::is_precompiled_header(path)) {
       return RememberIncludeFileResult::cannot_use_pch;
     } else if (ctx.config.direct_mode()) {
@@ -508,21 +631,36 @@ process_preprocessed_file(Context& ctx,
                           const std::string& path,
                           bool pump)
 {
-  std::string data;
+  // Only map the preprocessor output written by ccache, not a .i file given by
+  // the user, which could be truncated while being read.
+  const auto mapping = ctx.args_info.direct_i_file
+                         ? MappedFile::Mapping::never
+                         : MappedFile::Mapping::if_large;
+  std::unique_ptr<MappedFile> file;
   try {
-    data = Util::read_file(path);
+    file = std::make_unique<MappedFile>(path, 0, mapping);
   } catch (Error&) {
     return Statistic::internal_error;
   }
 
+  IncludeFileHasher include_file_hasher(ctx);
+
   // Bytes between p and q are pending to be hashed.
-  const char* p = &data[0];
-  char* q = &data[0];
-  const char* end = p + data.length();
+  char* const data = file->data();
+  const char* p = data;
+  char* q = data;
+  const char* end = p + file->size();
+  const string_view content(data, file->size());
 
   // There must be at least 7 characters (# 1 "x") left to potentially find an
   // include file path.
   while (q < end - 7) {
+    // Skip ahead to the next position that needs a closer look.
+    q = data + find_preprocessed_directive(content, q - data, pump);
+    if (q >= end - 7) {
+      break;
+    }
+
     static const string_view pragma_gcc_pch_preprocess =
       "pragma GCC pch_preprocess ";
     static const string_view hash_31_command_line_newline =
@@ -558,7 +696,7 @@ process_preprocessed_file(Context& ctx,
             // HP/AIX:
             || (q[1] == 'l' && q[2] == 'i' && q[3] == 'n' && q[4] == 'e'
                 && q[5] == ' '))
-        && (q == data.data() || q[-1] == '\n')) {
+        && (q == data || q[-1] == '\n')) {
       // Workarounds for preprocessor linemarker bugs in GCC version 6.
       if (q[2] == '3') {
         if (Util::starts_with(q, hash_31_command_line_newline)) {
@@ -635,7 +773,8 @@ process_preprocessed_file(Context& ctx,
         hash.hash(inc_path);
       }
 
-      if (remember_include_file(ctx, inc_path, hash, system, nullptr)
+      if (remember_include_file(
+            ctx, inc_path, hash, system, nullptr, &include_file_hasher)
           == RememberIncludeFileResult::cannot_use_pch) {
         return Statistic::could_not_use_precompiled_header;
       }
@@ -670,6 +809,11 @@ process_preprocessed_file(Context& ctx,
 
   hash.hash(p, (end - p));
 
+  if (!include_file_hasher.finish() && ctx.config.direct_mode()) {
+    LOG_RAW("Disabling direct mode");
+    ctx.config.set_direct_mode(false);
+  }
+
   // Explicitly check the .gch/.pch/.pth file as Clang does not include any
   // mention of it in the preprocessed output.
   if (!ctx.included_pch_file.empty()) {
@@ -966,6 +1110,7 @@ to_cache(Context& ctx,
   ctx.register_pending_tmp_file(tmp_stderr.path);
   std::string tmp_stderr_path = tmp_stderr.path;
 
+  const auto compile_start = std::chrono::steady_clock::now();
   int status;
   if (!ctx.config.depend_mode()) {
     status =
@@ -984,6 +1129,10 @@ to_cache(Context& ctx,
       ctx, depend_mode_args, std::move(tmp_stdout), std::move(tmp_stderr));
   }
   MTR_END("execute", "compiler");
+  ctx.storage.primary().set_compile_time(
+    std::chrono::duration_cast<std::chrono::milliseconds>(
+      std::chrono::steady_clock::now() - compile_start)
+      .count());
 
   auto st = Stat::stat(tmp_stdout_path, Stat::OnError::log);
   if (!st) {
@@ -1153,14 +1302,104 @@ get_result_key_from_cpp(Context& ctx, Args& args, Hash& hash)
   return hash.digest();
 }
 
+// Hash the file status fields that change when a file at a given path is
+// replaced or modified.
+static void
+hash_file_status(Hash& hash, const Stat& st)
+{
+  hash.hash(static_cast<int64_t>(st.device()));
+  hash.hash(static_cast<int64_t>(st.inode()));
+  hash.hash(static_cast<int64_t>(st.size()));
+  hash.hash(static_cast<int64_t>(st.mtime()));
+  hash.hash(static_cast<int64_t>(st.ctime()));
+}
+
+// Let `identity_hasher` hash the identity of the compiler at `path` (its
+// content or the output of the compiler check command) into `hash`. If
+// compiler_check_cache is enabled, the digest of the identity is hashed instead
+// and stored in the cache directory, keyed by the compiler's path and file
+// status, and reused as long as the compiler is unchanged.
+//
+// Returns false if `identity_hasher` fails.
+static bool
+hash_compiler_identity(const Context& ctx,
+                       Hash& hash,
+                       const Stat& st,
+                       const std::string& path,
+                       const std::function<bool(Hash&)>& identity_hasher)
+{
+  if (!ctx.config.compiler_check_cache()) {
+    return identity_hasher(hash);
+  }
+
+  // The key must not depend on whether the stored digest can be used, so
+  // always hash the digest. In debug mode the identity is computed each time
+  // so that problems with the stored digest can be ruled out.
+  if (ctx.config.debug() || !st) {
+    Hash identity_hash;
+    if (!identity_hasher(identity_hash)) {
+      return false;
+    }
+    const auto digest = identity_hash.digest();
+    hash.hash(digest.bytes(), Digest::size(), Hash::HashType::binary);
+    return true;
+  }
+
+  const char* path_env = getenv("PATH");
+  Hash key_hash;
+  key_hash.hash(ctx.config.compiler_check());
+  key_hash.hash(path);
+  key_hash.hash(ctx.orig_args[0]);
+  key_hash.hash(path_env ? path_env : "");
+  hash_file_status(key_hash, st);
+  const auto identity_path = FMT("{}/compiler-identity/{}",
+                                 ctx.config.cache_dir(),
+                                 key_hash.digest().to_string());
+
+  Digest digest;
+  try {
+    const auto data = Util::read_file(identity_path);
+    if (data.size() == Digest::size()) {
+      LOG("Using cached identity of compiler {}", path);
+      memcpy(digest.bytes(), data.data(), Digest::size());
+      hash.hash(digest.bytes(), Digest::size(), Hash::HashType::binary);
+      return true;
+    }
+  } catch (const Error&) {
+    // Not cached yet.
+  }
+
+  Hash identity_hash;
+  if (!identity_hasher(identity_hash)) {
+    return false;
+  }
+  digest = identity_hash.digest();
+  hash.hash(digest.bytes(), Digest::size(), Hash::HashType::binary);
+
+  if (!ctx.config.read_only()) {
+    try {
+      Util::ensure_dir_exists(Util::dir_name(identity_path));
+      AtomicFile file(identity_path, AtomicFile::Mode::binary);
+      file.write(
+        std::vector<uint8_t>(digest.bytes(), digest.bytes() + Digest::size()));
+      file.commit();
+    } catch (const Error& e) {
+      LOG("Failed to write {}: {}", identity_path, e.what());
+    }
+  }
+  return true;
+}
+
 // Hash mtime or content of a file, or the output of a command, according to
-// the CCACHE_COMPILERCHECK setting.
+// the CCACHE_COMPILERCHECK setting. If `signature_only` is true, the file
+// status is hashed instead of the content or the command output.
 static void
 hash_compiler(const Context& ctx,
               Hash& hash,
               const Stat& st,
               const std::string& path,
-              bool allow_command)
+              bool allow_command,
+              bool signature_only = false)
 {
   if (ctx.config.compiler_check() == "none") {
     // Do nothing.
@@ -1173,10 +1412,31 @@ hash_compiler(const Context& ctx,
     hash.hash(&ctx.config.compiler_check()[7]);
   } else if (ctx.config.compiler_check() == "content" || !allow_command) {
     hash.hash_delimiter("cc_content");
-    hash_binary_file(ctx, hash, path);
+    if (signature_only) {
+      hash.hash(path);
+      hash_file_status(hash, st);
+      return;
+    }
+    hash_compiler_identity(ctx, hash, st, path, [&](Hash& identity_hash) {
+      return hash_binary_file(ctx, identity_hash, path);
+    });
   } else { // command string
-    if (!hash_multicommand_output(
-          hash, ctx.config.compiler_check(), ctx.orig_args[0])) {
+    if (signature_only) {
+      // Same information as the key of a cached compiler identity.
+      const char* path_env = getenv("PATH");
+      hash.hash(ctx.config.compiler_check());
+      hash.hash(path);
+      hash.hash(ctx.orig_args[0]);
+      hash.hash(path_env ? path_env : "");
+      hash_file_status(hash, st);
+      return;
+    }
+    if (!hash_compiler_identity(
+          ctx, hash, st, path, [&](Hash& identity_hash) {
+            return hash_multicommand_output(identity_hash,
+                                            ctx.config.compiler_check(),
+                                            ctx.orig_args[0]);
+          })) {
       LOG("Failure running compiler check command: {}",
           ctx.config.compiler_check());
       throw Failure(Statistic::compiler_check_failed);
@@ -1241,12 +1501,37 @@ should_rewrite_dependency_target(const ArgsInfo& args_info)
   return !args_info.dependency_target_specified && args_info.seen_MD_MMD;
 }
 
+// Hash the content of a file that is part of the common information, or only
+// its path and status if `signature_only` is true.
+static bool
+hash_common_file(const Context& ctx,
+                 Hash& hash,
+                 const std::string& path,
+                 bool signature_only)
+{
+  if (!signature_only) {
+    return hash_binary_file(ctx, hash, path);
+  }
+  const auto st = Stat::stat(path, Stat::OnError::log);
+  if (!st) {
+    return false;
+  }
+  hash.hash(path);
+  hash_file_status(hash, st);
+  return true;
+}
+
 // update a hash with information common for the direct and preprocessor modes.
+//
+// If `signature_only` is true, files whose content would be hashed are instead
+// represented by their path and file status, which makes the resulting hash a
+// cheap signature of the information.
 static void
 hash_common_info(const Context& ctx,
                  const Args& args,
                  Hash& hash,
-                 const ArgsInfo& args_info)
+                 const ArgsInfo& args_info,
+                 bool signature_only = false)
 {
   hash.hash(HASH_PREFIX);
 
@@ -1267,7 +1552,7 @@ hash_common_info(const Context& ctx,
   }
 
   // Hash information about the compiler.
-  hash_compiler(ctx, hash, st, compiler_path, true);
+  hash_compiler(ctx, hash, st, compiler_path, true, signature_only);
 
   // Also hash the compiler name as some compilers use hard links and behave
   // differently depending on the real name.
@@ -1364,7 +1649,7 @@ hash_common_info(const Context& ctx,
   for (const auto& sanitize_blacklist : args_info.sanitize_blacklists) {
     LOG("Hashing sanitize blacklist {}", sanitize_blacklist);
     hash.hash("sanitizeblacklist");
-    if (!hash_binary_file(ctx, hash, sanitize_blacklist)) {
+    if (!hash_common_file(ctx, hash, sanitize_blacklist, signature_only)) {
       throw Failure(Statistic::error_hashing_extra_file);
     }
   }
@@ -1374,7 +1659,7 @@ hash_common_info(const Context& ctx,
            ctx.config.extra_files_to_hash(), PATH_DELIM)) {
       LOG("Hashing extra file {}", path);
       hash.hash_delimiter("extrafile");
-      if (!hash_binary_file(ctx, hash, path)) {
+      if (!hash_common_file(ctx, hash, path, signature_only)) {
         throw Failure(Statistic::error_hashing_extra_file);
       }
     }
@@ -1390,6 +1675,49 @@ hash_common_info(const Context& ctx,
   }
 }
 
+// Like hash_common_info but, if common_hash_cache is enabled, reuse the hash
+// state stored in the cache directory by an earlier invocation with the same
+// common information signature.
+static void
+hash_common_info_cached(const Context& ctx, const Args& args, Hash& hash)
+{
+  // Don't hide the common information from the hash debug files.
+  if (!ctx.config.common_hash_cache() || ctx.config.debug()) {
+    hash_common_info(ctx, args, hash, ctx.args_info);
+    return;
+  }
+
+  Hash signature;
+  signature.hash(CCACHE_VERSION);
+  signature.hash(static_cast<int64_t>(hash.state().size()));
+  hash_common_info(ctx, args, signature, ctx.args_info, true);
+  const auto state_path = FMT("{}/common-hash/{}",
+                              ctx.config.cache_dir(),
+                              signature.digest().to_string());
+
+  try {
+    if (hash.set_state(Util::read_file(state_path))) {
+      LOG("Using cached common hash state {}", state_path);
+      return;
+    }
+  } catch (const Error&) {
+    // Not cached yet.
+  }
+
+  hash_common_info(ctx, args, hash, ctx.args_info);
+
+  if (!ctx.config.read_only()) {
+    try {
+      Util::ensure_dir_exists(Util::dir_name(state_path));
+      AtomicFile file(state_path, AtomicFile::Mode::binary);
+      file.write(hash.state());
+      file.commit();
+    } catch (const Error& e) {
+      LOG("Failed to write {}: {}", state_path, e.what());
+    }
+  }
+}
+
 static bool
 hash_profile_data_file(const Context& ctx, Hash& hash)
 {
@@ -2108,8 +2436,7 @@ do_cache_compilation(Context& ctx, const char* const* argv)
   init_hash_debug(ctx, common_hash, 'c', "COMMON", debug_text_file);
 
   MTR_BEGIN("hash", "common_hash");
-  hash_common_info(
-    ctx, processed.preprocessor_args, common_hash, ctx.args_info);
+  hash_common_info_cached(ctx, processed.preprocessor_args, common_hash);
   MTR_END("hash", "common_hash");
 
   // Try to find the hash using the manifest.
@@ -2241,7 +2568,9 @@ handle_main_options(int argc, const char* const* argv)
     EXTRACT_RESULT,
     HASH_FILE,
     PRINT_STATS,
+    RESHARD,
     SHOW_LOG_STATS,
+    SIMULATE_EVICTION,
   };
   static const struct option options[] = {
     {"checksum-file", required_argument, nullptr, CHECKSUM_FILE},
@@ -2256,23 +2585,28 @@ handle_main_options(int argc, const char* const* argv)
     {"get-config", required_argument, nullptr, 'k'},
     {"hash-file", required_argument, nullptr, HASH_FILE},
     {"help", no_argument, nullptr, 'h'},
+    {"jobs", required_argument, nullptr, 'j'},
     {"max-files", required_argument, nullptr, 'F'},
     {"max-size", required_argument, nullptr, 'M'},
     {"print-stats", no_argument, nullptr, PRINT_STATS},
     {"recompress", required_argument, nullptr, 'X'},
+    {"reshard", no_argument, nullptr, RESHARD},
     {"set-config", required_argument, nullptr, 'o'},
     {"show-compression", no_argument, nullptr, 'x'},
     {"show-config", no_argument, nullptr, 'p'},
     {"show-log-stats", no_argument, nullptr, SHOW_LOG_STATS},
     {"show-stats", no_argument, nullptr, 's'},
+    {"simulate-eviction", required_argument, nullptr, SIMULATE_EVICTION},
     {"version", no_argument, nullptr, 'V'},
     {"zero-stats", no_argument, nullptr, 'z'},
     {nullptr, 0, nullptr, 0}};
 
+  size_t threads = std::max(1u, std::thread::hardware_concurrency());
+
   int c;
   while ((c = getopt_long(argc,
                           const_cast<char* const*>(argv),
-                          "cCd:k:hF:M:po:sVxX:z",
+                          "cCd:j:k:hF:M:po:sVxX:z",
                           options,
                           nullptr))
          != -1) {
@@ -2312,7 +2646,10 @@ handle_main_options(int argc, const char* const* argv)
       auto seconds = Util::parse_duration(arg);
       ProgressBar progress_bar("Evicting...");
       clean_old(
-        ctx, [&](double progress) { progress_bar.update(progress); }, seconds);
+        ctx,
+        [&](double progress) { progress_bar.update(progress); },
+        seconds,
+        threads);
       if (isatty(STDOUT_FILENO)) {
         PRINT_RAW(stdout, "\n");
       }
@@ -2350,11 +2687,24 @@ handle_main_options(int argc, const char* const* argv)
       break;
     }
 
+    case RESHARD: {
+      ProgressBar progress_bar("Resharding...");
+      const auto moved_entries = ctx.storage.reshard_secondary_storages(
+        [&](double progress) { progress_bar.update(progress); });
+      if (isatty(STDOUT_FILENO)) {
+        PRINT_RAW(stdout, "\n");
+      }
+      PRINT(stdout, "Moved {} entries in secondary storage\n", moved_entries);
+      break;
+    }
+
     case 'c': // --cleanup
     {
       ProgressBar progress_bar("Cleaning...");
-      clean_up_all(ctx.config,
-                   [&](double progress) { progress_bar.update(progress); });
+      clean_up_all(
+        ctx.config,
+        [&](double progress) { progress_bar.update(progress); },
+        threads);
       if (isatty(STDOUT_FILENO)) {
         PRINT_RAW(stdout, "\n");
       }
@@ -2364,7 +2714,8 @@ handle_main_options(int argc, const char* const* argv)
     case 'C': // --clear
     {
       ProgressBar progress_bar("Clearing...");
-      wipe_all(ctx, [&](double progress) { progress_bar.update(progress); });
+      wipe_all(
+        ctx, [&](double progress) { progress_bar.update(progress); }, threads);
       if (isatty(STDOUT_FILENO)) {
         PRINT_RAW(stdout, "\n");
       }
@@ -2379,6 +2730,10 @@ handle_main_options(int argc, const char* const* argv)
       PRINT(stdout, USAGE_TEXT, CCACHE_NAME, CCACHE_NAME);
       exit(EXIT_SUCCESS);
 
+    case 'j': // --jobs
+      threads = Util::parse_unsigned(arg, 1, nullopt, "number of jobs");
+      break;
+
     case 'k': // --get-config
       PRINT(stdout, "{}\n", ctx.config.get_string_value(arg));
       break;
@@ -2448,6 +2803,47 @@ handle_main_options(int argc, const char* const* argv)
         stdout,
         Statistics::format_human_readable(counters, last_updated, false));
       PRINT_RAW(stdout, Statistics::format_config_footer(ctx.config));
+#ifdef INODE_CACHE_SUPPORTED
+      if (ctx.config.inode_cache() && Stat::stat(ctx.inode_cache.get_file())) {
+        PRINT(stdout,
+              "{:32}{:8}\n",
+              "inode cache entries",
+              ctx.inode_cache.get_occupancy());
+        PRINT(stdout,
+              "{:32}{:8}\n",
+              "inode cache capacity",
+              ctx.inode_cache.get_capacity());
+        PRINT(stdout,
+              "{:32}{:8}\n",
+              "inode cache evictions",
+              ctx.inode_cache.get_evictions());
+      }
+#endif
+      break;
+    }
+
+    case SIMULATE_EVICTION: {
+      const uint64_t max_size = Util::parse_size(arg);
+      PRINT(stdout,
+            "{:<8}{:>12}{:>12}{:>12}{:>10}{:>14}\n",
+            "policy",
+            "hits",
+            "misses",
+            "evictions",
+            "hit rate",
+            "time saved");
+      for (const auto policy : {EvictionPolicy::lru, EvictionPolicy::gdsf}) {
+        const auto result = simulate_eviction(ctx.config, policy, max_size);
+        const uint64_t uses = result.hits + result.misses;
+        PRINT(stdout,
+              "{:<8}{:>12}{:>12}{:>12}{:>8.2f} %{:>12.1f} s\n",
+              eviction_policy_to_string(policy),
+              result.hits,
+              result.misses,
+              result.evictions,
+              uses == 0 ? 0.0 : 100.0 * result.hits / uses,
+              result.saved_time / 1000.0);
+      }
       break;
     }
 
@@ -2474,9 +2870,11 @@ handle_main_options(int argc, const char* const* argv)
       }
 
       ProgressBar progress_bar("Recompressing...");
-      compress_recompress(ctx, wanted_level, [&](double progress) {
-        progress_bar.update(progress);
-      });
+      compress_recompress(
+        ctx,
+        wanted_level,
+        [&](double progress) { progress_bar.update(progress); },
+        threads);
       break;
     }
 
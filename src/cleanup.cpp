@@ -22,15 +22,82 @@
 #include "CacheFile.hpp"
 #include "Config.hpp"
 #include "Context.hpp"
+#include "Lockfile.hpp"
 #include "Logging.hpp"
+#include "Stat.hpp"
 #include "Statistics.hpp"
 #include "Util.hpp"
+#include "assertions.hpp"
+#include "fmtmacros.hpp"
+
+#include <storage/primary/LruIndex.hpp>
 
 #ifdef INODE_CACHE_SUPPORTED
 #  include "InodeCache.hpp"
 #endif
 
 #include <algorithm>
+#include <set>
+#include <unordered_map>
+#include <unordered_set>
+
+using storage::primary::LruIndex;
+
+// Raw files of a result are numbered by entry and a result has at most one
+// entry per file type.
+const uint32_t k_max_raw_files_per_result = 8;
+
+// With the GDSF eviction policy, an entry is kept as if it had been used this
+// many seconds later for each use (including when it was stored) and each
+// millisecond of compilation time per KiB of cache space that it occupies.
+const double k_gdsf_seconds_per_cost_density = 3600;
+
+static bool
+is_raw_file_name(nonstd::string_view name)
+{
+  return name.length() >= 2 && name.back() == 'W'
+         && isdigit(static_cast<unsigned char>(name[name.length() - 2]));
+}
+
+// Return the priority of `entry` according to `policy`. Entries with lower
+// priority are evicted first.
+static double
+eviction_priority(EvictionPolicy policy, const LruIndex::Entry& entry)
+{
+  switch (policy) {
+  case EvictionPolicy::gdsf:
+    // GreedyDual-Size-Frequency with the time of last use as the inflation
+    // value, i.e. entries age like with LRU but entries that save much
+    // compilation time per byte and are used often are kept longer.
+    if (entry.size > 0) {
+      const double size_kib = std::max(1.0, entry.size / 1024.0);
+      return entry.time
+             + k_gdsf_seconds_per_cost_density * (1 + entry.hits) * entry.cost
+                 / size_kib;
+    }
+    return entry.time;
+
+  case EvictionPolicy::lru:
+    return entry.time;
+  }
+
+  ASSERT(false);
+}
+
+// Read `index` into a map from entry name to entry.
+static std::unordered_map<std::string, LruIndex::Entry>
+read_index_entries(LruIndex& index)
+{
+  std::unordered_map<std::string, LruIndex::Entry> result;
+  auto entries = index.read();
+  if (entries) {
+    for (auto& entry : *entries) {
+      auto name = entry.name;
+      result.emplace(std::move(name), std::move(entry));
+    }
+  }
+  return result;
+}
 
 static void
 delete_file(const std::string& path,
@@ -46,8 +113,8 @@ delete_file(const std::string& path,
     // delete since the final cache size calculation will be incorrect if they
     // aren't. (This can happen when there are several parallel ongoing
     // cleanups of the same directory.)
-    *cache_size -= size;
-    --*files_in_cache;
+    *cache_size -= std::min(*cache_size, size);
+    *files_in_cache -= std::min<uint64_t>(*files_in_cache, 1);
   }
 }
 
@@ -70,14 +137,17 @@ update_counters(const std::string& dir,
 void
 clean_old(const Context& ctx,
           const Util::ProgressReceiver& progress_receiver,
-          uint64_t max_age)
+          uint64_t max_age,
+          size_t threads)
 {
   Util::for_each_level_1_subdir(
     ctx.config.cache_dir(),
     [&](const auto& subdir, const auto& sub_progress_receiver) {
-      clean_up_dir(subdir, 0, 0, max_age, sub_progress_receiver);
+      clean_up_dir(
+        subdir, 0, 0, max_age, EvictionPolicy::lru, sub_progress_receiver);
     },
-    progress_receiver);
+    progress_receiver,
+    threads);
 }
 
 // Clean up one cache subdirectory.
@@ -86,10 +156,16 @@ clean_up_dir(const std::string& subdir,
              uint64_t max_size,
              uint64_t max_files,
              uint64_t max_age,
+             EvictionPolicy policy,
              const Util::ProgressReceiver& progress_receiver)
 {
   LOG("Cleaning up cache directory {}", subdir);
 
+  // Make sure that entries stored during the traversal are recorded somewhere
+  // so that they can be carried over to the new index.
+  LruIndex(subdir).create_partial();
+  const int64_t traversal_start = time(nullptr);
+
   std::vector<CacheFile> files = Util::get_level_1_files(
     subdir, [&](double progress) { progress_receiver(progress / 3); });
 
@@ -117,16 +193,46 @@ clean_up_dir(const std::string& subdir,
     files_in_cache += 1;
   }
 
-  // Sort according to modification time, oldest first.
-  std::sort(files.begin(), files.end(), [](const auto& f1, const auto& f2) {
-    return f1.lstat().mtime() < f2.lstat().mtime();
-  });
+  if (max_age != 0 || policy == EvictionPolicy::lru) {
+    // Sort according to modification time, oldest first.
+    std::sort(files.begin(), files.end(), [](const auto& f1, const auto& f2) {
+      return f1.lstat().mtime() < f2.lstat().mtime();
+    });
+  } else {
+    // Sort according to priority, lowest first. Raw files get the priority of
+    // their result.
+    LruIndex index(subdir);
+    const auto index_entries = read_index_entries(index);
+    std::vector<std::pair<double, size_t>> priorities;
+    priorities.reserve(files.size());
+    for (size_t i = 0; i < files.size(); ++i) {
+      std::string name(Util::base_name(files[i].path()));
+      if (is_raw_file_name(name)) {
+        name.replace(name.length() - 2, 2, "R");
+      }
+      LruIndex::Entry entry;
+      const auto it = index_entries.find(name);
+      if (it != index_entries.end()) {
+        entry = it->second;
+      }
+      entry.time = std::max<int64_t>(entry.time, files[i].lstat().mtime());
+      priorities.emplace_back(eviction_priority(policy, entry), i);
+    }
+    std::sort(priorities.begin(), priorities.end());
+    std::vector<CacheFile> sorted_files;
+    sorted_files.reserve(files.size());
+    for (const auto& item : priorities) {
+      sorted_files.push_back(std::move(files[item.second]));
+    }
+    files = std::move(sorted_files);
+  }
 
   LOG("Before cleanup: {:.0f} KiB, {:.0f} files",
       static_cast<double>(cache_size) / 1024,
       static_cast<double>(files_in_cache));
 
   bool cleaned = false;
+  size_t first_kept = files.size();
   for (size_t i = 0; i < files.size();
        ++i, progress_receiver(2.0 / 3 + 1.0 * i / files.size() / 3)) {
     const auto& file = files[i];
@@ -140,6 +246,7 @@ clean_up_dir(const std::string& subdir,
         && (max_age == 0
             || file.lstat().mtime()
                  > (current_time - static_cast<int64_t>(max_age)))) {
+      first_kept = i;
       break;
     }
 
@@ -174,13 +281,152 @@ clean_up_dir(const std::string& subdir,
     LOG("Cleaned up cache directory {}", subdir);
   }
 
+  // The traversal has seen all entries except those stored meanwhile, so
+  // record them in a new LRU index, keeping what the previous index knew about
+  // them. Raw files are removed together with their result.
+  LruIndex index(subdir);
+  Lockfile lock(index.path());
+  if (lock.acquired()) {
+    const auto old_entries = read_index_entries(index);
+    std::unordered_set<std::string> seen_names;
+    std::vector<LruIndex::Entry> index_entries;
+    for (size_t i = first_kept; i < files.size(); ++i) {
+      const auto& file = files[i];
+      const auto name = Util::base_name(file.path());
+      if (!file.lstat().is_regular() || is_raw_file_name(name)
+          || !(Util::ends_with(name, "R") || Util::ends_with(name, "M"))) {
+        continue;
+      }
+      LruIndex::Entry entry;
+      const auto it = old_entries.find(std::string(name));
+      if (it != old_entries.end()) {
+        entry = it->second;
+      }
+      entry.name = std::string(name);
+      entry.time = std::max<int64_t>(entry.time, file.lstat().mtime());
+      if (entry.size == 0) {
+        entry.size = file.lstat().size_on_disk();
+      }
+      seen_names.insert(entry.name);
+      index_entries.push_back(std::move(entry));
+    }
+    for (const auto& stored : index.read_stored_since(traversal_start)) {
+      if (seen_names.count(stored.name) != 0
+          || !Stat::lstat(FMT("{}/{}", subdir, stored.name))) {
+        continue;
+      }
+      const auto it = old_entries.find(stored.name);
+      index_entries.push_back(it != old_entries.end() ? it->second : stored);
+    }
+    index.write(index_entries);
+  }
+
   update_counters(subdir, files_in_cache, cache_size, cleaned);
 }
 
+bool
+clean_up_dir_using_index(const std::string& subdir,
+                         uint64_t max_size,
+                         uint64_t max_files,
+                         EvictionPolicy policy)
+{
+  LruIndex index(subdir);
+  std::vector<std::pair<std::string, uint64_t>> victims;
+  uint64_t cache_size;
+  uint64_t files_in_cache;
+
+  // Only choose the files to remove and rewrite the index while holding the
+  // lock since removing many files could take longer than the lock's staleness
+  // limit.
+  {
+    Lockfile lock(index.path());
+    if (!lock.acquired()) {
+      return false;
+    }
+    auto entries = index.read();
+    if (!entries) {
+      return false;
+    }
+    if (policy != EvictionPolicy::lru) {
+      std::stable_sort(
+        entries->begin(), entries->end(), [&](const auto& e1, const auto& e2) {
+          return eviction_priority(policy, e1) < eviction_priority(policy, e2);
+        });
+    }
+
+    LOG("Cleaning up cache directory {} using LRU index", subdir);
+
+    const auto counters = Statistics::read(subdir + "/stats");
+    cache_size = counters.get(Statistic::cache_size_kibibyte) * 1024;
+    files_in_cache = counters.get(Statistic::files_in_cache);
+    const auto over_limits = [&] {
+      return (max_size != 0 && cache_size > max_size)
+             || (max_files != 0 && files_in_cache > max_files);
+    };
+    const auto add_victim = [&](const std::string& path, uint64_t size) {
+      victims.emplace_back(path, size);
+      cache_size -= std::min(cache_size, size);
+      files_in_cache -= std::min<uint64_t>(files_in_cache, 1);
+    };
+
+    LOG("Before cleanup: {:.0f} KiB, {:.0f} files",
+        static_cast<double>(cache_size) / 1024,
+        static_cast<double>(files_in_cache));
+
+    // The entry may have been moved to another level since it was recorded.
+    const std::string cache_dir(Util::dir_name(subdir));
+    size_t i = 0;
+    for (; i < entries->size() && over_limits(); ++i) {
+      const auto& name = (*entries)[i].name;
+      for (uint8_t level = 2; level <= 4; ++level) {
+        const auto path = Util::get_path_in_cache(cache_dir, level, name);
+        const auto st = Stat::lstat(path);
+        if (!st) {
+          continue;
+        }
+        add_victim(path, st.size_on_disk());
+        if (Util::ends_with(name, "R")) {
+          const auto prefix = path.substr(0, path.length() - 1);
+          for (uint32_t j = 0; j < k_max_raw_files_per_result; ++j) {
+            const auto raw_path = FMT("{}{}W", prefix, j);
+            const auto raw_st = Stat::lstat(raw_path);
+            if (raw_st) {
+              add_victim(raw_path, raw_st.size_on_disk());
+            }
+          }
+        }
+        break;
+      }
+    }
+
+    if (over_limits()) {
+      // Let the caller clean up by traversing the directory instead.
+      LOG("LRU index of {} doesn't cover enough entries", subdir);
+      return false;
+    }
+
+    entries->erase(entries->begin(), entries->begin() + i);
+    index.write(*entries);
+  }
+
+  // The counters were adjusted when the files were chosen.
+  for (const auto& victim : victims) {
+    delete_file(victim.first, victim.second, nullptr, nullptr);
+  }
+
+  LOG("After cleanup: {:.0f} KiB, {:.0f} files",
+      static_cast<double>(cache_size) / 1024,
+      static_cast<double>(files_in_cache));
+
+  update_counters(subdir, files_in_cache, cache_size, !victims.empty());
+  return true;
+}
+
 // Clean up all cache subdirectories.
 void
 clean_up_all(const Config& config,
-             const Util::ProgressReceiver& progress_receiver)
+             const Util::ProgressReceiver& progress_receiver,
+             size_t threads)
 {
   Util::for_each_level_1_subdir(
     config.cache_dir(),
@@ -189,9 +435,11 @@ clean_up_all(const Config& config,
                    config.max_size() / 16,
                    config.max_files() / 16,
                    0,
+                   config.eviction_policy(),
                    sub_progress_receiver);
     },
-    progress_receiver);
+    progress_receiver,
+    threads);
 }
 
 // Wipe one cache subdirectory.
@@ -213,16 +461,109 @@ wipe_dir(const std::string& subdir,
   if (cleared) {
     LOG("Cleared out cache directory {}", subdir);
   }
+
+  LruIndex index(subdir);
+  Lockfile lock(index.path());
+  if (lock.acquired()) {
+    index.write({});
+  }
+
   update_counters(subdir, 0, 0, cleared);
 }
 
 // Wipe all cached files in all subdirectories.
 void
-wipe_all(const Context& ctx, const Util::ProgressReceiver& progress_receiver)
+wipe_all(const Context& ctx,
+         const Util::ProgressReceiver& progress_receiver,
+         size_t threads)
 {
   Util::for_each_level_1_subdir(
-    ctx.config.cache_dir(), wipe_dir, progress_receiver);
+    ctx.config.cache_dir(), wipe_dir, progress_receiver, threads);
+  Util::wipe_path(FMT("{}/compiler-identity", ctx.config.cache_dir()));
+  Util::wipe_path(FMT("{}/common-hash", ctx.config.cache_dir()));
 #ifdef INODE_CACHE_SUPPORTED
   ctx.inode_cache.drop();
 #endif
 }
+
+EvictionSimulationResult
+simulate_eviction(const Config& config,
+                  EvictionPolicy policy,
+                  uint64_t max_size)
+{
+  // Collect the uses from all indexes along with the latest known size and
+  // cost of each entry. Retrievals that a rewrite of the index merged into the
+  // hits of a complete line are replayed at the time of that line (the last
+  // use) since their real times are unknown.
+  std::unordered_map<std::string, LruIndex::Entry> known_entries;
+  std::vector<std::pair<int64_t, std::string>> uses;
+  Util::for_each_level_1_subdir(
+    config.cache_dir(),
+    [&](const std::string& subdir,
+        const Util::ProgressReceiver& /*progress_receiver*/) {
+      const auto lines = LruIndex(subdir).read_lines();
+      if (!lines) {
+        return;
+      }
+      for (const auto& line : *lines) {
+        auto& entry = known_entries[line.name];
+        if (line.size > 0) {
+          entry.size = line.size;
+          entry.cost = line.cost;
+        }
+        for (uint64_t i = 0; i <= line.hits; ++i) {
+          uses.emplace_back(line.time, line.name);
+        }
+      }
+    },
+    [](double /*progress*/) {});
+  std::stable_sort(
+    uses.begin(), uses.end(), [](const auto& u1, const auto& u2) {
+      return u1.first < u2.first;
+    });
+
+  struct CachedEntry
+  {
+    LruIndex::Entry entry;
+    double priority;
+  };
+  std::unordered_map<std::string, CachedEntry> cached_entries;
+  std::set<std::pair<double, std::string>> eviction_order;
+  uint64_t cache_size = 0;
+
+  EvictionSimulationResult result;
+  for (const auto& use : uses) {
+    const auto& known_entry = known_entries[use.second];
+    if (known_entry.size == 0) {
+      // Can't simulate an entry of unknown size.
+      continue;
+    }
+
+    auto it = cached_entries.find(use.second);
+    if (it != cached_entries.end()) {
+      ++result.hits;
+      result.saved_time += known_entry.cost;
+      eviction_order.erase({it->second.priority, use.second});
+      it->second.entry.time = use.first;
+      ++it->second.entry.hits;
+    } else {
+      ++result.misses;
+      LruIndex::Entry entry{
+        use.second, use.first, known_entry.size, known_entry.cost, 0};
+      it = cached_entries.emplace(use.second, CachedEntry{entry, 0.0}).first;
+      cache_size += known_entry.size;
+    }
+    it->second.priority = eviction_priority(policy, it->second.entry);
+    eviction_order.emplace(it->second.priority, use.second);
+
+    while (cache_size > max_size && !eviction_order.empty()) {
+      const auto victim = cached_entries.find(eviction_order.begin()->second);
+      cache_size -= victim->second.entry.size;
+      cached_entries.erase(victim);
+      eviction_order.erase(eviction_order.begin());
+      ++result.evictions;
+    }
+  }
+
+  return result;
+}
@@ -20,25 +20,54 @@
 
 #include "system.hpp"
 
+#include "Config.hpp"
 #include "Util.hpp"
 
 #include <string>
 
-class Config;
 class Context;
 
 void clean_old(const Context& ctx,
                const Util::ProgressReceiver& progress_receiver,
-               uint64_t max_age);
+               uint64_t max_age,
+               size_t threads = 1);
 
 void clean_up_dir(const std::string& subdir,
                   uint64_t max_size,
                   uint64_t max_files,
                   uint64_t max_age,
+                  EvictionPolicy policy,
                   const Util::ProgressReceiver& progress_receiver);
 
+// Like clean_up_dir but find the entries to evict in the LRU index of `subdir`
+// instead of traversing it. Returns false if there is no valid
+// index or if it doesn't cover enough entries to reach the limits, in which
+// case clean_up_dir should be used instead.
+bool clean_up_dir_using_index(const std::string& subdir,
+                              uint64_t max_size,
+                              uint64_t max_files,
+                              EvictionPolicy policy);
+
 void clean_up_all(const Config& config,
-                  const Util::ProgressReceiver& progress_receiver);
+                  const Util::ProgressReceiver& progress_receiver,
+                  size_t threads = 1);
 
 void wipe_all(const Context& ctx,
-              const Util::ProgressReceiver& progress_receiver);
+              const Util::ProgressReceiver& progress_receiver,
+              size_t threads = 1);
+
+struct EvictionSimulationResult
+{
+  uint64_t hits = 0;
+  uint64_t misses = 0;
+  uint64_t evictions = 0;
+  uint64_t saved_time = 0; // Milliseconds of compilation avoided by hits
+};
+
+// Replay the uses of cache entries recorded in the LRU indexes of the cache in
+// a simulated cache that holds at most `max_size` bytes and evicts entries
+// according to `policy`. Hits merged by rewrites of an index are replayed at
+// the time of the entry's last use.
+EvictionSimulationResult simulate_eviction(const Config& config,
+                                           EvictionPolicy policy,
+                                           uint64_t max_size);
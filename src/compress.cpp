@@ -36,7 +36,6 @@
 
 #include <memory>
 #include <string>
-#include <thread>
 
 using nonstd::optional;
 
@@ -275,9 +274,9 @@ compress_stats(const Config& config,
 void
 compress_recompress(Context& ctx,
                     optional<int8_t> level,
-                    const Util::ProgressReceiver& progress_receiver)
+                    const Util::ProgressReceiver& progress_receiver,
+                    size_t threads)
 {
-  const size_t threads = std::thread::hardware_concurrency();
   const size_t read_ahead = 2 * threads;
   ThreadPool thread_pool(threads, read_ahead);
   RecompressionStatistics statistics;
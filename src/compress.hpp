@@ -37,6 +37,8 @@ void compress_stats(const Config& config,
 // - level: Target compression level (positive or negative value for actual
 //   level, 0 for default level and nonstd::nullopt for no compression).
 // - progress_receiver: Function that will be called for progress updates.
+// - threads: Number of files to recompress concurrently.
 void compress_recompress(Context& ctx,
                          nonstd::optional<int8_t> level,
-                         const Util::ProgressReceiver& progress_receiver);
+                         const Util::ProgressReceiver& progress_receiver,
+                         size_t threads);
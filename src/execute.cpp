@@ -27,6 +27,7 @@
 #include "Stat.hpp"
 #include "TemporaryFile.hpp"
 #include "Util.hpp"
+#include "exceptions.hpp"
 #include "fmtmacros.hpp"
 
 #include <util/path_utils.hpp>
@@ -63,6 +64,13 @@ execute_noreturn(const char* const* argv, const std::string& temp_dir)
   win32execute(argv[0], argv, 0, -1, -1, temp_dir);
 }
 
+bool
+execute_detached(const std::function<void()>& /*function*/)
+{
+  // Not implemented on Windows.
+  return false;
+}
+
 std::string
 win32getshell(const std::string& path)
 {
@@ -236,6 +244,64 @@ execute_noreturn(const char* const* argv, const std::string& /*temp_dir*/)
 {
   execv(argv[0], const_cast<char* const*>(argv));
 }
+
+bool
+execute_detached(const std::function<void()>& function)
+{
+  // Make sure that buffered output isn't written by both processes.
+  fflush(nullptr);
+
+  pid_t pid;
+  {
+    SignalHandlerBlocker signal_handler_blocker;
+    pid = fork();
+  }
+
+  if (pid == -1) {
+    LOG("Failed to fork: {}", strerror(errno));
+    return false;
+  }
+
+  if (pid == 0) {
+    // Child. Fork again and let the grandchild do the work so that it's
+    // reparented to init instead of becoming a zombie of the caller.
+    const pid_t grandchild_pid = fork();
+    if (grandchild_pid != 0) {
+      _exit(grandchild_pid == -1 ? EXIT_FAILURE : EXIT_SUCCESS);
+    }
+
+    setsid();
+    Fd null_fd(open("/dev/null", O_RDWR));
+    if (null_fd) {
+      dup2(*null_fd, STDIN_FILENO);
+      dup2(*null_fd, STDOUT_FILENO);
+      dup2(*null_fd, STDERR_FILENO);
+    }
+
+    // Don't keep the caller's stderr alive via the duplicate made for
+    // uncached compilations since that would make e.g. Ninja wait for us.
+    const char* uncached_err_fd = getenv("UNCACHED_ERR_FD");
+    if (uncached_err_fd) {
+      close(atoi(uncached_err_fd));
+    }
+
+    try {
+      function();
+    } catch (const ErrorBase& e) {
+      LOG("Error in background process: {}", e.what());
+    }
+    _exit(EXIT_SUCCESS);
+  }
+
+  int status;
+  while (waitpid(pid, &status, 0) == -1) {
+    if (errno != EINTR) {
+      LOG("waitpid failed: {}", strerror(errno));
+      return false;
+    }
+  }
+  return WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS;
+}
 #endif
 
 std::string
@@ -22,6 +22,7 @@
 
 #include "Fd.hpp"
 
+#include <functional>
 #include <string>
 
 class Context;
@@ -30,6 +31,13 @@ int execute(Context& ctx, const char* const* argv, Fd&& fd_out, Fd&& fd_err);
 
 void execute_noreturn(const char* const* argv, const std::string& temp_dir);
 
+// Run `function` in a detached background process that may outlive the current
+// process and that isn't waited for by the parent process (e.g. a build
+// system). Standard input, output and error of the background process are
+// redirected to the null device. Returns false if the background process could
+// not be created, in which case `function` is not called.
+bool execute_detached(const std::function<void()>& function);
+
 // Find an executable named `name` in `$PATH`. Exclude any executables that are
 // links to `exclude_name`.
 std::string find_executable(const Context& ctx,
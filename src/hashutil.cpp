@@ -23,6 +23,7 @@
 #include "Context.hpp"
 #include "Hash.hpp"
 #include "Logging.hpp"
+#include "MappedFile.hpp"
 #include "Sloppiness.hpp"
 #include "Stat.hpp"
 #include "execute.hpp"
@@ -39,10 +40,14 @@
 #  include "Win32Util.hpp"
 #endif
 
-#ifdef HAVE_AVX2
+#if defined(HAVE_AVX2) || defined(HAVE_AVX512BW)
 #  include <immintrin.h>
 #endif
 
+#ifdef HAVE_SSE2
+#  include <emmintrin.h>
+#endif
+
 using nonstd::string_view;
 
 namespace {
@@ -85,14 +90,14 @@ check_for_temporal_macros_helper(string_view str, size_t pos)
 }
 
 int
-check_for_temporal_macros_bmh(string_view str)
+check_for_temporal_macros_bmh(string_view str, size_t start = 0)
 {
   int result = 0;
 
   // We're using the Boyer-Moore-Horspool algorithm, which searches starting
   // from the *end* of the needle. Our needles are 8 characters long, so i
   // starts at 7.
-  size_t i = 7;
+  size_t i = start + 7;
 
   while (i < str.length()) {
     // Check whether the substring ending at str[i] has the form "_....E..". On
@@ -110,13 +115,50 @@ check_for_temporal_macros_bmh(string_view str)
   return result;
 }
 
+// The SIMD variants below use the following algorithm, which is heavily
+// inspired by <http://0x80.pl/articles/simd-strfind.html>: Compare a block of
+// the input with '_' and the same block offset by 5 bytes (i.e. the offset of
+// 'E' in all three macros) with 'E'. Each position where both match is a
+// possible location for a temporal macro. The rest of the input is handled by
+// the Boyer-Moore-Horspool variant.
+
+#ifdef HAVE_SSE2
+int check_for_temporal_macros_sse2(string_view str)
+  __attribute__((target("sse2")));
+
+int
+check_for_temporal_macros_sse2(string_view str)
+{
+  int result = 0;
+
+  const __m128i first = _mm_set1_epi8('_');
+  const __m128i last = _mm_set1_epi8('E');
+
+  size_t pos = 0;
+  for (; pos + 5 + 16 <= str.length(); pos += 16) {
+    const __m128i block_first =
+      _mm_loadu_si128(reinterpret_cast<const __m128i*>(&str[pos]));
+    const __m128i block_last =
+      _mm_loadu_si128(reinterpret_cast<const __m128i*>(&str[pos + 5]));
+    uint32_t mask = _mm_movemask_epi8(_mm_and_si128(
+      _mm_cmpeq_epi8(first, block_first), _mm_cmpeq_epi8(last, block_last)));
+
+    while (mask != 0) {
+      // The start position + 1 (as we know the first char is _).
+      const auto start = pos + __builtin_ctz(mask) + 1;
+      mask = mask & (mask - 1);
+      result |= check_for_temporal_macros_helper(str, start);
+    }
+  }
+
+  return result | check_for_temporal_macros_bmh(str, pos);
+}
+#endif
+
 #ifdef HAVE_AVX2
 int check_for_temporal_macros_avx2(string_view str)
   __attribute__((target("avx2")));
 
-// The following algorithm, which uses AVX2 instructions to find __DATE__,
-// __TIME__ and __TIMESTAMP__, is heavily inspired by
-// <http://0x80.pl/articles/simd-strfind.html>.
 int
 check_for_temporal_macros_avx2(string_view str)
 {
@@ -157,9 +199,38 @@ check_for_temporal_macros_avx2(string_view str)
     }
   }
 
-  result |= check_for_temporal_macros_bmh(str.substr(pos));
+  return result | check_for_temporal_macros_bmh(str, pos);
+}
+#endif
 
-  return result;
+#ifdef HAVE_AVX512BW
+int check_for_temporal_macros_avx512bw(string_view str)
+  __attribute__((target("avx512bw")));
+
+int
+check_for_temporal_macros_avx512bw(string_view str)
+{
+  int result = 0;
+
+  const __m512i first = _mm512_set1_epi8('_');
+  const __m512i last = _mm512_set1_epi8('E');
+
+  size_t pos = 0;
+  for (; pos + 5 + 64 <= str.length(); pos += 64) {
+    const __m512i block_first = _mm512_loadu_si512(&str[pos]);
+    const __m512i block_last = _mm512_loadu_si512(&str[pos + 5]);
+    uint64_t mask = _mm512_cmpeq_epi8_mask(first, block_first)
+                    & _mm512_cmpeq_epi8_mask(last, block_last);
+
+    while (mask != 0) {
+      // The start position + 1 (as we know the first char is _).
+      const auto start = pos + __builtin_ctzll(mask) + 1;
+      mask = mask & (mask - 1);
+      result |= check_for_temporal_macros_helper(str, start);
+    }
+  }
+
+  return result | check_for_temporal_macros_bmh(str, pos);
 }
 #endif
 
@@ -177,14 +248,12 @@ hash_source_code_file_nocache(const Context& ctx,
       return HASH_SOURCE_CODE_ERROR;
     }
   } else {
-    std::string data;
     try {
-      data = Util::read_file(path, size_hint);
+      MappedFile file(path, size_hint);
+      return hash_source_code_string(ctx, hash, file.view(), path);
     } catch (Error&) {
       return HASH_SOURCE_CODE_ERROR;
     }
-    int result = hash_source_code_string(ctx, hash, data, path);
-    return result;
   }
 }
 
@@ -202,17 +271,165 @@ get_content_type(const Config& config, const std::string& path)
 }
 #endif
 
+bool
+is_preprocessed_directive(string_view str, size_t pos, bool pump)
+{
+  const char c = str[pos];
+  if (c == '#') {
+    return pos == 0 || str[pos - 1] == '\n';
+  }
+  if (pos + 1 == str.length()) {
+    return false;
+  }
+  return (c == '.' && str[pos + 1] == 'i')
+         || (pump && c == '_' && str[pos + 1] == '_');
+}
+
+size_t
+find_preprocessed_directive_scalar(string_view str, size_t pos, bool pump)
+{
+  for (; pos < str.length(); ++pos) {
+    if (is_preprocessed_directive(str, pos, pump)) {
+      return pos;
+    }
+  }
+  return str.length();
+}
+
+#ifdef HAVE_AVX2
+size_t find_preprocessed_directive_avx2(string_view str, size_t pos, bool pump)
+  __attribute__((target("avx2")));
+
+size_t
+find_preprocessed_directive_avx2(string_view str, size_t pos, bool pump)
+{
+  // The block comparison looks at the previous character, which doesn't exist
+  // for the first one.
+  if (pos == 0) {
+    if (!str.empty() && is_preprocessed_directive(str, 0, pump)) {
+      return 0;
+    }
+    pos = 1;
+  }
+
+  const __m256i hash = _mm256_set1_epi8('#');
+  const __m256i newline = _mm256_set1_epi8('\n');
+  const __m256i dot = _mm256_set1_epi8('.');
+  const __m256i i = _mm256_set1_epi8('i');
+  const __m256i underscore = _mm256_set1_epi8('_');
+
+  // Look at 32 positions at a time together with the characters before and
+  // after each of them.
+  for (; pos + 32 + 1 <= str.length(); pos += 32) {
+    const __m256i prev =
+      _mm256_loadu_si256(reinterpret_cast<const __m256i*>(&str[pos - 1]));
+    const __m256i cur =
+      _mm256_loadu_si256(reinterpret_cast<const __m256i*>(&str[pos]));
+    const __m256i next =
+      _mm256_loadu_si256(reinterpret_cast<const __m256i*>(&str[pos + 1]));
+
+    __m256i found =
+      _mm256_or_si256(_mm256_and_si256(_mm256_cmpeq_epi8(cur, hash),
+                                       _mm256_cmpeq_epi8(prev, newline)),
+                      _mm256_and_si256(_mm256_cmpeq_epi8(cur, dot),
+                                       _mm256_cmpeq_epi8(next, i)));
+    if (pump) {
+      found = _mm256_or_si256(
+        found,
+        _mm256_and_si256(_mm256_cmpeq_epi8(cur, underscore),
+                         _mm256_cmpeq_epi8(next, underscore)));
+    }
+
+    const uint32_t mask = _mm256_movemask_epi8(found);
+    if (mask != 0) {
+      return pos + __builtin_ctz(mask);
+    }
+  }
+
+  return find_preprocessed_directive_scalar(str, pos, pump);
+}
+#endif
+
 } // namespace
 
+bool
+temporal_macro_scanner_supported(TemporalMacroScanner scanner)
+{
+  switch (scanner) {
+  case TemporalMacroScanner::best:
+  case TemporalMacroScanner::bmh:
+    return true;
+
+  case TemporalMacroScanner::sse2:
+#ifdef HAVE_SSE2
+    return blake3_cpu_supports_sse2();
+#else
+    return false;
+#endif
+
+  case TemporalMacroScanner::avx2:
+#ifdef HAVE_AVX2
+    return blake3_cpu_supports_avx2();
+#else
+    return false;
+#endif
+
+  case TemporalMacroScanner::avx512bw:
+#ifdef HAVE_AVX512BW
+    return blake3_cpu_supports_avx512bw();
+#else
+    return false;
+#endif
+  }
+
+  return false;
+}
+
 int
-check_for_temporal_macros(string_view str)
+check_for_temporal_macros(string_view str, TemporalMacroScanner scanner)
 {
+  if (scanner == TemporalMacroScanner::best) {
+    // The CPU features don't change, so only look them up once.
+    static const TemporalMacroScanner best_scanner = [] {
+      for (auto candidate : {TemporalMacroScanner::avx512bw,
+                             TemporalMacroScanner::avx2,
+                             TemporalMacroScanner::sse2}) {
+        if (temporal_macro_scanner_supported(candidate)) {
+          return candidate;
+        }
+      }
+      return TemporalMacroScanner::bmh;
+    }();
+    scanner = best_scanner;
+  }
+
+  switch (scanner) {
+#ifdef HAVE_SSE2
+  case TemporalMacroScanner::sse2:
+    return check_for_temporal_macros_sse2(str);
+#endif
 #ifdef HAVE_AVX2
-  if (blake3_cpu_supports_avx2()) {
+  case TemporalMacroScanner::avx2:
     return check_for_temporal_macros_avx2(str);
+#endif
+#ifdef HAVE_AVX512BW
+  case TemporalMacroScanner::avx512bw:
+    return check_for_temporal_macros_avx512bw(str);
+#endif
+  default:
+    return check_for_temporal_macros_bmh(str);
+  }
+}
+
+size_t
+find_preprocessed_directive(string_view str, size_t pos, bool pump)
+{
+#ifdef HAVE_AVX2
+  if (blake3_cpu_supports_avx2()) {
+    return find_preprocessed_directive_avx2(str, pos, pump);
   }
 #endif
-  return check_for_temporal_macros_bmh(str);
+  return find_preprocessed_directive_scalar(str, pos, pump);
 }
 
 int
@@ -334,6 +551,37 @@ hash_source_code_file(const Context& ctx,
 #endif
 }
 
+nonstd::optional<int>
+hash_source_code_file_cached(const Context& ctx,
+                             Hash& hash,
+                             const std::string& path,
+                             const Stat& st)
+{
+#ifdef INODE_CACHE_SUPPORTED
+  if (!ctx.config.inode_cache()) {
+    return nonstd::nullopt;
+  }
+
+  Digest digest;
+  int return_value;
+  if (!ctx.inode_cache.get(path,
+                           st,
+                           get_content_type(ctx.config, path),
+                           digest,
+                           &return_value)) {
+    return nonstd::nullopt;
+  }
+  hash.hash(digest.bytes(), Digest::size(), Hash::HashType::binary);
+  return return_value;
+#else
+  (void)ctx;
+  (void)hash;
+  (void)path;
+  (void)st;
+  return nonstd::nullopt;
+#endif
+}
+
 bool
 hash_binary_file(const Context& ctx, Hash& hash, const std::string& path)
 {
@@ -20,6 +20,7 @@
 
 #include "system.hpp"
 
+#include "third_party/nonstd/optional.hpp"
 #include "third_party/nonstd/string_view.hpp"
 
 #include <string>
@@ -27,6 +28,7 @@
 class Config;
 class Context;
 class Hash;
+class Stat;
 
 const int HASH_SOURCE_CODE_OK = 0;
 const int HASH_SOURCE_CODE_ERROR = (1 << 0);
@@ -34,13 +36,31 @@ const int HASH_SOURCE_CODE_FOUND_DATE = (1 << 1);
 const int HASH_SOURCE_CODE_FOUND_TIME = (1 << 2);
 const int HASH_SOURCE_CODE_FOUND_TIMESTAMP = (1 << 3);
 
+// Implementations of check_for_temporal_macros. `best` is the fastest one
+// supported by the CPU, the others are mainly useful for testing and
+// benchmarking.
+enum class TemporalMacroScanner { best, bmh, sse2, avx2, avx512bw };
+
+// Return whether `scanner` can be used on this host.
+bool temporal_macro_scanner_supported(TemporalMacroScanner scanner);
+
 // Search for the strings "DATE", "TIME" and "TIMESTAMP" with two surrounding
-// underscores in `str`.
+// underscores in `str`. `scanner` must be supported by the host.
 //
 // Returns a bitmask with HASH_SOURCE_CODE_FOUND_DATE,
 // HASH_SOURCE_CODE_FOUND_TIME and HASH_SOURCE_CODE_FOUND_TIMESTAMP set
 // appropriately.
-int check_for_temporal_macros(nonstd::string_view str);
+int check_for_temporal_macros(
+  nonstd::string_view str,
+  TemporalMacroScanner scanner = TemporalMacroScanner::best);
+
+// Return the first position at or after `pos` in preprocessed output `str`
+// that may start a linemarker or other directive that needs inspection: a '#'
+// first on a line, ".i" (as in .incbin) or, if `pump` is true, "__"
+// (distcc-pump output). Returns str.length() if there is no such position.
+size_t find_preprocessed_directive(nonstd::string_view str,
+                                   size_t pos,
+                                   bool pump);
 
 // Hash a string. Returns a bitmask of HASH_SOURCE_CODE_* results.
 int hash_source_code_string(const Context& ctx,
@@ -55,6 +75,16 @@ int hash_source_code_file(const Context& ctx,
                           const std::string& path,
                           size_t size_hint = 0);
 
+// Look up the result of hash_source_code_file for `path`, whose status is `st`,
+// in the inode cache without reading the file. On a hit, the digest is added to
+// `hash` like hash_source_code_file does and a bitmask of HASH_SOURCE_CODE_*
+// results is returned. Returns nullopt on a miss or if the inode cache is
+// disabled.
+nonstd::optional<int> hash_source_code_file_cached(const Context& ctx,
+                                                   Hash& hash,
+                                                   const std::string& path,
+                                                   const Stat& st);
+
 // Hash a binary file using the inode cache if enabled.
 //
 // Returns true on success, otherwise false.
@@ -0,0 +1,267 @@
+// Copyright (C) 2021 Joel Rosdahl and other contributors
+//
+// See doc/AUTHORS.adoc for a complete list of contributors.
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc., 51
+// Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#include "NegativeLookupCache.hpp"
+
+#include <Config.hpp>
+#include <Digest.hpp>
+#include <Finalizer.hpp>
+#include <Hash.hpp>
+#include <Logging.hpp>
+#include <SharedBuckets.hpp>
+#include <Util.hpp>
+#include <fmtmacros.hpp>
+
+#include <sys/mman.h>
+
+#include <algorithm>
+
+// The negative lookup cache resides in a file that is mapped into shared memory
+// by running processes, just like the inode cache. It is a hash table
+// consisting of buckets, each guarded by a mutex and containing entries in MRU
+// order. An entry maps a hash of a secondary storage URL and a key to the time
+// when the key was found to be missing in that storage.
+//
+// Losing an entry (due to eviction or a wiped bucket) only means that the
+// backend will be asked again, so the table is kept small.
+
+namespace {
+
+// Note: Increment the version number if the entry format or constants
+// affecting storage size are changed.
+const uint32_t k_version = 1;
+
+const uint32_t k_num_buckets = 4 * 1024;
+const uint32_t k_num_entries = 4;
+
+static_assert(Digest::size() == 20,
+              "Increment version number if size of digest is changed.");
+static_assert(IS_TRIVIALLY_COPYABLE(Digest),
+              "Digest is expected to be trivially copyable.");
+
+Digest
+get_entry_key(const std::string& url, const Digest& key)
+{
+  Hash hash;
+  hash.hash(url);
+  hash.hash(key.bytes(), Digest::size(), Hash::HashType::binary);
+  return hash.digest();
+}
+
+} // namespace
+
+namespace storage {
+
+struct NegativeLookupCache::Entry
+{
+  Digest entry_key;  // Hashed URL and key
+  int64_t miss_time; // When the key was found to be missing
+};
+
+struct NegativeLookupCache::Bucket
+{
+  pthread_mutex_t mt;
+  Entry entries[k_num_entries];
+};
+
+struct NegativeLookupCache::SharedRegion
+{
+  uint32_t version;
+  Bucket buckets[k_num_buckets];
+};
+
+NegativeLookupCache::NegativeLookupCache(const Config& config)
+  : m_config(config)
+{
+}
+
+NegativeLookupCache::~NegativeLookupCache()
+{
+  if (m_sr) {
+    munmap(m_sr, sizeof(SharedRegion));
+  }
+}
+
+bool
+NegativeLookupCache::is_missing(const std::string& url,
+                                const Digest& key,
+                                time_t now)
+{
+  if (!initialize()) {
+    return false;
+  }
+
+  const auto entry_key = get_entry_key(url, key);
+  const int64_t ttl = m_config.secondary_storage_negative_cache_ttl();
+  bool missing = false;
+  with_bucket(entry_key, [&](const auto bucket) {
+    for (const auto& entry : bucket->entries) {
+      if (entry.entry_key == entry_key) {
+        missing = entry.miss_time <= now && now - entry.miss_time < ttl;
+        break;
+      }
+    }
+  });
+  return missing;
+}
+
+bool
+NegativeLookupCache::remember_miss(const std::string& url,
+                                   const Digest& key,
+                                   time_t now)
+{
+  if (!initialize()) {
+    return false;
+  }
+
+  const auto entry_key = get_entry_key(url, key);
+  return with_bucket(entry_key, [&](const auto bucket) {
+    uint32_t i = 0;
+    while (i < k_num_entries - 1 && bucket->entries[i].entry_key != entry_key) {
+      ++i;
+    }
+    // Either replace the existing entry or evict the least recently used one.
+    memmove(&bucket->entries[1], &bucket->entries[0], sizeof(Entry) * i);
+    bucket->entries[0].entry_key = entry_key;
+    bucket->entries[0].miss_time = now;
+  });
+}
+
+void
+NegativeLookupCache::forget(const std::string& url, const Digest& key)
+{
+  if (!initialize()) {
+    return;
+  }
+
+  const auto entry_key = get_entry_key(url, key);
+  with_bucket(entry_key, [&](const auto bucket) {
+    for (uint32_t i = 0; i < k_num_entries; ++i) {
+      if (bucket->entries[i].entry_key == entry_key) {
+        memmove(&bucket->entries[i],
+                &bucket->entries[i + 1],
+                sizeof(Entry) * (k_num_entries - i - 1));
+        memset(&bucket->entries[k_num_entries - 1], 0, sizeof(Entry));
+        break;
+      }
+    }
+  });
+}
+
+bool
+NegativeLookupCache::drop()
+{
+  const auto file = get_file();
+  if (unlink(file.c_str()) != 0) {
+    return false;
+  }
+  if (m_sr) {
+    munmap(m_sr, sizeof(SharedRegion));
+    m_sr = nullptr;
+  }
+  return true;
+}
+
+std::string
+NegativeLookupCache::get_file() const
+{
+  return FMT(
+    "{}/negative-lookup-cache.v{}", m_config.temporary_dir(), k_version);
+}
+
+bool
+NegativeLookupCache::initialize()
+{
+  if (m_failed || m_config.secondary_storage_negative_cache_ttl() == 0) {
+    return false;
+  }
+
+  if (m_sr) {
+    return true;
+  }
+
+  const auto filename = get_file();
+  if (mmap_file(filename)) {
+    return true;
+  }
+
+  // Concurrent processes could try to create new files simultaneously, so map
+  // the file that actually landed on disk instead of the one we created.
+  create_new_file(filename);
+  if (mmap_file(filename)) {
+    return true;
+  }
+
+  m_failed = true;
+  return false;
+}
+
+bool
+NegativeLookupCache::mmap_file(const std::string& filename)
+{
+  size_t size = 0;
+  m_sr = static_cast<SharedRegion*>(SharedBuckets::map_file(
+    filename, "negative lookup cache", k_version, sizeof(SharedRegion), size));
+  return m_sr != nullptr;
+}
+
+bool
+NegativeLookupCache::create_new_file(const std::string& filename)
+{
+  LOG_RAW("Creating a new negative lookup cache");
+  return SharedBuckets::create_file(
+    filename,
+    "negative lookup cache",
+    k_version,
+    sizeof(SharedRegion),
+    [](void* region) {
+      SharedRegion* sr = static_cast<SharedRegion*>(region);
+      SharedBuckets::initialize_mutexes(
+        k_num_buckets, [&](uint32_t i) { return &sr->buckets[i].mt; });
+    });
+}
+
+bool
+NegativeLookupCache::with_bucket(const Digest& entry_key,
+                                 const BucketHandler& bucket_handler)
+{
+  uint32_t hash;
+  Util::big_endian_to_int(entry_key.bytes(), hash);
+  const uint32_t index = hash % k_num_buckets;
+  Bucket* bucket = &m_sr->buckets[index];
+  switch (
+    SharedBuckets::lock(&bucket->mt, true, "negative lookup cache", index)) {
+  case SharedBuckets::LockResult::locked:
+    break;
+
+  case SharedBuckets::LockResult::stale:
+    // The owner died while modifying the bucket, so it can't be trusted.
+    memset(bucket->entries, 0, sizeof(Bucket::entries));
+    break;
+
+  case SharedBuckets::LockResult::busy:
+  case SharedBuckets::LockResult::failed:
+    return false;
+  }
+
+  Finalizer unlocker([&] { pthread_mutex_unlock(&bucket->mt); });
+  bucket_handler(bucket);
+  return true;
+}
+
+} // namespace storage
@@ -0,0 +1,82 @@
+// Copyright (C) 2021 Joel Rosdahl and other contributors
+//
+// See doc/AUTHORS.adoc for a complete list of contributors.
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc., 51
+// Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#pragma once
+
+#include <ctime>
+#include <functional>
+#include <string>
+
+class Config;
+class Digest;
+
+namespace storage {
+
+// Remembers for a limited time (secondary_storage_negative_cache_ttl) that a
+// key was missing in a secondary storage backend so that repeated lookups of
+// the same key don't have to ask the backend again. The cache is shared by all
+// ccache processes using the same cache directory.
+class NegativeLookupCache
+{
+public:
+  NegativeLookupCache(const Config& config);
+  ~NegativeLookupCache();
+
+  // Return true if `key` was recorded as missing in the backend `url` less
+  // than the TTL ago.
+  bool is_missing(const std::string& url,
+                  const Digest& key,
+                  time_t now = time(nullptr));
+
+  // Record that `key` is missing in the backend `url`.
+  //
+  // Returns true if the miss could be recorded, false otherwise.
+  bool remember_miss(const std::string& url,
+                     const Digest& key,
+                     time_t now = time(nullptr));
+
+  // Forget a recorded miss of `key` in the backend `url`, e.g. because the
+  // entry has been stored.
+  void forget(const std::string& url, const Digest& key);
+
+  // Unmaps the current cache and removes the mapped file from disk.
+  //
+  // Returns true on success, false otherwise.
+  bool drop();
+
+  // Returns name of the persistent file.
+  std::string get_file() const;
+
+private:
+  struct Bucket;
+  struct Entry;
+  struct SharedRegion;
+  using BucketHandler = std::function<void(Bucket* bucket)>;
+
+  bool initialize();
+  bool mmap_file(const std::string& filename);
+  static bool create_new_file(const std::string& filename);
+  bool with_bucket(const Digest& entry_key,
+                   const BucketHandler& bucket_handler);
+
+  const Config& m_config;
+  SharedRegion* m_sr = nullptr;
+  bool m_failed = false;
+};
+
+} // namespace storage
@@ -0,0 +1,118 @@
+// Copyright (C) 2021 Joel Rosdahl and other contributors
+//
+// See doc/AUTHORS.adoc for a complete list of contributors.
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc., 51
+// Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#include "SecondaryStorage.hpp"
+
+#include <Logging.hpp>
+#include <Util.hpp>
+#include <exceptions.hpp>
+
+namespace storage {
+
+nonstd::expected<bool, SecondaryStorage::Error>
+SecondaryStorage::get_to_file(const Digest& key, const std::string& path)
+{
+  const auto value = get(key);
+  if (!value) {
+    return nonstd::make_unexpected(value.error());
+  }
+  if (!*value) {
+    return false;
+  }
+
+  try {
+    Util::write_file(path, **value);
+  } catch (const ::Error& e) {
+    // Not the backend's fault, so don't report an error.
+    LOG("Failed to write {}: {}", path, e.what());
+    return false;
+  }
+  return true;
+}
+
+nonstd::expected<bool, SecondaryStorage::Error>
+SecondaryStorage::put_from_file(const Digest& key,
+                                const std::string& path,
+                                bool only_if_missing)
+{
+  std::string value;
+  try {
+    value = Util::read_file(path);
+  } catch (const ::Error& e) {
+    // Not the backend's fault, so don't report an error.
+    LOG("Failed to read {}: {}", path, e.what());
+    return false;
+  }
+  return put(key, value, only_if_missing);
+}
+
+nonstd::expected<std::vector<bool>, SecondaryStorage::Error>
+SecondaryStorage::get_many_to_files(const std::vector<KeyAndPath>& entries)
+{
+  std::vector<bool> found;
+  nonstd::optional<Error> error;
+  bool any_completed = false;
+  for (const auto& entry : entries) {
+    if (error == Error::timeout) {
+      // Don't wait for the timeout once per entry.
+      found.push_back(false);
+      continue;
+    }
+    const auto result = get_to_file(entry.first, entry.second);
+    if (result) {
+      any_completed = true;
+    } else {
+      error = result.error();
+    }
+    found.push_back(result && *result);
+  }
+  if (error && !any_completed) {
+    return nonstd::make_unexpected(*error);
+  }
+  return found;
+}
+
+nonstd::expected<std::vector<bool>, SecondaryStorage::Error>
+SecondaryStorage::put_many_from_files(const std::vector<KeyAndPath>& entries,
+                                      bool only_if_missing)
+{
+  std::vector<bool> stored;
+  nonstd::optional<Error> error;
+  bool any_completed = false;
+  for (const auto& entry : entries) {
+    if (error == Error::timeout) {
+      // Don't wait for the timeout once per entry.
+      stored.push_back(false);
+      continue;
+    }
+    const auto result =
+      put_from_file(entry.first, entry.second, only_if_missing);
+    if (result) {
+      any_completed = true;
+    } else {
+      error = result.error();
+    }
+    stored.push_back(result && *result);
+  }
+  if (error && !any_completed) {
+    return nonstd::make_unexpected(*error);
+  }
+  return stored;
+}
+
+} // namespace storage
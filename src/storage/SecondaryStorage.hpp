@@ -18,12 +18,16 @@
 
 #pragma once
 
+#include <Digest.hpp>
+
 #include <third_party/nonstd/expected.hpp>
 #include <third_party/nonstd/optional.hpp>
 
+#include <atomic>
+#include <chrono>
 #include <string>
-
-class Digest;
+#include <utility>
+#include <vector>
 
 namespace storage {
 
@@ -36,6 +40,9 @@ public:
     timeout, // Timeout, e.g. due to slow network or server.
   };
 
+  // A key and the path to a local file holding (or receiving) its value.
+  using KeyAndPath = std::pair<Digest, std::string>;
+
   virtual ~SecondaryStorage() = default;
 
   // Get the value associated with `key`. Returns the value on success or
@@ -53,6 +60,101 @@ public:
   // Remove `key` and its associated value. Returns true if the entry was
   // removed, otherwise false.
   virtual nonstd::expected<bool, Error> remove(const Digest& key) = 0;
+
+  // Write the value associated with `key` to the file `path`, replacing it if
+  // it already exists. Returns true on success or false if the entry is not
+  // present or `path` could not be written. The default implementation calls
+  // get() and writes the value to `path`. Backends that can stream data or that
+  // have direct access to a file should override this to avoid holding the
+  // whole entry in memory.
+  virtual nonstd::expected<bool, Error> get_to_file(const Digest& key,
+                                                    const std::string& path);
+
+  // Put the content of the file `path` associated to `key` in the storage. See
+  // put() for the meaning of `only_if_missing` and the return value, which is
+  // also false if `path` could not be read. The default implementation reads
+  // `path` and calls put(). Backends that can stream data or that can clone the
+  // file should override this to avoid holding the whole entry in memory.
+  virtual nonstd::expected<bool, Error> put_from_file(
+    const Digest& key, const std::string& path, bool only_if_missing = false);
+
+  // Batch version of get_to_file(). Returns, for each entry in `entries`,
+  // whether it was found. An entry that fails is reported as not found, and
+  // the whole call only fails if no entry could be handled by the backend. The
+  // default implementation calls get_to_file() for each entry and gives up on
+  // the remaining entries after a timeout. Backends that can pipeline or
+  // combine requests should override this.
+  virtual nonstd::expected<std::vector<bool>, Error>
+  get_many_to_files(const std::vector<KeyAndPath>& entries);
+
+  // Batch version of put_from_file(). Returns, for each entry in `entries`,
+  // whether it was stored. An entry that fails is reported as not stored, and
+  // the whole call only fails if no entry could be handled by the backend. The
+  // default implementation calls put_from_file() for each entry and gives up
+  // on the remaining entries after a timeout. Backends that can pipeline or
+  // combine requests should override this.
+  virtual nonstd::expected<std::vector<bool>, Error>
+  put_many_from_files(const std::vector<KeyAndPath>& entries,
+                      bool only_if_missing = false);
+
+  // Request that an operation running in another thread is aborted as soon as
+  // possible, e.g. because another backend already has delivered the entry.
+  // The result of a cancelled operation is ignored, so backends may return
+  // either result after cancellation has been requested.
+  void request_cancellation();
+
+  // Clear a previous cancellation request.
+  void reset_cancellation();
+
+  // Make operations give up with Error::timeout at `deadline`, e.g. because
+  // the caller's latency budget is used up before the backend's own timeout
+  // would expire. nullopt removes the deadline.
+  void set_operation_deadline(
+    nonstd::optional<std::chrono::steady_clock::time_point> deadline);
+
+protected:
+  // Backends should check this between (or, if possible, during) potentially
+  // slow steps of an operation.
+  bool cancellation_requested() const;
+
+  // Backends should not let operations run past this point in time, if set.
+  nonstd::optional<std::chrono::steady_clock::time_point>
+  operation_deadline() const;
+
+private:
+  std::atomic<bool> m_cancellation_requested{false};
+  nonstd::optional<std::chrono::steady_clock::time_point> m_operation_deadline;
 };
 
+inline void
+SecondaryStorage::request_cancellation()
+{
+  m_cancellation_requested = true;
+}
+
+inline void
+SecondaryStorage::reset_cancellation()
+{
+  m_cancellation_requested = false;
+}
+
+inline bool
+SecondaryStorage::cancellation_requested() const
+{
+  return m_cancellation_requested;
+}
+
+inline void
+SecondaryStorage::set_operation_deadline(
+  nonstd::optional<std::chrono::steady_clock::time_point> deadline)
+{
+  m_operation_deadline = deadline;
+}
+
+inline nonstd::optional<std::chrono::steady_clock::time_point>
+SecondaryStorage::operation_deadline() const
+{
+  return m_operation_deadline;
+}
+
 } // namespace storage
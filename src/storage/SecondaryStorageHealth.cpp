@@ -0,0 +1,187 @@
+// Copyright (C) 2021 Joel Rosdahl and other contributors
+//
+// See doc/AUTHORS.adoc for a complete list of contributors.
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc., 51
+// Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+
+#include "SecondaryStorageHealth.hpp"
+
+#include <AtomicFile.hpp>
+#include <Lockfile.hpp>
+#include <Logging.hpp>
+#include <Util.hpp>
+#include <exceptions.hpp>
+#include <fmtmacros.hpp>
+
+namespace storage {
+
+SecondaryStorageHealth::SecondaryStorageHealth(std::string path,
+                                               uint32_t failure_threshold,
+                                               uint32_t cool_down)
+  : m_path(std::move(path)),
+    m_failure_threshold(failure_threshold),
+    m_cool_down(cool_down)
+{
+}
+
+bool
+SecondaryStorageHealth::should_skip(time_t now)
+{
+  if (m_failure_threshold == 0) {
+    return false;
+  }
+  load();
+  return m_errors + m_timeouts >= m_failure_threshold
+         && m_last_failure_time <= now
+         && now < m_last_failure_time + static_cast<time_t>(m_cool_down);
+}
+
+void
+SecondaryStorageHealth::record_failure(SecondaryStorage::Error error,
+                                       time_t now)
+{
+  if (m_failure_threshold == 0) {
+    return;
+  }
+
+  try {
+    Util::ensure_dir_exists(Util::dir_name(m_path));
+  } catch (const Error& e) {
+    LOG("Failed to create directory for {}: {}", m_path, e.what());
+    return;
+  }
+
+  // Hold the lock while updating so that failures recorded by concurrent
+  // processes are not lost, and reload to include them.
+  Lockfile lock(m_path);
+  if (!lock.acquired()) {
+    LOG("Failed to acquire lock for {}", m_path);
+    return;
+  }
+  m_loaded = false;
+  load();
+
+  if (error == SecondaryStorage::Error::timeout) {
+    ++m_timeouts;
+  } else {
+    ++m_errors;
+  }
+  m_last_failure_time = now;
+  save();
+}
+
+void
+SecondaryStorageHealth::record_success()
+{
+  if (m_failure_threshold == 0) {
+    return;
+  }
+
+  // Failures may have been recorded by other processes since the state was
+  // last read, so check the file again.
+  m_loaded = false;
+  load();
+  if (m_errors == 0 && m_timeouts == 0) {
+    return;
+  }
+
+  Lockfile lock(m_path);
+  if (!lock.acquired()) {
+    LOG("Failed to acquire lock for {}", m_path);
+    return;
+  }
+  m_loaded = false;
+  load();
+  if (m_errors != 0 || m_timeouts != 0) {
+    m_errors = 0;
+    m_timeouts = 0;
+    save();
+  }
+}
+
+uint64_t
+SecondaryStorageHealth::errors()
+{
+  load();
+  return m_errors;
+}
+
+uint64_t
+SecondaryStorageHealth::timeouts()
+{
+  load();
+  return m_timeouts;
+}
+
+time_t
+SecondaryStorageHealth::last_failure_time()
+{
+  load();
+  return m_last_failure_time;
+}
+
+void
+SecondaryStorageHealth::load()
+{
+  if (m_loaded) {
+    return;
+  }
+  m_loaded = true;
+  m_errors = 0;
+  m_timeouts = 0;
+  m_last_failure_time = 0;
+
+  std::string data;
+  try {
+    data = Util::read_file(m_path);
+  } catch (const Error&) {
+    // Nonexistent file: no failures recorded.
+    return;
+  }
+
+  // Format: <errors> <timeouts> <last failure time>
+  const auto fields = Util::split_into_strings(data, " \n");
+  if (fields.size() != 3) {
+    LOG("Ignoring malformed secondary storage health file {}", m_path);
+    return;
+  }
+  try {
+    m_errors = Util::parse_unsigned(fields[0]);
+    m_timeouts = Util::parse_unsigned(fields[1]);
+    m_last_failure_time = Util::parse_signed(fields[2]);
+  } catch (const Error& e) {
+    LOG("Ignoring malformed secondary storage health file {}: {}",
+        m_path,
+        e.what());
+    m_errors = 0;
+    m_timeouts = 0;
+    m_last_failure_time = 0;
+  }
+}
+
+void
+SecondaryStorageHealth::save() const
+{
+  try {
+    AtomicFile file(m_path, AtomicFile::Mode::text);
+    file.write(FMT("{} {} {}\n", m_errors, m_timeouts, m_last_failure_time));
+    file.commit();
+  } catch (const Error& e) {
+    LOG("Failed to write {}: {}", m_path, e.what());
+  }
+}
+
+} // namespace storage
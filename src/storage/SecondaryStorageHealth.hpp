@@ -0,0 +1,68 @@
+// Copyright (C) 2021 Joel Rosdahl and other contributors
+//
+// See doc/AUTHORS.adoc for a complete list of contributors.
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc., 51
+// Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+
+#pragma once
+
+#include <storage/SecondaryStorage.hpp>
+
+#include <cstdint>
+#include <ctime>
+#include <string>
+
+namespace storage {
+
+// Failure history of a secondary storage backend, persisted in a small file so
+// that it is shared by all ccache invocations. It is used to implement a
+// circuit breaker: a backend that has failed `failure_threshold` times in a row
+// is skipped until `cool_down` seconds have passed since the last failure,
+// after which it is given another chance.
+class SecondaryStorageHealth
+{
+public:
+  SecondaryStorageHealth(std::string path,
+                         uint32_t failure_threshold,
+                         uint32_t cool_down);
+
+  // Return true if the backend should not be used right now.
+  bool should_skip(time_t now = time(nullptr));
+
+  void record_failure(SecondaryStorage::Error error,
+                      time_t now = time(nullptr));
+  void record_success();
+
+  // Consecutive errors and timeouts since the last successful operation.
+  uint64_t errors();
+  uint64_t timeouts();
+
+  time_t last_failure_time();
+
+private:
+  std::string m_path;
+  uint32_t m_failure_threshold;
+  uint32_t m_cool_down;
+  bool m_loaded = false;
+  uint64_t m_errors = 0;
+  uint64_t m_timeouts = 0;
+  time_t m_last_failure_time = 0;
+
+  void load();
+  void save() const;
+};
+
+} // namespace storage
@@ -18,28 +18,124 @@
 
 #include "Storage.hpp"
 
+#include <CacheEntryReader.hpp>
+#include <CacheEntryWriter.hpp>
 #include <Config.hpp>
+#include <Counters.hpp>
+#include <File.hpp>
+#include <Finalizer.hpp>
+#include <Hash.hpp>
 #include <Logging.hpp>
+#include <Manifest.hpp>
+#include <Result.hpp>
+#include <SignalHandler.hpp>
+#include <Statistic.hpp>
 #include <TemporaryFile.hpp>
 #include <Util.hpp>
+#include <ZstdCompressor.hpp>
 #include <assertions.hpp>
+#include <execute.hpp>
 #include <fmtmacros.hpp>
 #include <storage/secondary/FileStorage.hpp>
+#ifndef _WIN32
+#  include <storage/secondary/HttpStorage.hpp>
+#endif
 #include <util/Tokenizer.hpp>
 #include <util/string_utils.hpp>
 
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <map>
 #include <memory>
+#include <mutex>
+#include <thread>
 
 namespace storage {
 
+// Queued uploads younger than this (in seconds) are left alone by other
+// processes since they are likely still being processed by the process that
+// queued them.
+const time_t k_upload_retry_delay = 60;
+
+// Queued uploads that still haven't been uploaded after this many seconds are
+// dropped.
+const time_t k_max_upload_age = 24 * 60 * 60;
+
+using Clock = std::chrono::steady_clock;
+
+static std::string
+get_upload_queue_dir(const Config& config)
+{
+  return FMT("{}/upload-queue", config.cache_dir());
+}
+
+// Upload queue entries are named "<key>-<time>" where <key> is the key in hex
+// and <time> is when the entry was queued. The time is kept in the name since
+// the status change time of the hard linked file changes when the primary
+// storage entry is touched.
+struct UploadQueueEntry
+{
+  Digest key;
+  time_t queued_at;
+};
+
+static std::string
+get_upload_queue_entry_name(const Digest& key, const time_t queued_at)
+{
+  return FMT("{}-{}",
+             Util::format_base16(key.bytes(), Digest::size()),
+             static_cast<int64_t>(queued_at));
+}
+
+static nonstd::optional<UploadQueueEntry>
+parse_upload_queue_entry_name(const nonstd::string_view name)
+{
+  const size_t key_length = 2 * Digest::size();
+  if (name.length() < key_length + 2 || name[key_length] != '-') {
+    return nonstd::nullopt;
+  }
+
+  UploadQueueEntry entry;
+  try {
+    entry.queued_at = static_cast<time_t>(
+      Util::parse_unsigned(std::string(name.substr(key_length + 1))));
+  } catch (const Error&) {
+    return nonstd::nullopt;
+  }
+
+  Digest& key = entry.key;
+  for (size_t i = 0; i < Digest::size(); ++i) {
+    uint8_t byte = 0;
+    for (size_t j = 0; j < 2; ++j) {
+      const char c = name[2 * i + j];
+      byte <<= 4;
+      if (c >= '0' && c <= '9') {
+        byte |= c - '0';
+      } else if (c >= 'a' && c <= 'f') {
+        byte |= c - 'a' + 10;
+      } else {
+        return nonstd::nullopt;
+      }
+    }
+    key.bytes()[i] = byte;
+  }
+  return entry;
+}
+
 Storage::Storage(const Config& config)
   : m_config(config),
     m_primary_storage(config)
+#ifdef INODE_CACHE_SUPPORTED
+    ,
+    m_negative_lookup_cache(config)
+#endif
 {
 }
 
 Storage::~Storage()
 {
+  wait_for_lookup_threads();
   for (const auto& tmp_file : m_tmp_files) {
     Util::unlink_tmp(tmp_file);
   }
@@ -55,7 +151,30 @@ Storage::initialize()
 void
 Storage::finalize()
 {
+  wait_for_lookup_threads();
+
+  // Upload or queue uploads before finalizing primary storage since that may
+  // move cache files to another cache level.
+  std::vector<std::string> queued_paths;
+  if (m_config.secondary_storage_async_upload()) {
+    queued_paths = queue_pending_uploads();
+  } else if (!m_pending_uploads.empty()) {
+    put_in_secondary_storages(m_pending_uploads);
+  }
+  m_pending_uploads.clear();
+
+  m_primary_storage.increment_statistics(m_counter_updates);
+  m_counter_updates = Counters();
+
   m_primary_storage.finalize();
+
+  if (!queued_paths.empty() && !execute_detached([&] {
+        m_apply_latency_budget = false;
+        process_upload_queue(queued_paths);
+      })) {
+    LOG_RAW("Could not upload to secondary storage in the background");
+    process_upload_queue(queued_paths);
+  }
 }
 
 primary::PrimaryStorage&
@@ -72,30 +191,47 @@ Storage::get(const Digest& key, const core::CacheEntryType type)
     return path;
   }
 
-  for (const auto& storage : m_secondary_storages) {
-    const auto result = storage.backend->get(key);
-    if (!result) {
-      // The backend is expected to log details about the error.
-      // TODO: Update statistics.
+  // Query backends in order of decreasing priority. Backends with the same
+  // priority are queried in parallel.
+  std::vector<SecondaryStorageEntry*> storages;
+  for (auto& storage : m_secondary_storages) {
+    if (is_busy(storage)) {
       continue;
     }
-
-    const auto& value = *result;
-    if (!value) {
-      LOG("No {} in {}", key.to_string(), storage.url);
+    if (is_known_missing(key, storage)) {
+      LOG("Skipping lookup of {} in {} since it was recently missing",
+          key.to_string(),
+          storage.url);
       continue;
     }
-
-    TemporaryFile tmp_file(FMT("{}/tmp.get", m_config.temporary_dir()));
-    m_tmp_files.push_back(tmp_file.path);
-    try {
-      Util::write_file(tmp_file.path, *value);
-    } catch (const Error& e) {
-      throw Fatal("Error writing to {}: {}", tmp_file.path, e.what());
+    if (is_unhealthy(storage)) {
+      continue;
     }
-
-    LOG("Retrieved {} from {}", key.to_string(), storage.url);
-    return tmp_file.path;
+    storages.push_back(&storage);
+  }
+  std::stable_sort(storages.begin(),
+                   storages.end(),
+                   [](const auto* storage_1, const auto* storage_2) {
+                     return storage_1->priority > storage_2->priority;
+                   });
+
+  for (auto it = storages.begin(); it != storages.end();) {
+    if (latency_budget_exhausted()) {
+      increment_statistic(Statistic::secondary_storage_skipped,
+                          storages.end() - it);
+      break;
+    }
+    const auto end = std::find_if(it, storages.end(), [&](const auto* storage) {
+      return storage->priority != (*it)->priority;
+    });
+    const auto tmp_path =
+      end - it == 1 ? get_from_secondary_storage(key, **it)
+                    : get_from_secondary_storages_in_parallel(
+                      key, std::vector<SecondaryStorageEntry*>(it, end));
+    if (tmp_path) {
+      return tmp_path;
+    }
+    it = end;
   }
 
   return nonstd::nullopt;
@@ -111,70 +247,635 @@ Storage::put(const Digest& key,
     return false;
   }
 
-  nonstd::optional<std::string> value;
-  for (const auto& storage : m_secondary_storages) {
+  // Secondary storage backends are updated by finalize() so that the result
+  // and manifest can be sent in one batch.
+  if (std::any_of(m_secondary_storages.begin(),
+                  m_secondary_storages.end(),
+                  [](const auto& storage) { return !storage.read_only; })) {
+    m_pending_uploads.emplace_back(key, *path);
+  }
+  return true;
+}
+
+void
+Storage::remove(const Digest& key, const core::CacheEntryType type)
+{
+  m_primary_storage.remove(key, type);
+
+  for (auto& storage : m_secondary_storages) {
     if (storage.read_only) {
-      LOG("Not storing {} in {} since it is read-only",
+      LOG("Did not remove {} from {} since it is read-only",
           key.to_string(),
           storage.url);
       continue;
     }
-
-    if (!value) {
-      try {
-        value = Util::read_file(*path);
-      } catch (const Error& e) {
-        LOG("Failed to read {}: {}", *path, e.what());
-        break; // Don't indicate failure since primary storage was OK.
-      }
+    if (is_busy(storage) || is_unhealthy(storage)) {
+      continue;
+    }
+    if (latency_budget_exhausted()) {
+      increment_statistic(Statistic::secondary_storage_skipped);
+      continue;
     }
 
-    const auto result = storage.backend->put(key, *value);
+    set_operation_deadline(storage);
+    const auto start = Clock::now();
+    const auto result = storage.backend->remove(key);
+    m_secondary_storage_time += Clock::now() - start;
     if (!result) {
       // The backend is expected to log details about the error.
-      // TODO: Update statistics.
+      report_failure(storage, result.error());
       continue;
     }
+    storage.health.record_success();
 
-    const bool stored = *result;
-    LOG("{} {} in {}",
-        stored ? "Stored" : "Failed to store",
-        key.to_string(),
-        storage.url);
+    const bool removed = *result;
+    if (removed) {
+      LOG("Removed {} from {}", key.to_string(), storage.url);
+    } else {
+      LOG("No {} to remove from {}", key.to_string(), storage.url);
+    }
   }
+}
+
+std::string
+Storage::create_tmp_file_for_get()
+{
+  TemporaryFile tmp_file(FMT("{}/tmp.get", m_config.temporary_dir()));
+  m_tmp_files.push_back(tmp_file.path);
+  return tmp_file.path;
+}
+
+nonstd::optional<std::string>
+Storage::get_from_secondary_storage(const Digest& key,
+                                    SecondaryStorageEntry& storage)
+{
+  const auto tmp_path = create_tmp_file_for_get();
+  set_operation_deadline(storage);
+  const auto start = Clock::now();
+  const auto result = storage.backend->get_to_file(key, tmp_path);
+  m_secondary_storage_time += Clock::now() - start;
+  if (!result) {
+    // The backend is expected to log details about the error.
+    report_failure(storage, result.error());
+    return nonstd::nullopt;
+  }
+  storage.health.record_success();
+
+  const bool found = *result;
+  if (!found) {
+    LOG("No {} in {}", key.to_string(), storage.url);
+    remember_miss(key, storage);
+    return nonstd::nullopt;
+  }
+
+  LOG("Retrieved {} from {}", key.to_string(), storage.url);
+  return tmp_path;
+}
+
+nonstd::optional<std::string>
+Storage::get_from_secondary_storages_in_parallel(
+  const Digest& key, const std::vector<SecondaryStorageEntry*>& storages)
+{
+  struct LookupState
+  {
+    std::mutex mutex;
+    std::condition_variable done_condition;
+    size_t remaining = 0;
+    nonstd::optional<size_t> winner;
+    std::vector<bool> missing;
+    std::vector<nonstd::optional<SecondaryStorage::Error>> errors;
+  };
+
+  auto state = std::make_shared<LookupState>();
+  state->remaining = storages.size();
+  state->missing.resize(storages.size(), false);
+  state->errors.resize(storages.size());
+
+  std::vector<std::string> tmp_paths;
+  for (auto* storage : storages) {
+    tmp_paths.push_back(create_tmp_file_for_get());
+    storage->backend->reset_cancellation();
+    set_operation_deadline(*storage);
+  }
+
+  LOG("Looking up {} in {} secondary storages in parallel",
+      key.to_string(),
+      storages.size());
+
+  {
+    // Let the main thread handle signals.
+    SignalHandlerBlocker signal_handler_blocker;
+
+    for (size_t i = 0; i < storages.size(); ++i) {
+      *storages[i]->lookup_running = true;
+      storages[i]->lookup_thread = std::thread(
+        [state, i, key, storage = storages[i], tmp_path = tmp_paths[i]] {
+          bool found = false;
+          bool missing = false;
+          nonstd::optional<SecondaryStorage::Error> error;
+          try {
+            const auto result = storage->backend->get_to_file(key, tmp_path);
+            found = result && *result;
+            missing = result && !*result;
+            if (!result) {
+              error = result.error();
+            }
+          } catch (const std::exception& e) {
+            LOG("Error looking up {} in {}: {}",
+                key.to_string(),
+                storage->url,
+                e.what());
+            error = SecondaryStorage::Error::error;
+          }
+
+          std::lock_guard<std::mutex> lock(state->mutex);
+          if (found && !state->winner) {
+            state->winner = i;
+          }
+          state->missing[i] = missing;
+          state->errors[i] = error;
+          --state->remaining;
+          state->done_condition.notify_all();
+          *storage->lookup_running = false;
+        });
+    }
+  }
+
+  const auto start = Clock::now();
+  const auto budget = remaining_latency_budget();
+  bool finished;
+  nonstd::optional<size_t> winner;
+  std::vector<bool> missing;
+  std::vector<nonstd::optional<SecondaryStorage::Error>> errors;
+  {
+    std::unique_lock<std::mutex> lock(state->mutex);
+    const auto is_finished = [&] {
+      return state->winner || state->remaining == 0;
+    };
+    if (budget) {
+      finished = state->done_condition.wait_for(lock, *budget, is_finished);
+    } else {
+      state->done_condition.wait(lock, is_finished);
+      finished = true;
+    }
+    winner = state->winner;
+    missing = state->missing;
+    errors = state->errors;
+  }
+  m_secondary_storage_time += Clock::now() - start;
+
+  if (!finished) {
+    LOG("Secondary storage latency budget used up while looking up {}",
+        key.to_string());
+    for (auto* storage : storages) {
+      storage->backend->request_cancellation();
+    }
+    increment_statistic(Statistic::secondary_storage_skipped,
+                        storages.size());
+    return nonstd::nullopt;
+  }
+
+  if (!winner) {
+    LOG("No {} in secondary storage", key.to_string());
+    // All lookups have finished, so the results are final.
+    for (size_t i = 0; i < storages.size(); ++i) {
+      if (errors[i]) {
+        report_failure(*storages[i], *errors[i]);
+      } else {
+        storages[i]->health.record_success();
+      }
+      if (missing[i]) {
+        remember_miss(key, *storages[i]);
+      }
+    }
+    return nonstd::nullopt;
+  }
+
+  storages[*winner]->health.record_success();
 
+  // Don't wait for the slower lookups -- later lookups skip their backends
+  // until they have finished and wait_for_lookup_threads reaps them.
+  for (size_t i = 0; i < storages.size(); ++i) {
+    if (i != *winner) {
+      storages[i]->backend->request_cancellation();
+    }
+  }
+
+  LOG("Retrieved {} from {}", key.to_string(), storages[*winner]->url);
+  return tmp_paths[*winner];
+}
+
+void
+Storage::increment_statistic(const Statistic statistic, const int64_t value)
+{
+  m_counter_updates.increment(statistic, value);
+}
+
+// Return whether a lookup started by an earlier call to get() is still running
+// in `storage`, in which case the backend must not be used by this thread.
+bool
+Storage::is_busy(SecondaryStorageEntry& storage)
+{
+  if (!storage.lookup_thread.joinable()) {
+    return false;
+  }
+  if (*storage.lookup_running) {
+    LOG("Skipping {} since an earlier lookup is still running", storage.url);
+    increment_statistic(Statistic::secondary_storage_skipped);
+    return true;
+  }
+  storage.lookup_thread.join();
+  return false;
+}
+
+bool
+Storage::is_unhealthy(SecondaryStorageEntry& storage)
+{
+  if (!storage.health.should_skip()) {
+    return false;
+  }
+  LOG("Skipping {} since it has failed {} times in a row (last failure {}"
+      " seconds ago)",
+      storage.url,
+      storage.health.errors() + storage.health.timeouts(),
+      time(nullptr) - storage.health.last_failure_time());
+  increment_statistic(Statistic::secondary_storage_skipped);
   return true;
 }
 
 void
-Storage::remove(const Digest& key, const core::CacheEntryType type)
+Storage::report_failure(SecondaryStorageEntry& storage,
+                        const SecondaryStorage::Error error)
 {
-  m_primary_storage.remove(key, type);
+  increment_statistic(error == SecondaryStorage::Error::timeout
+                        ? Statistic::secondary_storage_timeout
+                        : Statistic::secondary_storage_error);
+  storage.health.record_failure(error);
+}
 
-  for (const auto& storage : m_secondary_storages) {
+nonstd::optional<std::chrono::milliseconds>
+Storage::remaining_latency_budget() const
+{
+  if (!m_apply_latency_budget
+      || m_config.secondary_storage_latency_budget() == 0) {
+    return nonstd::nullopt;
+  }
+  const auto budget =
+    std::chrono::milliseconds(m_config.secondary_storage_latency_budget());
+  const auto spent = std::chrono::duration_cast<std::chrono::milliseconds>(
+    m_secondary_storage_time);
+  return spent < budget ? budget - spent : std::chrono::milliseconds(0);
+}
+
+void
+Storage::set_operation_deadline(SecondaryStorageEntry& storage) const
+{
+  const auto budget = remaining_latency_budget();
+  if (budget) {
+    storage.backend->set_operation_deadline(Clock::now() + *budget);
+  } else {
+    storage.backend->set_operation_deadline(nonstd::nullopt);
+  }
+}
+
+bool
+Storage::latency_budget_exhausted()
+{
+  const auto budget = remaining_latency_budget();
+  if (!budget || budget->count() > 0) {
+    return false;
+  }
+  LOG("Skipping secondary storage since the latency budget of {} ms is used up",
+      m_config.secondary_storage_latency_budget());
+  return true;
+}
+
+bool
+Storage::is_known_missing(const Digest& key,
+                          const SecondaryStorageEntry& storage)
+{
+#ifdef INODE_CACHE_SUPPORTED
+  return m_negative_lookup_cache.is_missing(storage.url, key);
+#else
+  (void)key;
+  (void)storage;
+  return false;
+#endif
+}
+
+void
+Storage::remember_miss(const Digest& key, const SecondaryStorageEntry& storage)
+{
+#ifdef INODE_CACHE_SUPPORTED
+  m_negative_lookup_cache.remember_miss(storage.url, key);
+#else
+  (void)key;
+  (void)storage;
+#endif
+}
+
+void
+Storage::wait_for_lookup_threads()
+{
+  for (auto& storage : m_secondary_storages) {
+    if (storage.lookup_thread.joinable()) {
+      storage.lookup_thread.join();
+    }
+  }
+}
+
+// Write a copy of the cache entry at `path` compressed with Zstandard level
+// `level` to a temporary file. Returns the path of the copy, or nonstd::nullopt
+// if the entry already has that level or could not be transcoded.
+static nonstd::optional<std::string>
+transcode_entry(const std::string& path,
+                const int8_t level,
+                const std::string& temporary_dir)
+{
+  std::string tmp_path;
+  try {
+    File file(path, "rb");
+    if (!file) {
+      throw Error("failed to open {}: {}", path, strerror(errno));
+    }
+    uint8_t magic[4];
+    if (fread(magic, sizeof(magic), 1, *file) != 1) {
+      throw Error("failed to read {}", path);
+    }
+    rewind(*file);
+    const bool is_result = memcmp(magic, Result::k_magic, sizeof(magic)) == 0;
+    CacheEntryReader reader(
+      *file,
+      is_result ? Result::k_magic : Manifest::k_magic,
+      is_result ? Result::k_version : Manifest::k_version);
+    if (reader.compression_type() == Compression::Type::zstd
+        && reader.compression_level() == level) {
+      return nonstd::nullopt;
+    }
+
+    TemporaryFile tmp_file(FMT("{}/tmp.upload", temporary_dir));
+    tmp_path = tmp_file.path;
+    tmp_file.fd.close();
+    File tmp_stream(tmp_path, "wb");
+    if (!tmp_stream) {
+      throw Error("failed to open {}: {}", tmp_path, strerror(errno));
+    }
+    ::CacheEntryWriter writer(*tmp_stream,
+                              reader.magic(),
+                              reader.version(),
+                              Compression::Type::zstd,
+                              level,
+                              reader.payload_size());
+
+    // Stream the payload so that the entry is never held in memory.
+    char buffer[READ_BUFFER_SIZE];
+    uint64_t bytes_left = reader.payload_size();
+    while (bytes_left > 0) {
+      const size_t bytes_to_read =
+        std::min<uint64_t>(bytes_left, sizeof(buffer));
+      reader.read(buffer, bytes_to_read);
+      writer.write(buffer, bytes_to_read);
+      bytes_left -= bytes_to_read;
+    }
+    reader.finalize();
+    writer.finalize();
+    if (fflush(*tmp_stream) != 0) {
+      throw Error("failed to write {}: {}", tmp_path, strerror(errno));
+    }
+
+    LOG("Transcoded {} from level {} to level {} for upload",
+        path,
+        reader.compression_level(),
+        level);
+    return tmp_path;
+  } catch (const Error& e) {
+    LOG("Failed to transcode {}: {}", path, e.what());
+    if (!tmp_path.empty()) {
+      Util::unlink_tmp(tmp_path);
+    }
+    return nonstd::nullopt;
+  }
+}
+
+bool
+Storage::put_in_secondary_storages(
+  const std::vector<SecondaryStorage::KeyAndPath>& entries)
+{
+  // Entries transcoded to the compression level of some backend, by level.
+  std::map<int8_t, std::vector<SecondaryStorage::KeyAndPath>> transcoded;
+  std::vector<std::string> tmp_paths;
+  Finalizer tmp_file_remover([&] {
+    for (const auto& path : tmp_paths) {
+      Util::unlink_tmp(path);
+    }
+  });
+
+  const auto get_entries = [&](const SecondaryStorageEntry& storage)
+    -> const std::vector<SecondaryStorage::KeyAndPath>& {
+    if (!storage.compression_level) {
+      return entries;
+    }
+    const int8_t level = *storage.compression_level == 0
+                           ? ZstdCompressor::default_compression_level
+                           : *storage.compression_level;
+    auto it = transcoded.find(level);
+    if (it == transcoded.end()) {
+      std::vector<SecondaryStorage::KeyAndPath> level_entries;
+      for (const auto& entry : entries) {
+        const auto path =
+          transcode_entry(entry.second, level, m_config.temporary_dir());
+        if (path) {
+          tmp_paths.push_back(*path);
+        }
+        level_entries.emplace_back(entry.first, path ? *path : entry.second);
+      }
+      it = transcoded.emplace(level, std::move(level_entries)).first;
+    }
+    return it->second;
+  };
+
+  bool all_stored = true;
+  for (auto& storage : m_secondary_storages) {
     if (storage.read_only) {
-      LOG("Did not remove {} from {} since it is read-only",
-          key.to_string(),
-          storage.url);
+      for (const auto& entry : entries) {
+        LOG("Not storing {} in {} since it is read-only",
+            entry.first.to_string(),
+            storage.url);
+      }
+      continue;
+    }
+    if (is_unhealthy(storage)) {
+      all_stored = false;
+      continue;
+    }
+    if (latency_budget_exhausted()) {
+      increment_statistic(Statistic::secondary_storage_skipped);
+      all_stored = false;
       continue;
     }
 
-    const auto result = storage.backend->remove(key);
+    const auto& storage_entries = get_entries(storage);
+    set_operation_deadline(storage);
+    const auto start = Clock::now();
+    const auto result = storage.backend->put_many_from_files(storage_entries);
+    m_secondary_storage_time += Clock::now() - start;
     if (!result) {
       // The backend is expected to log details about the error.
-      // TODO: Update statistics.
+      report_failure(storage, result.error());
+      all_stored = false;
       continue;
     }
+    storage.health.record_success();
 
-    const bool removed = *result;
-    if (removed) {
-      LOG("Removed {} from {}", key.to_string(), storage.url);
-    } else {
-      LOG("No {} to remove from {}", key.to_string(), storage.url);
+    for (size_t i = 0; i < entries.size(); ++i) {
+      LOG("{} {} in {}",
+          (*result)[i] ? "Stored" : "Failed to store",
+          entries[i].first.to_string(),
+          storage.url);
+#ifdef INODE_CACHE_SUPPORTED
+      if ((*result)[i]) {
+        m_negative_lookup_cache.forget(storage.url, entries[i].first);
+      }
+#endif
+    }
+  }
+
+  return all_stored;
+}
+
+std::vector<std::string>
+Storage::queue_pending_uploads()
+{
+  std::vector<std::string> queued_paths;
+  if (m_pending_uploads.empty()) {
+    return queued_paths;
+  }
+
+  const auto queue_dir = get_upload_queue_dir(m_config);
+  if (!Util::create_dir(queue_dir)) {
+    LOG("Failed to create directory {}: {}", queue_dir, strerror(errno));
+  }
+
+  const time_t now = time(nullptr);
+  for (const auto& upload : m_pending_uploads) {
+    const auto& key = upload.first;
+    const auto& path = upload.second;
+    const auto queue_path =
+      FMT("{}/{}", queue_dir, get_upload_queue_entry_name(key, now));
+
+    // A hard link is cheap and keeps the data even if the primary storage entry
+    // is evicted before the upload has finished.
+    try {
+      Util::hard_link(path, queue_path);
+    } catch (const Error&) {
+      try {
+        Util::copy_file(path, queue_path, true);
+      } catch (const Error& e) {
+        LOG("Failed to queue {} for upload: {}", path, e.what());
+        increment_statistic(Statistic::secondary_storage_upload_dropped);
+        continue;
+      }
+    }
+
+    LOG("Queued {} for upload to secondary storage", key.to_string());
+    increment_statistic(Statistic::secondary_storage_upload_queued);
+    queued_paths.push_back(queue_path);
+  }
+
+  return queued_paths;
+}
+
+void
+Storage::process_upload_queue(const std::vector<std::string>& queued_paths)
+{
+  bool all_uploaded = true;
+
+  if (!upload_queued_entries(queued_paths)) {
+    increment_statistic(Statistic::secondary_storage_upload_failed,
+                        queued_paths.size());
+    all_uploaded = false;
+  }
+
+  // Also retry uploads left behind by earlier invocations, unless secondary
+  // storage seems to be unavailable right now.
+  if (all_uploaded) {
+    std::vector<std::string> old_paths;
+    try {
+      Util::traverse(get_upload_queue_dir(m_config),
+                     [&](const std::string& path, bool is_dir) {
+                       if (!is_dir) {
+                         old_paths.push_back(path);
+                       }
+                     });
+    } catch (const Error& e) {
+      LOG("Failed to scan upload queue: {}", e.what());
     }
+
+    const time_t now = time(nullptr);
+    for (const auto& path : old_paths) {
+      const auto entry = parse_upload_queue_entry_name(Util::base_name(path));
+      time_t queued_at;
+      if (entry) {
+        queued_at = entry->queued_at;
+      } else {
+        // Probably a temporary file, so use its modification time to get rid
+        // of it eventually if it was left behind.
+        const auto st = Stat::lstat(path);
+        if (!st) {
+          continue;
+        }
+        queued_at = st.mtime();
+      }
+      if (queued_at + k_upload_retry_delay > now) {
+        continue;
+      }
+      if (queued_at + k_max_upload_age < now) {
+        LOG("Dropping {} from upload queue since it's too old", path);
+        Util::unlink_safe(path);
+        if (entry) {
+          increment_statistic(Statistic::secondary_storage_upload_dropped);
+        }
+        continue;
+      }
+      if (!upload_queued_entries({path})) {
+        increment_statistic(Statistic::secondary_storage_upload_failed);
+        break;
+      }
+    }
+  }
+
+  if (!m_counter_updates.all_zero()) {
+    m_primary_storage.update_statistics(m_counter_updates);
+    m_counter_updates = Counters();
   }
 }
 
+bool
+Storage::upload_queued_entries(const std::vector<std::string>& paths)
+{
+  std::vector<SecondaryStorage::KeyAndPath> entries;
+  for (const auto& path : paths) {
+    const auto entry = parse_upload_queue_entry_name(Util::base_name(path));
+    if (!entry) {
+      // Probably a temporary file being written by another process.
+      continue;
+    }
+    LOG("Uploading {} to secondary storage", path);
+    entries.emplace_back(entry->key, path);
+  }
+
+  if (entries.empty()) {
+    return true;
+  }
+  if (!put_in_secondary_storages(entries)) {
+    return false;
+  }
+  for (const auto& entry : entries) {
+    Util::unlink_safe(entry.second);
+  }
+  return true;
+}
+
 namespace {
 
 struct ParseStorageEntryResult
@@ -183,6 +884,8 @@ struct ParseStorageEntryResult
   std::string url;
   storage::AttributeMap attributes;
   bool read_only = false;
+  int64_t priority = 0;
+  nonstd::optional<int8_t> compression_level;
 };
 
 } // namespace
@@ -209,6 +912,17 @@ parse_storage_entry(const nonstd::string_view& entry)
     }
     if (key == "read-only" && value == "true") {
       result.read_only = true;
+    } else if (key == "priority") {
+      result.priority = Util::parse_signed(*decoded_value,
+                                           nonstd::nullopt,
+                                           nonstd::nullopt,
+                                           "priority attribute");
+    } else if (key == "compression-level") {
+      result.compression_level =
+        Util::parse_signed(*decoded_value,
+                           INT8_MIN,
+                           INT8_MAX,
+                           "compression-level attribute");
     } else {
       result.attributes.emplace(std::string(key), *decoded_value);
     }
@@ -224,22 +938,79 @@ create_storage(const ParseStorageEntryResult& storage_entry)
     return std::make_unique<secondary::FileStorage>(storage_entry.url,
                                                     storage_entry.attributes);
   }
+#ifndef _WIN32
+  if (storage_entry.scheme == "http") {
+    return std::make_unique<secondary::HttpStorage>(storage_entry.url,
+                                                    storage_entry.attributes);
+  }
+#endif
 
   return {};
 }
 
+uint64_t
+Storage::reshard_secondary_storages(
+  const Util::ProgressReceiver& progress_receiver)
+{
+  std::vector<ParseStorageEntryResult> storage_entries;
+  for (const auto& entry : util::Tokenizer(m_config.secondary_storage(), " ")) {
+    auto storage_entry = parse_storage_entry(entry);
+    if (storage_entry.scheme != "file") {
+      LOG("Not resharding {} since it's not a file storage",
+          storage_entry.url);
+    } else if (storage_entry.read_only) {
+      LOG("Not resharding {} since it is read-only", storage_entry.url);
+    } else {
+      storage_entries.push_back(std::move(storage_entry));
+    }
+  }
+
+  uint64_t moved_entries = 0;
+  for (size_t i = 0; i < storage_entries.size(); ++i) {
+    secondary::FileStorage storage(storage_entries[i].url,
+                                   storage_entries[i].attributes);
+    moved_entries += storage.reshard([&](double progress) {
+      progress_receiver((i + progress) / storage_entries.size());
+    });
+  }
+  progress_receiver(1.0);
+  return moved_entries;
+}
+
 void
 Storage::add_secondary_storages()
 {
   for (const auto& entry : util::Tokenizer(m_config.secondary_storage(), " ")) {
-    const auto storage_entry = parse_storage_entry(entry);
-    auto storage = create_storage(storage_entry);
-    if (!storage) {
-      throw Error("unknown secondary storage URL: {}", storage_entry.url);
-    }
-    m_secondary_storages.push_back(SecondaryStorageEntry{
-      std::move(storage), storage_entry.url, storage_entry.read_only});
+    add_secondary_storage(entry);
+  }
+}
+
+void
+Storage::add_secondary_storage(nonstd::string_view entry,
+                               std::unique_ptr<SecondaryStorage> backend)
+{
+  const auto storage_entry = parse_storage_entry(entry);
+  if (!backend) {
+    backend = create_storage(storage_entry);
+  }
+  if (!backend) {
+    throw Error("unknown secondary storage URL: {}", storage_entry.url);
   }
+  const auto health_path =
+    FMT("{}/secondary-health/{}",
+        m_config.cache_dir(),
+        Hash().hash(storage_entry.url).digest().to_string());
+  m_secondary_storages.push_back(SecondaryStorageEntry{
+    std::move(backend),
+    storage_entry.url,
+    storage_entry.read_only,
+    storage_entry.priority,
+    SecondaryStorageHealth(health_path,
+                           m_config.secondary_storage_failure_threshold(),
+                           m_config.secondary_storage_cool_down()),
+    storage_entry.compression_level,
+    std::thread(),
+    std::make_shared<std::atomic<bool>>(false)});
 }
 
 } // namespace storage
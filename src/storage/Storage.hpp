@@ -20,18 +20,28 @@
 
 #include "types.hpp"
 
+#include <Counters.hpp>
+#include <Digest.hpp>
+#include <Util.hpp>
 #include <core/types.hpp>
 #include <storage/SecondaryStorage.hpp>
+#include <storage/SecondaryStorageHealth.hpp>
 #include <storage/primary/PrimaryStorage.hpp>
+#ifdef INODE_CACHE_SUPPORTED
+#  include <storage/NegativeLookupCache.hpp>
+#endif
 
 #include <third_party/nonstd/optional.hpp>
+#include <third_party/nonstd/string_view.hpp>
 
+#include <atomic>
+#include <chrono>
 #include <functional>
+#include <memory>
 #include <string>
+#include <thread>
 #include <vector>
 
-class Digest;
-
 namespace storage {
 
 class Storage
@@ -55,20 +65,76 @@ public:
 
   void remove(const Digest& key, core::CacheEntryType type);
 
+  // Add a secondary storage backend given by `entry` (with the syntax of an
+  // entry in the secondary_storage setting). `backend` is used instead of
+  // creating one from the URL if set.
+  void add_secondary_storage(nonstd::string_view entry,
+                             std::unique_ptr<SecondaryStorage> backend = {});
+
+  // Move entries in file secondary storage backends to the directory layout
+  // given by their attributes. Returns the number of moved entries.
+  uint64_t
+  reshard_secondary_storages(const Util::ProgressReceiver& progress_receiver);
+
 private:
   struct SecondaryStorageEntry
   {
     std::unique_ptr<storage::SecondaryStorage> backend;
     std::string url;
     bool read_only = false;
+    int64_t priority = 0;
+    SecondaryStorageHealth health;
+    // Compression level to transcode entries to before storing them.
+    nonstd::optional<int8_t> compression_level;
+    // Thread running a parallel lookup in the backend. It may still be running
+    // after the lookup has been won by another backend.
+    std::thread lookup_thread;
+    std::shared_ptr<std::atomic<bool>> lookup_running;
   };
 
   const Config& m_config;
   primary::PrimaryStorage m_primary_storage;
   std::vector<SecondaryStorageEntry> m_secondary_storages;
   std::vector<std::string> m_tmp_files;
+  std::vector<SecondaryStorage::KeyAndPath> m_pending_uploads;
+
+  // Statistics for secondary storage operations, added to the primary storage
+  // statistics by finalize() or process_upload_queue().
+  Counters m_counter_updates;
+
+  // Time spent waiting for secondary storage in this process and whether that
+  // time is limited by secondary_storage_latency_budget (it's not when
+  // uploading in the background).
+  std::chrono::steady_clock::duration m_secondary_storage_time{0};
+  bool m_apply_latency_budget = true;
+#ifdef INODE_CACHE_SUPPORTED
+  NegativeLookupCache m_negative_lookup_cache;
+#endif
 
   void add_secondary_storages();
+  std::string create_tmp_file_for_get();
+  void increment_statistic(Statistic statistic, int64_t value = 1);
+  bool is_unhealthy(SecondaryStorageEntry& storage);
+  bool is_busy(SecondaryStorageEntry& storage);
+  void report_failure(SecondaryStorageEntry& storage,
+                      SecondaryStorage::Error error);
+  nonstd::optional<std::chrono::milliseconds> remaining_latency_budget() const;
+  void set_operation_deadline(SecondaryStorageEntry& storage) const;
+  bool latency_budget_exhausted();
+  nonstd::optional<std::string>
+  get_from_secondary_storage(const Digest& key,
+                             SecondaryStorageEntry& storage);
+  nonstd::optional<std::string> get_from_secondary_storages_in_parallel(
+    const Digest& key, const std::vector<SecondaryStorageEntry*>& storages);
+  bool is_known_missing(const Digest& key,
+                        const SecondaryStorageEntry& storage);
+  void remember_miss(const Digest& key, const SecondaryStorageEntry& storage);
+  void wait_for_lookup_threads();
+  bool put_in_secondary_storages(
+    const std::vector<SecondaryStorage::KeyAndPath>& entries);
+  std::vector<std::string> queue_pending_uploads();
+  void process_upload_queue(const std::vector<std::string>& queued_paths);
+  bool upload_queued_entries(const std::vector<std::string>& paths);
 };
 
 } // namespace storage
@@ -0,0 +1,285 @@
+// Copyright (C) 2021 Joel Rosdahl and other contributors
+//
+// See doc/AUTHORS.adoc for a complete list of contributors.
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc., 51
+// Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#include "LruIndex.hpp"
+
+#include <AtomicFile.hpp>
+#include <Fd.hpp>
+#include <Logging.hpp>
+#include <Stat.hpp>
+#include <Util.hpp>
+#include <exceptions.hpp>
+#include <fmtmacros.hpp>
+
+#include <algorithm>
+#include <unordered_map>
+
+namespace storage {
+namespace primary {
+
+namespace {
+
+const nonstd::string_view k_header = "# ccache LRU index 2\n";
+const nonstd::string_view k_partial_header = "# ccache partial LRU index 2\n";
+
+// Attempts to append a line when the index keeps being replaced.
+const int k_max_append_attempts = 3;
+
+std::string
+format_line(const LruIndex::Entry& entry)
+{
+  return FMT("{} {} {} {} {}\n",
+             entry.time,
+             entry.name,
+             entry.size,
+             entry.cost,
+             entry.hits);
+}
+
+// Return whether `path` no longer refers to the file open as `fd`.
+bool
+was_replaced(const std::string& path, int fd)
+{
+#ifdef _WIN32
+  // An open file can't be replaced on Windows.
+  (void)path;
+  (void)fd;
+  return false;
+#else
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    return false;
+  }
+  const auto current = Stat::stat(path);
+  return current
+         && (current.device() != st.st_dev || current.inode() != st.st_ino);
+#endif
+}
+
+// Append `line` to the index at `path` if it exists.
+void
+append_line(const std::string& path, const std::string& line)
+{
+  for (int attempt = 0; attempt < k_max_append_attempts; ++attempt) {
+    Fd fd(open(path.c_str(), O_WRONLY | O_APPEND | O_BINARY));
+    if (!fd) {
+      return;
+    }
+    // A single write of a short line with O_APPEND won't be interleaved with
+    // lines written by other processes.
+    try {
+      Util::write_fd(*fd, line.data(), line.size());
+    } catch (const Error& e) {
+      LOG("Failed to write to {}: {}", path, e.what());
+      return;
+    }
+
+    // If LruIndex::write replaced the index after the line was written but
+    // before it read the tail, the line only ended up in the old file. (If the
+    // tail was read, the line is recorded twice, which is harmless except that
+    // a retrieval counts as two hits.)
+    if (!was_replaced(path, *fd)) {
+      return;
+    }
+  }
+  LOG("Failed to append to {} since it keeps being replaced", path);
+}
+
+} // namespace
+
+const char LruIndex::k_file_name[] = "lru";
+
+LruIndex::LruIndex(const std::string& level_1_dir)
+  : m_path(FMT("{}/{}", level_1_dir, k_file_name))
+{
+}
+
+void
+LruIndex::touch(nonstd::string_view name, int64_t time) const
+{
+  append_line(m_path, FMT("{} {}\n", time, name));
+}
+
+void
+LruIndex::record(const Entry& entry) const
+{
+  append_line(m_path, format_line(entry));
+}
+
+nonstd::optional<size_t>
+LruIndex::parse(
+  const std::function<void(const Entry& entry, bool complete)>& line_visitor,
+  bool allow_partial) const
+{
+  std::string data;
+  try {
+    data = Util::read_file(m_path);
+  } catch (const Error&) {
+    return nonstd::nullopt;
+  }
+  size_t pos;
+  if (Util::starts_with(data, k_header)) {
+    pos = k_header.length();
+  } else if (allow_partial && Util::starts_with(data, k_partial_header)) {
+    pos = k_partial_header.length();
+  } else {
+    LOG("Ignoring invalid LRU index {}", m_path);
+    return nonstd::nullopt;
+  }
+
+  while (true) {
+    const size_t end = data.find('\n', pos);
+    if (end == std::string::npos) {
+      // Not terminated, so possibly still being written. Leave it for write()
+      // to carry over.
+      break;
+    }
+    const nonstd::string_view line(data.data() + pos, end - pos);
+    pos = end + 1;
+
+    const auto fields = Util::split_into_views(line, " ");
+    if (fields.size() != 2 && fields.size() != 5) {
+      continue;
+    }
+    Entry entry;
+    try {
+      entry.time = Util::parse_signed(std::string(fields[0]));
+      entry.name = std::string(fields[1]);
+      if (fields.size() == 5) {
+        entry.size = Util::parse_unsigned(std::string(fields[2]));
+        entry.cost = Util::parse_unsigned(std::string(fields[3]));
+        entry.hits = Util::parse_unsigned(std::string(fields[4]));
+      }
+    } catch (const Error&) {
+      continue;
+    }
+    line_visitor(entry, fields.size() == 5);
+  }
+  return pos;
+}
+
+nonstd::optional<std::vector<LruIndex::Entry>>
+LruIndex::read()
+{
+  std::unordered_map<std::string, Entry> entries_by_name;
+  const auto size = parse([&](const Entry& line_entry, bool complete) {
+    auto& entry = entries_by_name[line_entry.name];
+    const int64_t time = std::max(entry.time, line_entry.time);
+    if (complete) {
+      entry = line_entry;
+    } else {
+      entry.name = line_entry.name;
+      ++entry.hits;
+    }
+    entry.time = time;
+  });
+  if (!size) {
+    return nonstd::nullopt;
+  }
+  m_read_size = *size;
+
+  std::vector<Entry> entries;
+  entries.reserve(entries_by_name.size());
+  for (auto& item : entries_by_name) {
+    entries.push_back(std::move(item.second));
+  }
+  std::sort(entries.begin(), entries.end(), [](const auto& e1, const auto& e2) {
+    return e1.time < e2.time || (e1.time == e2.time && e1.name < e2.name);
+  });
+  return entries;
+}
+
+nonstd::optional<std::vector<LruIndex::Entry>>
+LruIndex::read_lines() const
+{
+  std::vector<Entry> lines;
+  const auto size = parse([&](const Entry& entry, bool /*complete*/) {
+    lines.push_back(entry);
+  });
+  if (!size) {
+    return nonstd::nullopt;
+  }
+  return lines;
+}
+
+void
+LruIndex::create_partial() const
+{
+  Fd fd(open(m_path.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_BINARY, 0666));
+  if (!fd) {
+    return;
+  }
+  try {
+    Util::write_fd(*fd, k_partial_header.data(), k_partial_header.size());
+  } catch (const Error& e) {
+    LOG("Failed to write {}: {}", m_path, e.what());
+  }
+}
+
+std::vector<LruIndex::Entry>
+LruIndex::read_stored_since(int64_t time) const
+{
+  std::unordered_map<std::string, Entry> entries_by_name;
+  parse(
+    [&](const Entry& entry, bool complete) {
+      if (complete && entry.time >= time) {
+        entries_by_name[entry.name] = entry;
+      }
+    },
+    true);
+
+  std::vector<Entry> entries;
+  entries.reserve(entries_by_name.size());
+  for (auto& item : entries_by_name) {
+    entries.push_back(std::move(item.second));
+  }
+  return entries;
+}
+
+void
+LruIndex::write(const std::vector<Entry>& entries)
+{
+  std::string content(k_header);
+  for (const auto& entry : entries) {
+    content += format_line(entry);
+  }
+
+  if (m_read_size > 0) {
+    // Keep uses recorded after read() since they were not locked out.
+    try {
+      const auto data = Util::read_file(m_path);
+      if (data.size() > m_read_size) {
+        content.append(data, m_read_size, std::string::npos);
+      }
+    } catch (const Error&) {
+      // The index is gone, so there is nothing to keep.
+    }
+  }
+
+  try {
+    AtomicFile file(m_path, AtomicFile::Mode::binary);
+    file.write(content);
+    file.commit();
+    m_read_size = content.size();
+  } catch (const Error& e) {
+    LOG("Failed to write {}: {}", m_path, e.what());
+  }
+}
+
+} // namespace primary
+} // namespace storage
@@ -0,0 +1,111 @@
+// Copyright (C) 2021 Joel Rosdahl and other contributors
+//
+// See doc/AUTHORS.adoc for a complete list of contributors.
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc., 51
+// Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#pragma once
+
+#include <third_party/nonstd/optional.hpp>
+#include <third_party/nonstd/string_view.hpp>
+
+#include <cstdint>
+#include <ctime>
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace storage {
+namespace primary {
+
+// A record of how the cache entries in a level 1 directory have been used so
+// that cleanup can find the entries to evict without traversing the directory.
+//
+// The index is a text file with a header line followed by lines of two kinds:
+// "<time> <name>" records that the cache entry with file name `name` was
+// retrieved and "<time> <name> <size> <cost> <hits>" records everything known
+// about the entry, which is appended when the entry is stored and written when
+// the index is rewritten. Lines are appended without locking, and only to an
+// existing index. An appender that finds that the index was replaced while it
+// wrote appends the line again to the new index. The index is only made valid
+// by a cleanup that has traversed the directory, so it covers all entries:
+// while traversing, the cleanup lets a partial index collect the lines of
+// entries stored meanwhile and carries them over. Rewriting the index must be
+// done with a Lockfile on path() held.
+class LruIndex
+{
+public:
+  struct Entry
+  {
+    std::string name;
+    int64_t time = 0;  // Last use
+    uint64_t size = 0; // Size on disk in bytes, 0 if unknown
+    uint64_t cost = 0; // Milliseconds it took to create the entry, 0 if unknown
+    uint64_t hits = 0; // Number of retrievals since the entry was stored
+  };
+
+  // Name of the index file in the level 1 directory.
+  static const char k_file_name[];
+
+  LruIndex(const std::string& level_1_dir);
+
+  const std::string& path() const;
+
+  // Record that the entry `name` was retrieved at `time`.
+  void touch(nonstd::string_view name, int64_t time = ::time(nullptr)) const;
+
+  // Record that `entry` was stored.
+  void record(const Entry& entry) const;
+
+  // Read the index. Returns one element per entry with the latest time it was
+  // used, least recently used first, or nullopt if there is no valid index.
+  nonstd::optional<std::vector<Entry>> read();
+
+  // Read the lines of the index in order without merging lines about the same
+  // entry. Only name and time are set for retrievals.
+  nonstd::optional<std::vector<Entry>> read_lines() const;
+
+  // Create a partial index, which is not valid for read() but collects
+  // appended lines, if there is no index.
+  void create_partial() const;
+
+  // Return the entries recorded as stored at `time` or later, also if the index
+  // is partial.
+  std::vector<Entry> read_stored_since(int64_t time) const;
+
+  // Replace the index with `entries`. Lines appended since read() was called
+  // are kept.
+  void write(const std::vector<Entry>& entries);
+
+private:
+  const std::string m_path;
+  size_t m_read_size = 0; // Number of bytes handled by read()
+
+  // Call `line_visitor` with each valid line and whether it records everything
+  // about the entry. Returns the number of bytes handled.
+  nonstd::optional<size_t>
+  parse(const std::function<void(const Entry& entry, bool complete)>&
+          line_visitor,
+        bool allow_partial = false) const;
+};
+
+inline const std::string&
+LruIndex::path() const
+{
+  return m_path;
+}
+
+} // namespace primary
+} // namespace storage
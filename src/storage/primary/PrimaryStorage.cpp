@@ -18,8 +18,12 @@
 
 #include "PrimaryStorage.hpp"
 
+#include "LruIndex.hpp"
+
+#include <AtomicFile.hpp>
 #include <Config.hpp>
 #include <Counters.hpp>
+#include <Lockfile.hpp>
 #include <Logging.hpp>
 #include <MiniTrace.hpp>
 #include <Statistic.hpp>
@@ -28,9 +32,12 @@
 #include <assertions.hpp>
 #include <cleanup.hpp>
 #include <exceptions.hpp>
+#include <execute.hpp>
 #include <fmtmacros.hpp>
 #include <util/file_utils.hpp>
 
+#include <algorithm>
+
 namespace storage {
 namespace primary {
 
@@ -50,8 +57,9 @@ const uint8_t k_min_cache_levels = 2;
 
 // Maximum number of cache levels ($CCACHE_DIR/1/2/3/stored_file).
 //
-// On a cache miss, (k_max_cache_levels - k_min_cache_levels + 1) cache lookups
-// (i.e. stat system calls) will be performed for a cache entry.
+// On a cache miss in a level 1 directory without a levels file (see
+// k_cache_levels_file_name), (k_max_cache_levels - k_min_cache_levels + 1)
+// cache lookups (i.e. stat system calls) will be performed for a cache entry.
 //
 // An assumption made here is that if a cache is so large that it holds more
 // than 16^4 * k_max_cache_files_per_directory files then we can assume that the
@@ -59,6 +67,34 @@ const uint8_t k_min_cache_levels = 2;
 // k_max_cache_files_per_directory.
 const uint8_t k_max_cache_levels = 4;
 
+// Name of the file in a level 1 directory that lists the cache levels that may
+// hold cache files in the directory, the level to store new files on first.
+// Levels other than the first are only listed until the files on them have
+// been moved to the first level, so normally only one lookup is needed.
+const char k_cache_levels_file_name[] = "levels";
+
+// Name (without ".lock" suffix) of the lockfile in a level 1 directory that is
+// held while moving the files in the directory to another cache level.
+const char k_releveling_lock_name[] = "relevel";
+
+// Compact the LRU index of a level 1 directory when it has grown to more than
+// this many bytes per file in the directory, i.e. several lines per entry.
+const uint64_t k_max_lru_index_bytes_per_file = 256;
+
+// Name (without ".lock" suffix) of the lockfile in a level 1 directory that is
+// held by a background cleanup of the directory.
+const char k_background_cleanup_lock_name[] = "cleanup";
+
+// Don't start a new background cleanup of a level 1 directory while the
+// lockfile of another one is younger than this many seconds.
+const int k_background_cleanup_timeout = 15 * 60;
+
+// Staleness limit (in microseconds) of the lock held by a background job while
+// it runs, so that a job started at the same time as another one waits for it
+// instead of breaking its lock.
+const uint32_t k_background_job_lock_staleness_limit =
+  static_cast<uint32_t>(k_background_cleanup_timeout) * 1000000;
+
 static std::string
 suffix_from_type(const core::CacheEntryType type)
 {
@@ -73,6 +109,12 @@ suffix_from_type(const core::CacheEntryType type)
   ASSERT(false);
 }
 
+static std::string
+get_level_1_dir(const std::string& cache_dir, const Digest& key)
+{
+  return FMT("{}/{:x}", cache_dir, key.bytes()[0] >> 4);
+}
+
 static uint8_t
 calculate_wanted_cache_level(const uint64_t files_in_level_1)
 {
@@ -86,6 +128,76 @@ calculate_wanted_cache_level(const uint64_t files_in_level_1)
   return k_max_cache_levels;
 }
 
+static std::vector<uint8_t>
+all_cache_levels()
+{
+  std::vector<uint8_t> levels;
+  for (uint8_t level = k_min_cache_levels; level <= k_max_cache_levels;
+       ++level) {
+    levels.push_back(level);
+  }
+  return levels;
+}
+
+static std::string
+get_cache_levels_path(const std::string& level_1_dir)
+{
+  return FMT("{}/{}", level_1_dir, k_cache_levels_file_name);
+}
+
+static nonstd::optional<std::vector<uint8_t>>
+read_cache_levels(const std::string& level_1_dir)
+{
+  const auto path = get_cache_levels_path(level_1_dir);
+  std::string content;
+  try {
+    content = Util::read_file(path);
+  } catch (const Error&) {
+    return nonstd::nullopt;
+  }
+
+  std::vector<uint8_t> levels;
+  try {
+    for (const auto& word : Util::split_into_strings(content, " \n")) {
+      levels.push_back(static_cast<uint8_t>(Util::parse_unsigned(
+        word, k_min_cache_levels, k_max_cache_levels, "cache level")));
+    }
+  } catch (const Error& e) {
+    LOG("Ignoring {}: {}", path, e.what());
+    return nonstd::nullopt;
+  }
+  if (levels.empty()) {
+    return nonstd::nullopt;
+  }
+  return levels;
+}
+
+static void
+write_cache_levels(const std::string& level_1_dir,
+                   const std::vector<uint8_t>& levels)
+{
+  std::string content;
+  for (const auto level : levels) {
+    content += FMT("{} ", static_cast<unsigned>(level));
+  }
+  content.back() = '\n';
+
+  AtomicFile file(get_cache_levels_path(level_1_dir), AtomicFile::Mode::text);
+  file.write(content);
+  file.commit();
+}
+
+// Return whether `name` (a path relative to the cache directory without
+// slashes) is the name of a result, manifest or raw file, as opposed to e.g. a
+// temporary file or a lockfile.
+static bool
+is_cache_file_name(const std::string& name)
+{
+  return name.length() > k_max_cache_levels
+         && name.find('.') == std::string::npos
+         && (name.back() == 'R' || name.back() == 'M' || name.back() == 'W');
+}
+
 PrimaryStorage::PrimaryStorage(const Config& config) : m_config(config)
 {
 }
@@ -94,9 +206,7 @@ void
 PrimaryStorage::initialize()
 {
   MTR_BEGIN("primary_storage", "clean_up_internal_tempdir");
-  if (m_config.temporary_dir() == m_config.cache_dir() + "/tmp") {
-    clean_up_internal_tempdir();
-  }
+  clean_up_internal_tempdir();
   MTR_END("primary_storage", "clean_up_internal_tempdir");
 }
 
@@ -117,17 +227,8 @@ PrimaryStorage::finalize()
   }
 
   if (!m_result_key) {
-    // No result entry was written, so we just choose one of the stats files in
-    // the 256 level 2 directories.
-
-    ASSERT(m_result_counter_updates.get(Statistic::cache_size_kibibyte) == 0);
-    ASSERT(m_result_counter_updates.get(Statistic::files_in_cache) == 0);
-
-    const auto bucket = getpid() % 256;
-    const auto stats_file =
-      FMT("{}/{:x}/{:x}/stats", m_config.cache_dir(), bucket / 16, bucket % 16);
-    Statistics::update(
-      stats_file, [&](auto& cs) { cs.increment(m_result_counter_updates); });
+    // No result entry was written, so there is no natural stats file to use.
+    update_statistics(m_result_counter_updates);
     return;
   }
 
@@ -142,8 +243,7 @@ PrimaryStorage::finalize()
     return;
   }
 
-  const auto subdir =
-    FMT("{}/{:x}", m_config.cache_dir(), m_result_key->bytes()[0] >> 4);
+  const auto subdir = get_level_1_dir(m_config.cache_dir(), *m_result_key);
   bool need_cleanup = false;
 
   if (m_config.max_files() != 0
@@ -169,8 +269,21 @@ PrimaryStorage::finalize()
     const uint64_t max_size = round(m_config.max_size() * factor);
     const uint32_t max_files = round(m_config.max_files() * factor);
     const time_t max_age = 0;
-    clean_up_dir(
-      subdir, max_size, max_files, max_age, [](double /*progress*/) {});
+    const auto policy = m_config.eviction_policy();
+    if (m_config.background_cleanup()) {
+      start_background_cleanup(subdir, max_size, max_files);
+    } else if (!clean_up_dir_using_index(
+                 subdir, max_size, max_files, policy)) {
+      clean_up_dir(subdir,
+                   max_size,
+                   max_files,
+                   max_age,
+                   policy,
+                   [](double /*progress*/) {});
+    }
+  } else {
+    maybe_compact_lru_index(subdir,
+                            counters->get(Statistic::files_in_cache));
   }
 }
 
@@ -188,6 +301,8 @@ PrimaryStorage::get(const Digest& key, const core::CacheEntryType type) const
 
   // Update modification timestamp to save file from LRU cleanup.
   Util::update_mtime(cache_file.path);
+  LruIndex(get_level_1_dir(m_config.cache_dir(), key))
+    .touch(Util::base_name(cache_file.path));
   return cache_file.path;
 }
 
@@ -222,6 +337,13 @@ PrimaryStorage::put(const Digest& key,
 
   LOG("Stored {} in primary storage ({})", key.to_string(), cache_file.path);
 
+  LruIndex(get_level_1_dir(m_config.cache_dir(), key))
+    .record({std::string(Util::base_name(cache_file.path)),
+             time(nullptr),
+             new_stat.size_on_disk(),
+             m_compile_time,
+             0});
+
   auto& counter_updates = (type == core::CacheEntryType::manifest)
                             ? m_manifest_counter_updates
                             : m_result_counter_updates;
@@ -252,6 +374,12 @@ PrimaryStorage::remove(const Digest& key, const core::CacheEntryType type)
   }
 }
 
+void
+PrimaryStorage::set_compile_time(const uint64_t milliseconds)
+{
+  m_compile_time = milliseconds;
+}
+
 void
 PrimaryStorage::increment_statistic(const Statistic statistic,
                                     const int64_t value)
@@ -259,6 +387,30 @@ PrimaryStorage::increment_statistic(const Statistic statistic,
   m_result_counter_updates.increment(statistic, value);
 }
 
+void
+PrimaryStorage::increment_statistics(const Counters& counter_updates)
+{
+  m_result_counter_updates.increment(counter_updates);
+}
+
+void
+PrimaryStorage::update_statistics(const Counters& counter_updates)
+{
+  if (!m_config.stats()) {
+    return;
+  }
+
+  ASSERT(counter_updates.get(Statistic::cache_size_kibibyte) == 0);
+  ASSERT(counter_updates.get(Statistic::files_in_cache) == 0);
+
+  // Choose one of the stats files in the 256 level 2 directories.
+  const auto bucket = getpid() % 256;
+  const auto stats_file =
+    FMT("{}/{:x}/{:x}/stats", m_config.cache_dir(), bucket / 16, bucket % 16);
+  Statistics::update(stats_file,
+                     [&](auto& cs) { cs.increment(counter_updates); });
+}
+
 // Return a machine-readable string representing the final ccache result, or
 // nullopt if there was no result.
 nonstd::optional<std::string>
@@ -283,8 +435,14 @@ PrimaryStorage::look_up_cache_file(const Digest& key,
 {
   const auto key_string = FMT("{}{}", key.to_string(), suffix_from_type(type));
 
-  for (uint8_t level = k_min_cache_levels; level <= k_max_cache_levels;
-       ++level) {
+  // Without a levels file, files may be on any level and new files are stored
+  // on the shallowest level.
+  static const auto k_all_cache_levels = all_cache_levels();
+  const auto& recorded_levels =
+    get_cache_levels(get_level_1_dir(m_config.cache_dir(), key));
+  const auto& levels = recorded_levels ? *recorded_levels : k_all_cache_levels;
+
+  for (const auto level : levels) {
     const auto path =
       Util::get_path_in_cache(m_config.cache_dir(), level, key_string);
     const auto stat = Stat::stat(path);
@@ -293,9 +451,146 @@ PrimaryStorage::look_up_cache_file(const Digest& key,
     }
   }
 
-  const auto shallowest_path = Util::get_path_in_cache(
-    m_config.cache_dir(), k_min_cache_levels, key_string);
-  return {shallowest_path, Stat(), k_min_cache_levels};
+  const auto wanted_path =
+    Util::get_path_in_cache(m_config.cache_dir(), levels.front(), key_string);
+  return {wanted_path, Stat(), levels.front()};
+}
+
+const nonstd::optional<std::vector<uint8_t>>&
+PrimaryStorage::get_cache_levels(const std::string& level_1_dir) const
+{
+  auto it = m_cache_levels.find(level_1_dir);
+  if (it == m_cache_levels.end()) {
+    it =
+      m_cache_levels.emplace(level_1_dir, read_cache_levels(level_1_dir)).first;
+  }
+  return it->second;
+}
+
+bool
+PrimaryStorage::set_wanted_cache_level(const std::string& level_1_dir,
+                                       const uint8_t wanted_level,
+                                       const bool dir_is_empty)
+{
+  const auto path = get_cache_levels_path(level_1_dir);
+  Lockfile lock(path);
+  if (!lock.acquired()) {
+    LOG("Failed to lock {}", path);
+    return false;
+  }
+
+  // Another process may have updated the file since it was read.
+  auto levels = read_cache_levels(level_1_dir);
+  if (!levels || levels->front() < wanted_level) {
+    // Existing files stay on the previously listed levels (or any level if
+    // there was no levels file) until start_releveling has moved them.
+    std::vector<uint8_t> old_levels;
+    if (levels) {
+      old_levels = *levels;
+    } else if (!dir_is_empty) {
+      old_levels = all_cache_levels();
+    }
+    levels = std::vector<uint8_t>{wanted_level};
+    for (const auto level : old_levels) {
+      if (level != wanted_level) {
+        levels->push_back(level);
+      }
+    }
+    try {
+      write_cache_levels(level_1_dir, *levels);
+    } catch (const Error& e) {
+      LOG("Failed to write {}: {}", path, e.what());
+      return false;
+    }
+    LOG("Storing new files in {} on level {}", level_1_dir, wanted_level);
+  }
+
+  m_cache_levels[level_1_dir] = levels;
+  return true;
+}
+
+void
+PrimaryStorage::start_releveling(const std::string& level_1_dir)
+{
+  const std::string lock_path =
+    FMT("{}/{}", level_1_dir, k_releveling_lock_name);
+  const auto lock_st = Stat::lstat(lock_path + ".lock");
+  if (lock_st
+      && lock_st.mtime() + k_background_cleanup_timeout > time(nullptr)) {
+    LOG("Moving files in {} to another level is already in progress",
+        level_1_dir);
+    return;
+  }
+
+  const auto relevel = [&] {
+    Lockfile lock(lock_path, k_background_job_lock_staleness_limit);
+    if (!lock.acquired()) {
+      return;
+    }
+
+    // Another process may have moved the files while waiting for the lock.
+    const auto levels = read_cache_levels(level_1_dir);
+    if (!levels || levels->size() == 1) {
+      return;
+    }
+    const uint8_t wanted_level = levels->front();
+
+    const std::string& cache_dir = m_config.cache_dir();
+    uint64_t moved_files = 0;
+    for (const auto& file :
+         Util::get_level_1_files(level_1_dir, [](double /*progress*/) {})) {
+      std::string name = file.path().substr(cache_dir.length() + 1);
+      name.erase(std::remove(name.begin(), name.end(), '/'), name.end());
+      if (!is_cache_file_name(name)) {
+        continue;
+      }
+      const auto wanted_path =
+        Util::get_path_in_cache(cache_dir, wanted_level, name);
+      if (file.path() == wanted_path) {
+        continue;
+      }
+      try {
+        Util::create_dir(Util::dir_name(wanted_path));
+        Util::rename(file.path(), wanted_path);
+        ++moved_files;
+      } catch (const Error& e) {
+        LOG("Failed to move {} to {}: {}", file.path(), wanted_path, e.what());
+      }
+    }
+    LOG("Moved {} files in {} to level {}",
+        moved_files,
+        level_1_dir,
+        wanted_level);
+
+    Lockfile levels_lock(get_cache_levels_path(level_1_dir));
+    if (!levels_lock.acquired()) {
+      return;
+    }
+    // Leave the file alone if yet another level is wanted now, in which case a
+    // new job will be started.
+    const auto current_levels = read_cache_levels(level_1_dir);
+    if (current_levels && current_levels->front() == wanted_level) {
+      try {
+        write_cache_levels(level_1_dir, {wanted_level});
+      } catch (const Error& e) {
+        LOG("Failed to write {}: {}",
+            get_cache_levels_path(level_1_dir),
+            e.what());
+      }
+    }
+  };
+
+  LOG("Moving files in {} to level {} in the background",
+      level_1_dir,
+      get_cache_levels(level_1_dir)->front());
+  if (!execute_detached([&] {
+        Util::lower_process_priority();
+        relevel();
+      })) {
+    // Moving all files could take long, so keep looking up files on several
+    // levels instead of doing it now.
+    LOG_RAW("Could not move files to another level in the background");
+  }
 }
 
 void
@@ -310,20 +605,118 @@ PrimaryStorage::clean_up_internal_tempdir()
 
   Util::update_mtime(m_config.cache_dir());
 
-  const std::string& temp_dir = m_config.temporary_dir();
-  if (!Stat::lstat(temp_dir)) {
+  // Stored compiler identities and common hash states are keyed by file
+  // status, so they accumulate as compilers and other files change. Remove old
+  // ones too; one that is still used is simply computed and stored again.
+  std::vector<std::string> dirs{
+    FMT("{}/compiler-identity", m_config.cache_dir()),
+    FMT("{}/common-hash", m_config.cache_dir()),
+  };
+  if (m_config.temporary_dir() == m_config.cache_dir() + "/tmp") {
+    dirs.push_back(m_config.temporary_dir());
+  }
+
+  const auto clean_up = [&] {
+    for (const auto& dir : dirs) {
+      if (!Stat::lstat(dir)) {
+        continue;
+      }
+      Util::traverse(dir, [now](const std::string& path, bool is_dir) {
+        if (is_dir) {
+          return;
+        }
+        const auto st = Stat::lstat(path, Stat::OnError::log);
+        if (st && st.mtime() + k_tempdir_cleanup_interval < now) {
+          Util::unlink_tmp(path);
+        }
+      });
+    }
+  };
+
+  if (!m_config.background_cleanup() || !execute_detached([&] {
+        Util::lower_process_priority();
+        clean_up();
+      })) {
+    clean_up();
+  }
+}
+
+void
+PrimaryStorage::start_background_cleanup(const std::string& subdir,
+                                         uint64_t max_size,
+                                         uint64_t max_files)
+{
+  const std::string lock_path =
+    FMT("{}/{}", subdir, k_background_cleanup_lock_name);
+  const auto lock_st = Stat::lstat(lock_path + ".lock");
+  if (lock_st
+      && lock_st.mtime() + k_background_cleanup_timeout > time(nullptr)) {
+    LOG("Background cleanup of {} is already in progress", subdir);
     return;
   }
 
-  Util::traverse(temp_dir, [now](const std::string& path, bool is_dir) {
-    if (is_dir) {
+  const auto clean_up = [&] {
+    Lockfile lock(lock_path, k_background_job_lock_staleness_limit);
+    if (!lock.acquired()) {
       return;
     }
-    const auto st = Stat::lstat(path, Stat::OnError::log);
-    if (st && st.mtime() + k_tempdir_cleanup_interval < now) {
-      Util::unlink_tmp(path);
+
+    // Another background cleanup may have finished while waiting for the lock.
+    const auto counters = Statistics::read(subdir + "/stats");
+    if ((max_size == 0
+         || counters.get(Statistic::cache_size_kibibyte) * 1024 <= max_size)
+        && (max_files == 0
+            || counters.get(Statistic::files_in_cache) <= max_files)) {
+      LOG("No need to clean up {} anymore", subdir);
+      return;
     }
-  });
+
+    // Time doesn't matter here, so traverse the directory instead of using the
+    // LRU index to also remove stale temporary files and rebuild the index.
+    clean_up_dir(subdir,
+                 max_size,
+                 max_files,
+                 0,
+                 m_config.eviction_policy(),
+                 [](double /*progress*/) {});
+  };
+
+  LOG("Cleaning up {} in the background", subdir);
+  if (!execute_detached([&] {
+        Util::lower_process_priority();
+        clean_up();
+      })) {
+    LOG_RAW("Could not clean up in the background");
+    clean_up();
+  }
+}
+
+void
+PrimaryStorage::maybe_compact_lru_index(const std::string& subdir,
+                                        uint64_t files_in_cache)
+{
+  LruIndex index(subdir);
+  const auto st = Stat::stat(index.path());
+  const uint64_t max_size =
+    std::max<uint64_t>(files_in_cache, 1000) * k_max_lru_index_bytes_per_file;
+  if (!st || static_cast<uint64_t>(st.size()) <= max_size) {
+    return;
+  }
+
+  Lockfile lock(index.path());
+  if (!lock.acquired()) {
+    return;
+  }
+  auto entries = index.read();
+  if (entries) {
+    LOG("Compacting {} with {} entries", index.path(), entries->size());
+    index.write(*entries);
+  } else {
+    // E.g. a partial index left by an interrupted cleanup. The next cleanup
+    // will create a new index.
+    LOG("Removing invalid {}", index.path());
+    Util::unlink_safe(index.path());
+  }
 }
 
 nonstd::optional<Counters>
@@ -362,11 +755,47 @@ PrimaryStorage::update_stats_and_maybe_move_cache_file(
     // Only consider moving the cache file to another level when we have read
     // the level 1 stats file since it's only then we know the proper
     // files_in_cache value.
-    const auto wanted_level =
-      calculate_wanted_cache_level(counters->get(Statistic::files_in_cache));
+    const auto files_in_cache = counters->get(Statistic::files_in_cache);
+    const auto wanted_level = calculate_wanted_cache_level(files_in_cache);
+    const auto level_1_dir = get_level_1_dir(m_config.cache_dir(), key);
+    const auto& levels = get_cache_levels(level_1_dir);
+
+    // Files are never moved to a shallower level since a directory with about
+    // as many files as a level allows would otherwise flip between levels as
+    // cleanups remove files, each time moving all of them. Without a levels
+    // file (i.e. written by an older ccache version) the files may be on any
+    // level, so don't create one, which would mean moving all files, until a
+    // deeper level is needed, unless this is the first file.
+    const bool needs_deeper_level =
+      levels ? levels->front() < wanted_level
+             : wanted_level > k_min_cache_levels || files_in_cache <= 1;
+    if (needs_deeper_level
+        && !set_wanted_cache_level(
+          level_1_dir, wanted_level, files_in_cache <= 1)) {
+      // Lookups would not find the file on a level missing in the levels file.
+      return counters;
+    }
+    const auto& new_levels = get_cache_levels(level_1_dir);
+    if (new_levels && new_levels->size() > 1) {
+      start_releveling(level_1_dir);
+    }
+
+    // Another process may have changed the levels since they were read and
+    // then moved the files away from a level that is no longer listed, so pick
+    // the level and move the file while no levels change can happen.
+    const auto levels_path = get_cache_levels_path(level_1_dir);
+    Lockfile levels_lock(levels_path);
+    if (!levels_lock.acquired()) {
+      LOG("Failed to lock {}", levels_path);
+      return counters;
+    }
+    const auto current_levels = read_cache_levels(level_1_dir);
+    m_cache_levels[level_1_dir] = current_levels;
+
     const auto wanted_path =
       Util::get_path_in_cache(m_config.cache_dir(),
-                              wanted_level,
+                              current_levels ? current_levels->front()
+                                             : k_min_cache_levels,
                               key.to_string() + suffix_from_type(type));
     if (current_path != wanted_path) {
       Util::ensure_dir_exists(Util::dir_name(wanted_path));
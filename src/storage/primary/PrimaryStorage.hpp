@@ -25,6 +25,10 @@
 
 #include <third_party/nonstd/optional.hpp>
 
+#include <string>
+#include <unordered_map>
+#include <vector>
+
 class Config;
 class Counters;
 
@@ -50,7 +54,16 @@ public:
 
   void remove(const Digest& key, core::CacheEntryType type);
 
+  // Record that the entries stored by put() took `milliseconds` to compile.
+  void set_compile_time(uint64_t milliseconds);
+
   void increment_statistic(Statistic statistic, int64_t value = 1);
+  void increment_statistics(const Counters& counter_updates);
+
+  // Add `counter_updates` to one of the statistics files right away instead of
+  // when calling finalize(). Must not be used for cache size bookkeeping
+  // counters.
+  void update_statistics(const Counters& counter_updates);
 
   // Return a machine-readable string representing the final ccache result, or
   // nullopt if there was no result.
@@ -79,6 +92,14 @@ private:
   std::string m_manifest_path;
   std::string m_result_path;
 
+  uint64_t m_compile_time = 0; // Milliseconds
+
+  // Cache levels read from the levels files of level 1 directories, keyed by
+  // directory. nullopt means that the directory has no levels file.
+  mutable std::unordered_map<std::string,
+                             nonstd::optional<std::vector<uint8_t>>>
+    m_cache_levels;
+
   struct LookUpCacheFileResult
   {
     std::string path;
@@ -89,8 +110,35 @@ private:
   LookUpCacheFileResult look_up_cache_file(const Digest& key,
                                            core::CacheEntryType type) const;
 
+  // Return the levels that may hold cache files in `level_1_dir` as recorded in
+  // its levels file, the level to store new files on first, or nullopt if there
+  // is no levels file. The file is only read once per process.
+  const nonstd::optional<std::vector<uint8_t>>&
+  get_cache_levels(const std::string& level_1_dir) const;
+
+  // Record in the levels file that new files in `level_1_dir` should be stored
+  // on `wanted_level`, unless they already are stored deeper. `dir_is_empty`
+  // means that there are no files to move. Returns false if the file could not
+  // be updated.
+  bool set_wanted_cache_level(const std::string& level_1_dir,
+                              uint8_t wanted_level,
+                              bool dir_is_empty);
+
+  // Move all files in `level_1_dir` to the wanted level in a detached process
+  // with low priority unless another such process is already running.
+  void start_releveling(const std::string& level_1_dir);
+
   void clean_up_internal_tempdir();
 
+  // Clean up `subdir` in a detached process with low priority unless another
+  // background cleanup of it is already running.
+  void start_background_cleanup(const std::string& subdir,
+                                uint64_t max_size,
+                                uint64_t max_files);
+
+  void maybe_compact_lru_index(const std::string& subdir,
+                               uint64_t files_in_cache);
+
   nonstd::optional<Counters>
   update_stats_and_maybe_move_cache_file(const Digest& key,
                                          const std::string& current_path,
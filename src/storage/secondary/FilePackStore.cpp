@@ -0,0 +1,716 @@
+// Copyright (C) 2021 Joel Rosdahl and other contributors
+//
+// See doc/AUTHORS.adoc for a complete list of contributors.
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc., 51
+// Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#include "FilePackStore.hpp"
+
+#include <Checksum.hpp>
+#include <Logging.hpp>
+#include <Util.hpp>
+#include <exceptions.hpp>
+#include <fmtmacros.hpp>
+#include <util/file_utils.hpp>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstring>
+#include <map>
+#include <set>
+#include <unordered_map>
+
+// Index file format (integers are stored in big-endian byte order):
+//
+//   <index>  ::= <header> <record>*
+//   <header> ::= <magic> <version> <reserved> <current segment>
+//   <magic>  ::= 4 bytes ("cCpI")
+//   <version> ::= uint8_t
+//   <reserved> ::= 3 bytes
+//   <current segment> ::= uint32_t
+//   <record> ::= <key> <segment> <offset> <size> <checksum>
+//   <key> ::= 20 bytes
+//   <segment> ::= uint32_t
+//   <offset> ::= uint64_t
+//   <size> ::= uint64_t ; UINT64_MAX for a removed entry
+//   <checksum> ::= uint32_t ; lower bits of XXH3 of the preceding fields
+//
+// Segment file format:
+//
+//   <segment> ::= <entry>*
+//   <entry> ::= <key> <value>
+
+namespace {
+
+// Note: Increment the version number if the index or segment format is
+// changed.
+const uint8_t k_index_magic[4] = {'c', 'C', 'p', 'I'};
+const uint8_t k_index_version = 1;
+
+const size_t k_header_size = 12;
+const size_t k_record_size = 44;
+const size_t k_record_checksum_offset = 40;
+
+const uint64_t k_removed = UINT64_MAX;
+
+// Number of index records to read at a time when looking up a key.
+const size_t k_records_per_read = 256;
+
+static_assert(Digest::size() == 20,
+              "Increment version number if size of digest is changed.");
+
+uint32_t
+record_checksum(const uint8_t* record)
+{
+  Checksum checksum;
+  checksum.update(record, k_record_checksum_offset);
+  return static_cast<uint32_t>(checksum.digest());
+}
+
+std::string
+format_header(uint32_t current_segment)
+{
+  uint8_t header[k_header_size] = {};
+  memcpy(header, k_index_magic, sizeof(k_index_magic));
+  header[4] = k_index_version;
+  Util::int_to_big_endian(current_segment, header + 8);
+  return std::string(reinterpret_cast<const char*>(header), sizeof(header));
+}
+
+void
+pread_all(int fd, void* buffer, size_t size, uint64_t offset)
+{
+  auto p = static_cast<uint8_t*>(buffer);
+  while (size > 0) {
+    const auto n = pread(fd, p, size, offset);
+    if (n == -1 && errno == EINTR) {
+      continue;
+    }
+    if (n == -1) {
+      throw Error(strerror(errno));
+    }
+    if (n == 0) {
+      throw Error("unexpected end of file");
+    }
+    p += n;
+    size -= n;
+    offset += n;
+  }
+}
+
+void
+pwrite_all(int fd, const void* buffer, size_t size, uint64_t offset)
+{
+  auto p = static_cast<const uint8_t*>(buffer);
+  while (size > 0) {
+    const auto n = pwrite(fd, p, size, offset);
+    if (n == -1 && errno == EINTR) {
+      continue;
+    }
+    if (n == -1) {
+      throw Error(strerror(errno));
+    }
+    p += n;
+    size -= n;
+    offset += n;
+  }
+}
+
+// Pass `size` bytes at `offset` in `fd` to `data_receiver` in chunks.
+void
+read_range(int fd,
+           uint64_t offset,
+           uint64_t size,
+           const Util::DataReceiver& data_receiver)
+{
+  uint8_t buffer[READ_BUFFER_SIZE];
+  while (size > 0) {
+    const auto n =
+      static_cast<size_t>(std::min<uint64_t>(size, sizeof(buffer)));
+    pread_all(fd, buffer, n, offset);
+    data_receiver(buffer, n);
+    offset += n;
+    size -= n;
+  }
+}
+
+std::string
+key_bytes(const Digest& key)
+{
+  return std::string(reinterpret_cast<const char*>(key.bytes()),
+                     Digest::size());
+}
+
+std::string
+get_partition(const Digest& key)
+{
+  return key.to_string().substr(0, 2);
+}
+
+} // namespace
+
+namespace storage {
+namespace secondary {
+
+FilePackStore::FilePackStore(std::string dir, uint64_t max_segment_size)
+  : m_dir(std::move(dir)),
+    m_max_segment_size(max_segment_size)
+{
+}
+
+nonstd::expected<nonstd::optional<std::string>, SecondaryStorage::Error>
+FilePackStore::get(const Digest& key)
+{
+  std::string value;
+  const auto result =
+    read_value(key, [&](const void* data, size_t size) {
+      value.append(static_cast<const char*>(data), size);
+    });
+  if (!result) {
+    return nonstd::make_unexpected(result.error());
+  }
+  if (!*result) {
+    return nonstd::nullopt;
+  }
+  return value;
+}
+
+nonstd::expected<bool, SecondaryStorage::Error>
+FilePackStore::get_to_file(const Digest& key, const std::string& path)
+{
+  Fd fd(open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666));
+  if (!fd) {
+    // Not the backend's fault, so don't report an error.
+    LOG("Failed to open {} for writing: {}", path, strerror(errno));
+    return false;
+  }
+
+  nonstd::optional<std::string> write_error;
+  const auto result = read_value(key, [&](const void* data, size_t size) {
+    if (write_error) {
+      return;
+    }
+    try {
+      Util::write_fd(*fd, data, size);
+    } catch (const ::Error& e) {
+      write_error = e.what();
+    }
+  });
+  if (result && *result && write_error) {
+    LOG("Failed to write {}: {}", path, *write_error);
+    return false;
+  }
+  return result;
+}
+
+nonstd::expected<bool, SecondaryStorage::Error>
+FilePackStore::put(const Digest& key,
+                   nonstd::string_view value,
+                   bool only_if_missing)
+{
+  return store(key, only_if_missing, [&](int segment_fd) {
+    Util::write_fd(segment_fd, value.data(), value.size());
+    return static_cast<uint64_t>(value.size());
+  });
+}
+
+nonstd::expected<bool, SecondaryStorage::Error>
+FilePackStore::put_from_file(const Digest& key,
+                             const std::string& path,
+                             bool only_if_missing)
+{
+  Fd fd(open(path.c_str(), O_RDONLY));
+  if (!fd) {
+    // Not the backend's fault, so don't report an error.
+    LOG("Failed to open {}: {}", path, strerror(errno));
+    return false;
+  }
+
+  bool read_failed = false;
+  const auto result = store(key, only_if_missing, [&](int segment_fd) {
+    uint64_t size = 0;
+    if (!Util::read_fd(*fd, [&](const void* data, size_t n) {
+          Util::write_fd(segment_fd, data, n);
+          size += n;
+        })) {
+      read_failed = true;
+      throw Error("failed to read {}: {}", path, strerror(errno));
+    }
+    return size;
+  });
+  if (!result && read_failed) {
+    // The partially written entry is just garbage in the segment.
+    return false;
+  }
+  return result;
+}
+
+nonstd::expected<bool, SecondaryStorage::Error>
+FilePackStore::remove(const Digest& key)
+{
+  const auto partition = get_partition(key);
+  try {
+    const auto index_fd = open_and_lock_index(partition);
+    auto index = read_index(*index_fd, get_index_path(partition));
+    if (!index) {
+      return nonstd::make_unexpected(SecondaryStorage::Error::error);
+    }
+    if (!find_record(*index, key)) {
+      return false;
+    }
+    append_record(
+      *index_fd, *index, {key, index->current_segment, 0, k_removed});
+    LOG("Removed {} from {}", key.to_string(), m_dir);
+    return true;
+  } catch (const ::Error& e) {
+    LOG("Failed to remove {} from {}: {}", key.to_string(), m_dir, e.what());
+    return nonstd::make_unexpected(SecondaryStorage::Error::error);
+  }
+}
+
+nonstd::expected<bool, SecondaryStorage::Error>
+FilePackStore::read_value(const Digest& key,
+                          const Util::DataReceiver& data_receiver)
+{
+  const auto partition = get_partition(key);
+  const auto index_path = get_index_path(partition);
+  Fd index_fd(open(index_path.c_str(), O_RDONLY));
+  if (!index_fd) {
+    if (errno == ENOENT) {
+      return false;
+    }
+    LOG("Failed to open {}: {}", index_path, strerror(errno));
+    return nonstd::make_unexpected(SecondaryStorage::Error::error);
+  }
+  nonstd::optional<IndexRecord> record;
+  try {
+    record = look_up_record(*index_fd, key);
+  } catch (const ::Error& e) {
+    LOG("Failed to read {}: {}", index_path, e.what());
+    return nonstd::make_unexpected(SecondaryStorage::Error::error);
+  }
+  index_fd.close();
+  if (!record) {
+    return false;
+  }
+
+  const auto segment_path = get_segment_path(partition, record->segment);
+  Fd segment_fd(open(segment_path.c_str(), O_RDONLY));
+  if (!segment_fd) {
+    // The segment may have been removed by a concurrent compaction.
+    LOG("Failed to open {}: {}", segment_path, strerror(errno));
+    return false;
+  }
+
+  try {
+    uint8_t stored_key[Digest::size()];
+    pread_all(*segment_fd, stored_key, sizeof(stored_key), record->offset);
+    if (memcmp(stored_key, key.bytes(), Digest::size()) != 0) {
+      LOG("Unexpected key at offset {} in {}", record->offset, segment_path);
+      return false;
+    }
+    read_range(*segment_fd,
+               record->offset + Digest::size(),
+               record->size,
+               data_receiver);
+  } catch (const ::Error& e) {
+    LOG("Failed to read {} from {}: {}",
+        key.to_string(),
+        segment_path,
+        e.what());
+    return nonstd::make_unexpected(SecondaryStorage::Error::error);
+  }
+
+  LOG("Read {} from {}", key.to_string(), segment_path);
+  return true;
+}
+
+nonstd::expected<bool, SecondaryStorage::Error>
+FilePackStore::store(const Digest& key,
+                     bool only_if_missing,
+                     const ValueWriter& write_value)
+{
+  const auto partition = get_partition(key);
+  try {
+    const auto index_fd = open_and_lock_index(partition);
+    auto index = read_index(*index_fd, get_index_path(partition));
+    if (!index) {
+      return nonstd::make_unexpected(SecondaryStorage::Error::error);
+    }
+    if (only_if_missing && find_record(*index, key)) {
+      LOG("{} already in {}", key.to_string(), m_dir);
+      return false;
+    }
+    append_entry(*index_fd, partition, *index, key, write_value);
+    return true;
+  } catch (const ::Error& e) {
+    LOG("Failed to store {} in {}: {}", key.to_string(), m_dir, e.what());
+    return nonstd::make_unexpected(SecondaryStorage::Error::error);
+  }
+}
+
+std::string
+FilePackStore::get_index_path(const std::string& partition) const
+{
+  return FMT("{}/pack/{}.idx", m_dir, partition);
+}
+
+std::string
+FilePackStore::get_segment_path(const std::string& partition,
+                                uint32_t segment) const
+{
+  return FMT("{}/pack/{}-{}.pack", m_dir, partition, segment);
+}
+
+Fd
+FilePackStore::open_and_lock_index(const std::string& partition) const
+{
+  const auto path = get_index_path(partition);
+  Fd fd(open(path.c_str(), O_RDWR | O_CREAT, 0666));
+  if (!fd && errno == ENOENT) {
+    const auto dir = Util::dir_name(path);
+    if (!Util::create_dir(dir)) {
+      throw Error("failed to create directory {}: {}", dir, strerror(errno));
+    }
+    util::create_cachedir_tag(m_dir);
+    fd = Fd(open(path.c_str(), O_RDWR | O_CREAT, 0666));
+  }
+  if (!fd) {
+    throw Error("failed to open {}: {}", path, strerror(errno));
+  }
+
+  struct flock lock;
+  memset(&lock, 0, sizeof(lock));
+  lock.l_type = F_WRLCK;
+  lock.l_whence = SEEK_SET;
+  while (fcntl(*fd, F_SETLKW, &lock) != 0) {
+    if (errno != EINTR) {
+      throw Error("failed to lock {}: {}", path, strerror(errno));
+    }
+  }
+  return fd;
+}
+
+nonstd::optional<FilePackStore::Index>
+FilePackStore::read_index(int fd, const std::string& path)
+{
+  std::string data;
+  if (!Util::read_fd(fd, [&](const void* buffer, size_t size) {
+        data.append(static_cast<const char*>(buffer), size);
+      })) {
+    LOG("Failed to read {}: {}", path, strerror(errno));
+    return nonstd::nullopt;
+  }
+
+  Index index;
+  if (data.size() < k_header_size) {
+    // New index (or one whose header write was interrupted).
+    return index;
+  }
+
+  const auto bytes = reinterpret_cast<const uint8_t*>(data.data());
+  if (memcmp(bytes, k_index_magic, sizeof(k_index_magic)) != 0
+      || bytes[4] != k_index_version) {
+    LOG("Unknown index format in {}", path);
+    return nonstd::nullopt;
+  }
+  Util::big_endian_to_int(bytes + 8, index.current_segment);
+
+  const size_t record_count = (data.size() - k_header_size) / k_record_size;
+  index.records.reserve(record_count);
+  for (size_t i = 0; i < record_count; ++i) {
+    const auto record = parse_record(bytes + k_header_size + i * k_record_size);
+    if (record) {
+      index.records.push_back(*record);
+    }
+  }
+  index.end = k_header_size + record_count * k_record_size;
+
+  return index;
+}
+
+nonstd::optional<FilePackStore::IndexRecord>
+FilePackStore::look_up_record(int fd, const Digest& key)
+{
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    throw Error(strerror(errno));
+  }
+  if (static_cast<uint64_t>(st.st_size) < k_header_size) {
+    return nonstd::nullopt;
+  }
+
+  uint8_t header[k_header_size];
+  pread_all(fd, header, sizeof(header), 0);
+  if (memcmp(header, k_index_magic, sizeof(k_index_magic)) != 0
+      || header[4] != k_index_version) {
+    throw Error("unknown index format");
+  }
+
+  // Scan backwards a chunk at a time since the last record for a key is the
+  // valid one.
+  uint8_t buffer[k_records_per_read * k_record_size];
+  uint64_t end = (st.st_size - k_header_size) / k_record_size;
+  while (end > 0) {
+    const uint64_t begin =
+      end > k_records_per_read ? end - k_records_per_read : 0;
+    const auto count = static_cast<size_t>(end - begin);
+    pread_all(fd,
+              buffer,
+              count * k_record_size,
+              k_header_size + begin * k_record_size);
+    for (size_t i = count; i-- > 0;) {
+      const uint8_t* p = buffer + i * k_record_size;
+      if (memcmp(p, key.bytes(), Digest::size()) != 0) {
+        continue;
+      }
+      const auto record = parse_record(p);
+      if (!record) {
+        continue;
+      }
+      if (record->size == k_removed) {
+        return nonstd::nullopt;
+      }
+      return record;
+    }
+    end = begin;
+  }
+  return nonstd::nullopt;
+}
+
+nonstd::optional<FilePackStore::IndexRecord>
+FilePackStore::parse_record(const uint8_t* data)
+{
+  uint32_t checksum;
+  Util::big_endian_to_int(data + k_record_checksum_offset, checksum);
+  if (checksum != record_checksum(data)) {
+    // Partially written record.
+    return nonstd::nullopt;
+  }
+  IndexRecord record;
+  memcpy(record.key.bytes(), data, Digest::size());
+  Util::big_endian_to_int(data + 20, record.segment);
+  Util::big_endian_to_int(data + 24, record.offset);
+  Util::big_endian_to_int(data + 32, record.size);
+  return record;
+}
+
+std::string
+FilePackStore::format_record(const IndexRecord& record)
+{
+  uint8_t buffer[k_record_size];
+  memcpy(buffer, record.key.bytes(), Digest::size());
+  Util::int_to_big_endian(record.segment, buffer + 20);
+  Util::int_to_big_endian(record.offset, buffer + 24);
+  Util::int_to_big_endian(record.size, buffer + 32);
+  Util::int_to_big_endian(record_checksum(buffer),
+                          buffer + k_record_checksum_offset);
+  return std::string(reinterpret_cast<const char*>(buffer), sizeof(buffer));
+}
+
+nonstd::optional<FilePackStore::IndexRecord>
+FilePackStore::find_record(const Index& index, const Digest& key)
+{
+  for (auto it = index.records.rbegin(); it != index.records.rend(); ++it) {
+    if (it->key == key) {
+      if (it->size == k_removed) {
+        return nonstd::nullopt;
+      }
+      return *it;
+    }
+  }
+  return nonstd::nullopt;
+}
+
+void
+FilePackStore::append_record(int index_fd, Index& index, IndexRecord record)
+{
+  if (index.end == 0) {
+    const auto header = format_header(index.current_segment);
+    pwrite_all(index_fd, header.data(), header.size(), 0);
+    index.end = k_header_size;
+  }
+
+  const auto data = format_record(record);
+  pwrite_all(index_fd, data.data(), data.size(), index.end);
+
+  index.end += k_record_size;
+  index.records.push_back(record);
+}
+
+void
+FilePackStore::append_entry(int index_fd,
+                            const std::string& partition,
+                            Index& index,
+                            const Digest& key,
+                            const ValueWriter& write_value) const
+{
+  const auto segment_path = get_segment_path(partition, index.current_segment);
+  Fd segment_fd(
+    open(segment_path.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0666));
+  if (!segment_fd) {
+    throw Error("failed to open {}: {}", segment_path, strerror(errno));
+  }
+  const auto offset = lseek(*segment_fd, 0, SEEK_END);
+  if (offset == -1) {
+    throw Error("failed to seek in {}: {}", segment_path, strerror(errno));
+  }
+  Util::write_fd(*segment_fd, key.bytes(), Digest::size());
+  const auto size = write_value(*segment_fd);
+  segment_fd.close();
+
+  // The record must be written after the entry so that readers never find a
+  // record for an incomplete entry.
+  append_record(index_fd,
+                index,
+                {key,
+                 index.current_segment,
+                 static_cast<uint64_t>(offset),
+                 size});
+  LOG("Appended {} to {}", key.to_string(), segment_path);
+
+  if (offset + Digest::size() + size < m_max_segment_size) {
+    return;
+  }
+
+  ++index.current_segment;
+  const auto header = format_header(index.current_segment);
+  pwrite_all(index_fd, header.data(), header.size(), 0);
+  LOG("Started segment {} of partition {} in {}",
+      index.current_segment,
+      partition,
+      m_dir);
+
+  // Compact when more than half of the stored data is garbage.
+  std::unordered_map<std::string, uint64_t> live_sizes;
+  uint64_t total_size = 0;
+  for (const auto& record : index.records) {
+    if (record.size == k_removed) {
+      live_sizes.erase(key_bytes(record.key));
+    } else {
+      live_sizes[key_bytes(record.key)] = record.size;
+      total_size += record.size;
+    }
+  }
+  uint64_t live_size = 0;
+  for (const auto& entry : live_sizes) {
+    live_size += entry.second;
+  }
+  if (total_size - live_size > live_size) {
+    compact(index_fd, partition, index);
+  }
+}
+
+void
+FilePackStore::compact(int index_fd,
+                       const std::string& partition,
+                       Index& index) const
+{
+  LOG("Compacting partition {} in {}", partition, m_dir);
+
+  std::unordered_map<std::string, size_t> latest;
+  std::set<uint32_t> old_segments;
+  for (size_t i = 0; i < index.records.size(); ++i) {
+    const auto& record = index.records[i];
+    latest[key_bytes(record.key)] = i;
+    if (record.size != k_removed) {
+      old_segments.insert(record.segment);
+    }
+  }
+
+  // Copy live entries to the current (just started) segment. If this is
+  // interrupted, the copied data is just garbage at the start of the segment.
+  Index new_index;
+  new_index.current_segment = index.current_segment;
+  const auto target_path =
+    get_segment_path(partition, new_index.current_segment);
+  Fd target_fd(open(target_path.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0666));
+  if (!target_fd) {
+    throw Error("failed to open {}: {}", target_path, strerror(errno));
+  }
+  auto target_offset = lseek(*target_fd, 0, SEEK_END);
+  if (target_offset == -1) {
+    throw Error("failed to seek in {}: {}", target_path, strerror(errno));
+  }
+
+  std::map<uint32_t, Fd> source_fds;
+  for (size_t i = 0; i < index.records.size(); ++i) {
+    const auto& record = index.records[i];
+    if (record.size == k_removed || latest[key_bytes(record.key)] != i) {
+      continue;
+    }
+
+    auto& source_fd = source_fds[record.segment];
+    if (!source_fd) {
+      const auto path = get_segment_path(partition, record.segment);
+      source_fd = Fd(open(path.c_str(), O_RDONLY));
+      if (!source_fd) {
+        LOG("Failed to open {}: {}", path, strerror(errno));
+        continue;
+      }
+    }
+    const uint64_t entry_size = Digest::size() + record.size;
+    read_range(*source_fd,
+               record.offset,
+               entry_size,
+               [&](const void* data, size_t size) {
+                 Util::write_fd(*target_fd, data, size);
+               });
+
+    new_index.records.push_back({record.key,
+                                 new_index.current_segment,
+                                 static_cast<uint64_t>(target_offset),
+                                 record.size});
+    target_offset += entry_size;
+  }
+  target_fd.close();
+  source_fds.clear();
+
+  if (static_cast<uint64_t>(target_offset) >= m_max_segment_size) {
+    ++new_index.current_segment;
+  }
+
+  // Rewrite the index in place so that the lock stays valid. Records in the
+  // old tail left by an interrupted rewrite still refer to existing segments
+  // since those are removed afterwards.
+  std::string data = format_header(new_index.current_segment);
+  for (const auto& record : new_index.records) {
+    data += format_record(record);
+  }
+  pwrite_all(index_fd, data.data(), data.size(), 0);
+  if (ftruncate(index_fd, data.size()) != 0) {
+    throw Error("failed to truncate index: {}", strerror(errno));
+  }
+  new_index.end = data.size();
+
+  for (const auto segment : old_segments) {
+    if (segment != index.current_segment) {
+      Util::unlink_safe(get_segment_path(partition, segment));
+    }
+  }
+
+  LOG("Compacted partition {} in {} from {} to {} records",
+      partition,
+      m_dir,
+      index.records.size(),
+      new_index.records.size());
+  index = std::move(new_index);
+}
+
+} // namespace secondary
+} // namespace storage
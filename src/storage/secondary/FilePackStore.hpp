@@ -0,0 +1,132 @@
+// Copyright (C) 2021 Joel Rosdahl and other contributors
+//
+// See doc/AUTHORS.adoc for a complete list of contributors.
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc., 51
+// Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#pragma once
+
+#include <Digest.hpp>
+#include <Fd.hpp>
+#include <Util.hpp>
+#include <storage/SecondaryStorage.hpp>
+
+#include <third_party/nonstd/expected.hpp>
+#include <third_party/nonstd/optional.hpp>
+#include <third_party/nonstd/string_view.hpp>
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace storage {
+namespace secondary {
+
+// Stores the entries of a file storage backend in append-only pack files
+// instead of one file per entry, which makes a store an append to two existing
+// files and a lookup a backward scan of the index plus reading the entry data.
+// This matters on network file systems where metadata operations are the
+// bottleneck.
+//
+// Entries are spread over 256 partitions by key. Each partition consists of an
+// index file and a number of segment files in the "pack" subdirectory:
+//
+//   XX.idx     header followed by records mapping keys to segment locations
+//   XX-N.pack  segment N, a sequence of key + value pairs
+//
+// Writers serialize on an fcntl(2) lock on the index file while readers don't
+// lock at all. Since such locks are owned by the process, an instance must not
+// be written to by several threads at once. Index records are appended after
+// the value has been written and are checksummed, so a reader never sees a
+// record for incomplete data. When the current segment is full, a new one is
+// started and, if most of the stored data is garbage (overwritten or removed
+// entries), the partition is compacted.
+class FilePackStore
+{
+public:
+  FilePackStore(std::string dir, uint64_t max_segment_size);
+
+  nonstd::expected<nonstd::optional<std::string>, SecondaryStorage::Error>
+  get(const Digest& key);
+
+  // Like get/put but copy the value between the pack and `path` in chunks
+  // instead of holding it in memory.
+  nonstd::expected<bool, SecondaryStorage::Error>
+  get_to_file(const Digest& key, const std::string& path);
+
+  nonstd::expected<bool, SecondaryStorage::Error>
+  put(const Digest& key, nonstd::string_view value, bool only_if_missing);
+
+  nonstd::expected<bool, SecondaryStorage::Error> put_from_file(
+    const Digest& key, const std::string& path, bool only_if_missing);
+
+  nonstd::expected<bool, SecondaryStorage::Error> remove(const Digest& key);
+
+private:
+  // Writes a value to the segment file descriptor and returns its size.
+  using ValueWriter = std::function<uint64_t(int segment_fd)>;
+
+  struct IndexRecord
+  {
+    Digest key;
+    uint32_t segment;
+    uint64_t offset; // Offset of the entry (key + value) in the segment.
+    uint64_t size;   // Size of the value.
+  };
+
+  struct Index
+  {
+    uint32_t current_segment = 0;
+    std::vector<IndexRecord> records; // In append order.
+    uint64_t end = 0; // Where to write the next record, 0 if no header yet.
+  };
+
+  const std::string m_dir;
+  const uint64_t m_max_segment_size;
+
+  std::string get_index_path(const std::string& partition) const;
+  std::string get_segment_path(const std::string& partition,
+                               uint32_t segment) const;
+
+  nonstd::expected<bool, SecondaryStorage::Error>
+  read_value(const Digest& key, const Util::DataReceiver& data_receiver);
+  nonstd::expected<bool, SecondaryStorage::Error>
+  store(const Digest& key,
+        bool only_if_missing,
+        const ValueWriter& write_value);
+
+  Fd open_and_lock_index(const std::string& partition) const;
+  static nonstd::optional<Index> read_index(int fd, const std::string& path);
+  // Find the live record for `key` without reading the whole index. Throws
+  // Error on read failure.
+  static nonstd::optional<IndexRecord> look_up_record(int fd,
+                                                      const Digest& key);
+  static nonstd::optional<IndexRecord> parse_record(const uint8_t* data);
+  static std::string format_record(const IndexRecord& record);
+  static nonstd::optional<IndexRecord> find_record(const Index& index,
+                                                   const Digest& key);
+  static void append_record(int index_fd, Index& index, IndexRecord record);
+  void append_entry(int index_fd,
+                    const std::string& partition,
+                    Index& index,
+                    const Digest& key,
+                    const ValueWriter& write_value) const;
+  void
+  compact(int index_fd, const std::string& partition, Index& index) const;
+};
+
+} // namespace secondary
+} // namespace storage
@@ -21,6 +21,7 @@
 #include <AtomicFile.hpp>
 #include <Digest.hpp>
 #include <Logging.hpp>
+#include <ThreadPool.hpp>
 #include <UmaskScope.hpp>
 #include <Util.hpp>
 #include <assertions.hpp>
@@ -30,9 +31,19 @@
 
 #include <third_party/nonstd/string_view.hpp>
 
+#include <algorithm>
+#include <atomic>
+#include <thread>
+
 namespace storage {
 namespace secondary {
 
+// Length of the string representation of a key, i.e. of an entry path relative
+// to the storage directory without slashes.
+static const size_t k_key_string_length = Digest().to_string().length();
+
+static const uint64_t k_default_pack_size = 64 * 1024 * 1024;
+
 static std::string
 parse_url(const std::string& url)
 {
@@ -70,16 +81,78 @@ parse_update_mtime(const AttributeMap& attributes)
   return it != attributes.end() && it->second == "true";
 }
 
+static uint32_t
+parse_layout_attribute(const AttributeMap& attributes,
+                       const std::string& name,
+                       uint32_t default_value,
+                       uint32_t max_value)
+{
+  const auto it = attributes.find(name);
+  if (it == attributes.end()) {
+    return default_value;
+  }
+  return Util::parse_unsigned(
+    it->second, name == "levels" ? 0 : 1, max_value, FMT("{} attribute", name));
+}
+
+static bool
+parse_pack(const AttributeMap& attributes)
+{
+  const auto it = attributes.find("pack");
+  const bool pack = it != attributes.end() && it->second == "true";
+#ifdef _WIN32
+  if (pack) {
+    throw Error("the pack attribute is not supported on Windows");
+  }
+#endif
+  return pack;
+}
+
+#ifndef _WIN32
+static std::unique_ptr<FilePackStore>
+create_pack_store(const std::string& dir, const AttributeMap& attributes)
+{
+  if (!parse_pack(attributes)) {
+    return {};
+  }
+  const auto it = attributes.find("pack-size");
+  const uint64_t max_segment_size = it != attributes.end()
+                                      ? Util::parse_size(it->second)
+                                      : k_default_pack_size;
+  return std::make_unique<FilePackStore>(dir, max_segment_size);
+}
+#endif
+
 FileStorage::FileStorage(const std::string& url, const AttributeMap& attributes)
   : m_dir(parse_url(url)),
     m_umask(parse_umask(attributes)),
-    m_update_mtime(parse_update_mtime(attributes))
+    m_update_mtime(parse_update_mtime(attributes)),
+    m_levels(parse_layout_attribute(attributes, "levels", 1, 4)),
+    m_level_width(parse_layout_attribute(attributes, "level-width", 2, 4))
+#ifndef _WIN32
+    ,
+    m_pack_store(create_pack_store(m_dir, attributes))
+#endif
 {
+#ifdef _WIN32
+  parse_pack(attributes);
+#else
+  if (m_pack_store && m_update_mtime) {
+    // Entries in pack files have no modification times of their own.
+    throw ::Error("the update-mtime attribute can't be combined with pack");
+  }
+#endif
 }
 
 nonstd::expected<nonstd::optional<std::string>, SecondaryStorage::Error>
 FileStorage::get(const Digest& key)
 {
+#ifndef _WIN32
+  if (m_pack_store) {
+    return m_pack_store->get(key);
+  }
+#endif
+
   const auto path = get_entry_path(key);
   const bool exists = Stat::stat(path);
 
@@ -108,6 +181,13 @@ FileStorage::put(const Digest& key,
                  const std::string& value,
                  bool only_if_missing)
 {
+#ifndef _WIN32
+  if (m_pack_store) {
+    UmaskScope umask_scope(m_umask);
+    return m_pack_store->put(key, value, only_if_missing);
+  }
+#endif
+
   const auto path = get_entry_path(key);
 
   if (only_if_missing && Stat::stat(path)) {
@@ -118,11 +198,7 @@ FileStorage::put(const Digest& key,
   {
     UmaskScope umask_scope(m_umask);
 
-    util::create_cachedir_tag(m_dir);
-
-    const auto dir = Util::dir_name(path);
-    if (!Util::create_dir(dir)) {
-      LOG("Failed to create directory {}: {}", dir, strerror(errno));
+    if (!prepare_entry_dir(path)) {
       return nonstd::make_unexpected(Error::error);
     }
 
@@ -142,15 +218,211 @@ FileStorage::put(const Digest& key,
 nonstd::expected<bool, SecondaryStorage::Error>
 FileStorage::remove(const Digest& key)
 {
+#ifndef _WIN32
+  if (m_pack_store) {
+    return m_pack_store->remove(key);
+  }
+#endif
+
   return Util::unlink_safe(get_entry_path(key));
 }
 
+nonstd::expected<bool, SecondaryStorage::Error>
+FileStorage::get_to_file(const Digest& key, const std::string& path)
+{
+#ifndef _WIN32
+  if (m_pack_store) {
+    return m_pack_store->get_to_file(key, path);
+  }
+#endif
+
+  const auto entry_path = get_entry_path(key);
+  const bool exists = Stat::stat(entry_path);
+
+  if (!exists) {
+    // Don't log failure if the entry doesn't exist.
+    return false;
+  }
+
+  if (m_update_mtime) {
+    // Update modification timestamp for potential LRU cleanup by some external
+    // mechanism.
+    Util::update_mtime(entry_path);
+  }
+
+  if (cancellation_requested()) {
+    return nonstd::make_unexpected(Error::error);
+  }
+
+  // Don't hard link the entry: `path` may end up in the primary cache, which
+  // would then share the inode (e.g. its permissions and mtime) with the
+  // secondary storage.
+  try {
+    Util::clone_file(entry_path, path);
+    LOG("Cloned {} to {}", entry_path, path);
+    return true;
+  } catch (const ::Error&) {
+    // Fall back to copying.
+  }
+
+  try {
+    LOG("Copying {} to {}", entry_path, path);
+    Util::copy_file(entry_path, path);
+    return true;
+  } catch (const ::Error& e) {
+    LOG("Failed to copy {} to {}: {}", entry_path, path, e.what());
+    return nonstd::make_unexpected(Error::error);
+  }
+}
+
+nonstd::expected<bool, SecondaryStorage::Error>
+FileStorage::put_from_file(const Digest& key,
+                           const std::string& path,
+                           bool only_if_missing)
+{
+#ifndef _WIN32
+  if (m_pack_store) {
+    UmaskScope umask_scope(m_umask);
+    return m_pack_store->put_from_file(key, path, only_if_missing);
+  }
+#endif
+
+  const auto entry_path = get_entry_path(key);
+
+  if (only_if_missing && Stat::stat(entry_path)) {
+    LOG("{} already in cache", entry_path);
+    return false;
+  }
+
+  UmaskScope umask_scope(m_umask);
+
+  if (!prepare_entry_dir(entry_path)) {
+    return nonstd::make_unexpected(Error::error);
+  }
+
+  // Always create a new file (instead of hard linking) so that the configured
+  // umask is respected and so that the entry can't be affected by later
+  // changes to `path`.
+  try {
+    Util::clone_file(path, entry_path, true);
+    LOG("Cloned {} to {}", path, entry_path);
+    return true;
+  } catch (const ::Error&) {
+    // Fall back to copying.
+  }
+
+  try {
+    LOG("Copying {} to {}", path, entry_path);
+    Util::copy_file(path, entry_path, true);
+    return true;
+  } catch (const ::Error& e) {
+    LOG("Failed to copy {} to {}: {}", path, entry_path, e.what());
+    return nonstd::make_unexpected(Error::error);
+  }
+}
+
+uint64_t
+FileStorage::reshard(const Util::ProgressReceiver& progress_receiver)
+{
+#ifndef _WIN32
+  if (m_pack_store) {
+    LOG("Not resharding {} since it uses pack files", m_dir);
+    progress_receiver(1.0);
+    return 0;
+  }
+#endif
+
+  std::vector<std::string> paths;
+  Util::traverse(m_dir, [&](const std::string& path, bool is_dir) {
+    if (!is_dir) {
+      paths.push_back(path);
+    }
+  });
+  progress_receiver(0.1);
+
+  UmaskScope umask_scope(m_umask);
+  std::atomic<uint64_t> moved_entries(0);
+
+  const size_t threads = std::max(1u, std::thread::hardware_concurrency());
+  ThreadPool thread_pool(threads, 2 * threads);
+  for (size_t i = 0; i < paths.size(); ++i) {
+    const auto& path = paths[i];
+    std::string key_string = path.substr(m_dir.length() + 1);
+    key_string.erase(std::remove(key_string.begin(), key_string.end(), '/'),
+                     key_string.end());
+    if (key_string.length() != k_key_string_length
+        || !std::all_of(key_string.begin(), key_string.end(), [](char c) {
+             return (c >= '0' && c <= '9') || (c >= 'a' && c <= 'v');
+           })) {
+      // Not an entry, e.g. CACHEDIR.TAG or a temporary file.
+      continue;
+    }
+    auto entry_path = FMT("{}/{}", m_dir, get_entry_subpath(key_string));
+    if (entry_path == path) {
+      continue;
+    }
+
+    // Creating directories and renaming files is slow on network file
+    // systems, so do it in parallel.
+    thread_pool.enqueue([this, &moved_entries, path, entry_path] {
+      if (!prepare_entry_dir(entry_path)) {
+        return;
+      }
+      try {
+        Util::rename(path, entry_path);
+        ++moved_entries;
+      } catch (const ::Error& e) {
+        LOG("Failed to move {} to {}: {}", path, entry_path, e.what());
+      }
+    });
+
+    progress_receiver(0.1 + 0.8 * i / paths.size());
+  }
+  thread_pool.shut_down();
+
+  // Remove directories left empty. This is done after all entries have been
+  // moved so that a directory isn't removed right before an entry is moved
+  // into it. rmdir fails for directories that are not empty.
+  Util::traverse(m_dir, [&](const std::string& path, bool is_dir) {
+    if (is_dir && path != m_dir) {
+      rmdir(path.c_str());
+    }
+  });
+  progress_receiver(1.0);
+
+  LOG("Moved {} entries in {}", moved_entries.load(), m_dir);
+  return moved_entries.load();
+}
+
 std::string
 FileStorage::get_entry_path(const Digest& key) const
 {
-  const auto key_string = key.to_string();
-  const uint8_t digits = 2;
-  return FMT("{}/{:.{}}/{}", m_dir, key_string, digits, &key_string[digits]);
+  return FMT("{}/{}", m_dir, get_entry_subpath(key.to_string()));
+}
+
+std::string
+FileStorage::get_entry_subpath(const std::string& key_string) const
+{
+  std::string subpath;
+  for (uint32_t i = 0; i < m_levels; ++i) {
+    subpath.append(key_string, i * m_level_width, m_level_width);
+    subpath += '/';
+  }
+  subpath.append(key_string, m_levels * m_level_width, std::string::npos);
+  return subpath;
+}
+
+bool
+FileStorage::prepare_entry_dir(const std::string& path) const
+{
+  util::create_cachedir_tag(m_dir);
+
+  const auto dir = Util::dir_name(path);
+  if (!Util::create_dir(dir)) {
+    LOG("Failed to create directory {}: {}", dir, strerror(errno));
+    return false;
+  }
+  return true;
 }
 
 } // namespace secondary
@@ -18,8 +18,14 @@
 
 #pragma once
 
+#include <Util.hpp>
 #include <storage/SecondaryStorage.hpp>
 #include <storage/types.hpp>
+#ifndef _WIN32
+#  include <storage/secondary/FilePackStore.hpp>
+#endif
+
+#include <memory>
 
 namespace storage {
 namespace secondary {
@@ -35,13 +41,31 @@ public:
                                     const std::string& value,
                                     bool only_if_missing) override;
   nonstd::expected<bool, Error> remove(const Digest& key) override;
+  nonstd::expected<bool, Error> get_to_file(const Digest& key,
+                                            const std::string& path) override;
+  nonstd::expected<bool, Error> put_from_file(const Digest& key,
+                                              const std::string& path,
+                                              bool only_if_missing) override;
+
+  // Move entries stored with a different directory layout (e.g. before the
+  // levels or level-width attributes were changed) to where they belong with
+  // the current layout and remove directories that become empty. Returns the
+  // number of moved entries.
+  uint64_t reshard(const Util::ProgressReceiver& progress_receiver);
 
 private:
   const std::string m_dir;
   const nonstd::optional<mode_t> m_umask;
   const bool m_update_mtime;
+  const uint32_t m_levels;
+  const uint32_t m_level_width;
+#ifndef _WIN32
+  const std::unique_ptr<FilePackStore> m_pack_store;
+#endif
 
   std::string get_entry_path(const Digest& key) const;
+  std::string get_entry_subpath(const std::string& key_string) const;
+  bool prepare_entry_dir(const std::string& path) const;
 };
 
 } // namespace secondary
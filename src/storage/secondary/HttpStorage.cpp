@@ -0,0 +1,1011 @@
+// Copyright (C) 2021 Joel Rosdahl and other contributors
+//
+// See doc/AUTHORS.adoc for a complete list of contributors.
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc., 51
+// Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#include "HttpStorage.hpp"
+
+#include <Digest.hpp>
+#include <Logging.hpp>
+#include <Stat.hpp>
+#include <Util.hpp>
+#include <assertions.hpp>
+#include <exceptions.hpp>
+#include <fmtmacros.hpp>
+
+#include <third_party/nonstd/string_view.hpp>
+
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+namespace storage {
+namespace secondary {
+
+namespace {
+
+// Maximum time to wait in poll(2) before checking for cancellation.
+const std::chrono::milliseconds k_poll_interval(50);
+
+const size_t k_max_line_length = 8192;
+const size_t k_read_buffer_size = 64 * 1024;
+
+const uint64_t k_default_connect_timeout = 100;    // ms
+const uint64_t k_default_operation_timeout = 10000; // ms
+
+// Status of a request that was not (completely) sent since its body could not
+// be read. That is not the server's fault, so only the request fails.
+const int k_local_error_status = -1;
+
+#ifdef MSG_NOSIGNAL
+const int k_send_flags = MSG_NOSIGNAL;
+#else
+const int k_send_flags = 0;
+#endif
+
+struct Url
+{
+  std::string host;
+  std::string port;
+  std::string path;
+};
+
+Url
+parse_url(const std::string& url)
+{
+  const nonstd::string_view prefix = "http://";
+  ASSERT(Util::starts_with(url, prefix));
+  const auto rest = nonstd::string_view(url).substr(prefix.size());
+
+  const auto slash_pos = rest.find('/');
+  const auto authority = rest.substr(0, slash_pos);
+  auto path = slash_pos == nonstd::string_view::npos
+                ? std::string()
+                : std::string(rest.substr(slash_pos));
+  while (!path.empty() && path.back() == '/') {
+    path.pop_back();
+  }
+
+  if (authority.find('@') != nonstd::string_view::npos) {
+    throw Error("invalid HTTP URL \"{}\" - credentials are not supported",
+                url);
+  }
+
+  Url result;
+  nonstd::string_view port;
+  if (Util::starts_with(authority, "[")) {
+    // IPv6 address, e.g. [::1]:8080.
+    const auto end_pos = authority.find(']');
+    if (end_pos == nonstd::string_view::npos) {
+      throw Error("invalid HTTP URL \"{}\" - missing ']'", url);
+    }
+    result.host = std::string(authority.substr(1, end_pos - 1));
+    const auto after = authority.substr(end_pos + 1);
+    if (!after.empty()) {
+      if (after[0] != ':') {
+        throw Error("invalid HTTP URL \"{}\" - malformed host", url);
+      }
+      port = after.substr(1);
+    }
+  } else {
+    const auto colon_pos = authority.find(':');
+    result.host = std::string(authority.substr(0, colon_pos));
+    if (colon_pos != nonstd::string_view::npos) {
+      port = authority.substr(colon_pos + 1);
+    }
+  }
+
+  if (result.host.empty()) {
+    throw Error("invalid HTTP URL \"{}\" - missing host", url);
+  }
+  result.port = port.empty()
+                  ? "80"
+                  : FMT("{}",
+                        Util::parse_unsigned(
+                          std::string(port), 1, 65535, "HTTP URL port"));
+  result.path = path;
+  return result;
+}
+
+std::chrono::milliseconds
+parse_timeout(const AttributeMap& attributes,
+              const std::string& name,
+              uint64_t default_value)
+{
+  const auto it = attributes.find(name);
+  if (it == attributes.end()) {
+    return std::chrono::milliseconds(default_value);
+  }
+  return std::chrono::milliseconds(
+    Util::parse_unsigned(it->second, 1, nonstd::nullopt, name + " attribute"));
+}
+
+bool
+parse_keep_alive(const AttributeMap& attributes)
+{
+  const auto it = attributes.find("keep-alive");
+  return it == attributes.end() || it->second != "false";
+}
+
+bool
+is_successful(int status)
+{
+  return status >= 200 && status < 300;
+}
+
+SecondaryStorage::Error
+to_error(int status)
+{
+  // HTTP 408 (Request Timeout) and 504 (Gateway Timeout) both mean that the
+  // server or a proxy gave up waiting.
+  return status == 408 || status == 504 ? SecondaryStorage::Error::timeout
+                                        : SecondaryStorage::Error::error;
+}
+
+bool
+is_would_block(int error)
+{
+  // EAGAIN and EWOULDBLOCK may or may not have the same value.
+#if EWOULDBLOCK != EAGAIN
+  return error == EAGAIN || error == EWOULDBLOCK;
+#else
+  return error == EAGAIN;
+#endif
+}
+
+} // namespace
+
+HttpStorage::HttpStorage(const std::string& url, const AttributeMap& attributes)
+  : m_url(url),
+    m_connect_timeout(parse_timeout(
+      attributes, "connect-timeout", k_default_connect_timeout)),
+    m_operation_timeout(parse_timeout(
+      attributes, "operation-timeout", k_default_operation_timeout)),
+    m_keep_alive(parse_keep_alive(attributes))
+{
+  auto parsed_url = parse_url(url);
+  m_host = std::move(parsed_url.host);
+  m_port = std::move(parsed_url.port);
+  m_path = std::move(parsed_url.path);
+}
+
+nonstd::expected<nonstd::optional<std::string>, SecondaryStorage::Error>
+HttpStorage::get(const Digest& key)
+{
+  std::string value;
+  Request request;
+  request.method = "GET";
+  request.key = key;
+  request.body_receiver = [&](const char* data, size_t size) {
+    value.append(data, size);
+  };
+
+  const auto statuses = execute({request});
+  if (!statuses) {
+    return nonstd::make_unexpected(statuses.error());
+  }
+  const int status = (*statuses)[0];
+  if (is_successful(status)) {
+    return value;
+  } else if (status == 404) {
+    return nonstd::nullopt;
+  } else {
+    LOG("Unexpected HTTP status {} when getting {}", status, key.to_string());
+    return nonstd::make_unexpected(to_error(status));
+  }
+}
+
+nonstd::expected<bool, SecondaryStorage::Error>
+HttpStorage::put(const Digest& key,
+                 const std::string& value,
+                 bool only_if_missing)
+{
+  std::vector<Request> requests(1);
+  requests[0].method = "PUT";
+  requests[0].key = key;
+  requests[0].body = value;
+  const auto stored = put_many(std::move(requests), only_if_missing);
+  if (!stored) {
+    return nonstd::make_unexpected(stored.error());
+  }
+  return (*stored)[0];
+}
+
+nonstd::expected<bool, SecondaryStorage::Error>
+HttpStorage::remove(const Digest& key)
+{
+  Request request;
+  request.method = "DELETE";
+  request.key = key;
+
+  const auto statuses = execute({request});
+  if (!statuses) {
+    return nonstd::make_unexpected(statuses.error());
+  }
+  const int status = (*statuses)[0];
+  if (is_successful(status)) {
+    return true;
+  } else if (status == 404) {
+    return false;
+  } else {
+    LOG("Unexpected HTTP status {} when removing {}", status, key.to_string());
+    return nonstd::make_unexpected(to_error(status));
+  }
+}
+
+nonstd::expected<bool, SecondaryStorage::Error>
+HttpStorage::get_to_file(const Digest& key, const std::string& path)
+{
+  const auto found = get_many_to_files({{key, path}});
+  if (!found) {
+    return nonstd::make_unexpected(found.error());
+  }
+  return (*found)[0];
+}
+
+nonstd::expected<bool, SecondaryStorage::Error>
+HttpStorage::put_from_file(const Digest& key,
+                           const std::string& path,
+                           bool only_if_missing)
+{
+  const auto stored = put_many_from_files({{key, path}}, only_if_missing);
+  if (!stored) {
+    return nonstd::make_unexpected(stored.error());
+  }
+  return (*stored)[0];
+}
+
+nonstd::expected<std::vector<bool>, SecondaryStorage::Error>
+HttpStorage::get_many_to_files(const std::vector<KeyAndPath>& entries)
+{
+  // Failing to write a local file is not the server's fault, so it only makes
+  // that entry fail.
+  std::vector<bool> found(entries.size(), false);
+  std::vector<bool> write_failed(entries.size(), false);
+  std::vector<Fd> fds;
+  std::vector<size_t> indices;
+  std::vector<Request> requests;
+  for (size_t i = 0; i < entries.size(); ++i) {
+    const auto& path = entries[i].second;
+    Fd fd(open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666));
+    if (!fd) {
+      LOG("Failed to open {} for writing: {}", path, strerror(errno));
+      continue;
+    }
+    const int raw_fd = *fd;
+    fds.push_back(std::move(fd));
+
+    Request request;
+    request.method = "GET";
+    request.key = entries[i].first;
+    request.body_receiver = [&write_failed, &path, i, raw_fd](const char* data,
+                                                              size_t size) {
+      if (write_failed[i]) {
+        return;
+      }
+      try {
+        Util::write_fd(raw_fd, data, size);
+      } catch (const ::Error& e) {
+        LOG("Failed to write {}: {}", path, e.what());
+        write_failed[i] = true;
+      }
+    };
+    request.body_reset = [&write_failed, &path, i, raw_fd] {
+      if (ftruncate(raw_fd, 0) != 0 || lseek(raw_fd, 0, SEEK_SET) != 0) {
+        LOG("Failed to truncate {}: {}", path, strerror(errno));
+        write_failed[i] = true;
+      }
+    };
+    requests.push_back(std::move(request));
+    indices.push_back(i);
+  }
+  if (requests.empty()) {
+    return found;
+  }
+
+  const auto statuses = execute(requests);
+  if (!statuses) {
+    return nonstd::make_unexpected(statuses.error());
+  }
+
+  nonstd::optional<Error> error;
+  bool any_completed = false;
+  for (size_t j = 0; j < requests.size(); ++j) {
+    const size_t i = indices[j];
+    const int status = (*statuses)[j];
+    if (!is_successful(status) && status != 404) {
+      // Other entries may still have been retrieved, so just report this one
+      // as failed.
+      LOG("Unexpected HTTP status {} when getting {}",
+          status,
+          entries[i].first.to_string());
+      error = to_error(status);
+      continue;
+    }
+    any_completed = true;
+    found[i] = is_successful(status) && !write_failed[i];
+  }
+  if (error && !any_completed) {
+    return nonstd::make_unexpected(*error);
+  }
+  return found;
+}
+
+nonstd::expected<std::vector<bool>, SecondaryStorage::Error>
+HttpStorage::put_many_from_files(const std::vector<KeyAndPath>& entries,
+                                 bool only_if_missing)
+{
+  std::vector<bool> stored(entries.size(), false);
+  std::vector<size_t> indices;
+  std::vector<Request> requests;
+  for (size_t i = 0; i < entries.size(); ++i) {
+    // Leave out unreadable files here since failing to read one while sending
+    // would be taken as an error from the server.
+    if (!Stat::stat(entries[i].second, Stat::OnError::log)) {
+      continue;
+    }
+    Request request;
+    request.method = "PUT";
+    request.key = entries[i].first;
+    request.body_path = entries[i].second;
+    requests.push_back(std::move(request));
+    indices.push_back(i);
+  }
+  if (requests.empty()) {
+    return stored;
+  }
+
+  const auto requests_stored = put_many(std::move(requests), only_if_missing);
+  if (!requests_stored) {
+    return nonstd::make_unexpected(requests_stored.error());
+  }
+  for (size_t i = 0; i < indices.size(); ++i) {
+    stored[indices[i]] = (*requests_stored)[i];
+  }
+  return stored;
+}
+
+nonstd::expected<std::vector<bool>, SecondaryStorage::Error>
+HttpStorage::put_many(std::vector<Request>&& requests, bool only_if_missing)
+{
+  std::vector<bool> stored(requests.size(), false);
+  std::vector<size_t> indices_to_put;
+  nonstd::optional<Error> error;
+  bool any_completed = false;
+
+  if (only_if_missing) {
+    std::vector<Request> head_requests(requests.size());
+    for (size_t i = 0; i < requests.size(); ++i) {
+      head_requests[i].method = "HEAD";
+      head_requests[i].key = requests[i].key;
+    }
+    const auto statuses = execute(head_requests);
+    if (!statuses) {
+      return nonstd::make_unexpected(statuses.error());
+    }
+    for (size_t i = 0; i < requests.size(); ++i) {
+      const int status = (*statuses)[i];
+      if (is_successful(status)) {
+        LOG("{} already in {}", requests[i].key.to_string(), m_url);
+        any_completed = true;
+      } else if (status == 404) {
+        indices_to_put.push_back(i);
+      } else {
+        LOG("Unexpected HTTP status {} when checking {}",
+            status,
+            requests[i].key.to_string());
+        error = to_error(status);
+      }
+    }
+  } else {
+    for (size_t i = 0; i < requests.size(); ++i) {
+      indices_to_put.push_back(i);
+    }
+  }
+
+  if (indices_to_put.empty()) {
+    if (error && !any_completed) {
+      return nonstd::make_unexpected(*error);
+    }
+    return stored;
+  }
+
+  std::vector<Request> put_requests;
+  for (const auto i : indices_to_put) {
+    put_requests.push_back(std::move(requests[i]));
+  }
+  const auto statuses = execute(put_requests);
+  if (!statuses) {
+    return nonstd::make_unexpected(statuses.error());
+  }
+  for (size_t i = 0; i < put_requests.size(); ++i) {
+    const int status = (*statuses)[i];
+    if (status == k_local_error_status) {
+      // Already logged by send_request.
+      continue;
+    }
+    if (!is_successful(status)) {
+      // Other entries may still be stored, so just report this one as failed.
+      LOG("Unexpected HTTP status {} when putting {}",
+          status,
+          put_requests[i].key.to_string());
+      error = to_error(status);
+      continue;
+    }
+    any_completed = true;
+    stored[indices_to_put[i]] = true;
+  }
+  if (error && !any_completed) {
+    return nonstd::make_unexpected(*error);
+  }
+  return stored;
+}
+
+nonstd::expected<std::vector<int>, SecondaryStorage::Error>
+HttpStorage::execute(const std::vector<Request>& requests)
+{
+  const auto deadline =
+    std::min(Clock::now() + m_operation_timeout,
+             operation_deadline().value_or(Clock::time_point::max()));
+  std::vector<int> statuses;
+  bool retried = false;
+
+  while (statuses.size() < requests.size()) {
+    const bool reused = bool(m_socket);
+    if (!reused) {
+      const auto status = connect();
+      if (status != IoStatus::ok) {
+        return nonstd::make_unexpected(
+          status == IoStatus::timeout ? Error::timeout : Error::error);
+      }
+    }
+
+    // Send all remaining requests before reading any response. While sending,
+    // responses to earlier requests are buffered so that the server never
+    // blocks on us.
+    const size_t first = statuses.size();
+    size_t end = first;
+    IoStatus io_status = IoStatus::ok;
+    bool close_connection = !m_keep_alive;
+    bool response_interrupted = false;
+    try {
+      while (end < requests.size()) {
+        io_status = send_request(requests[end], deadline);
+        if (io_status != IoStatus::ok) {
+          break;
+        }
+        ++end;
+      }
+      const bool body_failed = io_status == IoStatus::local_error;
+      if (io_status != IoStatus::timeout && !cancellation_requested()) {
+        // Read responses to requests sent completely, even if sending a later
+        // request failed since the server may have closed the connection after
+        // a response.
+        for (size_t i = first; i < end; ++i) {
+          int status = 0;
+          bool close = false;
+          const auto read_status =
+            read_response(requests[i], status, close, deadline);
+          if (read_status != IoStatus::ok) {
+            io_status = read_status;
+            response_interrupted = m_response_started;
+            break;
+          }
+          statuses.push_back(status);
+          if (close) {
+            close_connection = true;
+            break;
+          }
+        }
+      }
+      if (body_failed && statuses.size() == end) {
+        // The request may have been partly sent, so the connection can't be
+        // reused, but the remaining requests can be sent on a new one.
+        statuses.push_back(k_local_error_status);
+        close_connection = true;
+      }
+    } catch (const ::Error& e) {
+      LOG("Failed to communicate with {}: {}", m_url, e.what());
+      disconnect();
+      return nonstd::make_unexpected(Error::error);
+    }
+
+    if (statuses.size() == requests.size()) {
+      if (close_connection) {
+        disconnect();
+      }
+      break;
+    }
+    disconnect();
+
+    if (io_status == IoStatus::timeout) {
+      LOG("Timeout while communicating with {}", m_url);
+      return nonstd::make_unexpected(Error::timeout);
+    }
+    if (cancellation_requested()) {
+      return nonstd::make_unexpected(Error::error);
+    }
+    if (statuses.size() > first) {
+      // Progress was made, so just continue with remaining requests (if any)
+      // on a new connection. The receiver of an interrupted response may
+      // already have got part of the body, so it has to start over.
+      const auto& interrupted = requests[statuses.size()];
+      if (response_interrupted && interrupted.body_receiver) {
+        if (!interrupted.body_reset) {
+          LOG("Response from {} was interrupted", m_url);
+          return nonstd::make_unexpected(Error::error);
+        }
+        try {
+          interrupted.body_reset();
+        } catch (const ::Error& e) {
+          LOG("Failed to retry request to {}: {}", m_url, e.what());
+          return nonstd::make_unexpected(Error::error);
+        }
+      }
+      continue;
+    }
+    if (reused && !retried && !m_response_started) {
+      // The server has probably closed the idle connection, so try again on a
+      // new one.
+      LOG("Connection to {} was closed, reconnecting", m_url);
+      retried = true;
+      continue;
+    }
+    LOG("Failed to communicate with {}: {}",
+        m_url,
+        io_status == IoStatus::closed ? "connection closed" : strerror(errno));
+    return nonstd::make_unexpected(Error::error);
+  }
+
+  return statuses;
+}
+
+HttpStorage::IoStatus
+HttpStorage::connect()
+{
+  addrinfo hints;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  addrinfo* addresses = nullptr;
+  const int result =
+    getaddrinfo(m_host.c_str(), m_port.c_str(), &hints, &addresses);
+  if (result != 0) {
+    LOG("Failed to resolve {}: {}", m_host, gai_strerror(result));
+    return IoStatus::error;
+  }
+
+  const auto deadline =
+    std::min(Clock::now() + m_connect_timeout,
+             operation_deadline().value_or(Clock::time_point::max()));
+  IoStatus status = IoStatus::error;
+  for (auto address = addresses; address; address = address->ai_next) {
+    m_socket = Fd(
+      socket(address->ai_family, address->ai_socktype, address->ai_protocol));
+    if (!m_socket) {
+      continue;
+    }
+    fcntl(*m_socket, F_SETFD, FD_CLOEXEC);
+    fcntl(*m_socket, F_SETFL, fcntl(*m_socket, F_GETFL) | O_NONBLOCK);
+    int one = 1;
+#ifdef SO_NOSIGPIPE
+    setsockopt(*m_socket, SOL_SOCKET, SO_NOSIGPIPE, &one, sizeof(one));
+#endif
+
+    if (::connect(*m_socket, address->ai_addr, address->ai_addrlen) == 0) {
+      status = IoStatus::ok;
+    } else if (errno == EINPROGRESS) {
+      status = wait_for(POLLOUT, deadline);
+      int error = 0;
+      socklen_t length = sizeof(error);
+      if (status == IoStatus::ok
+          && (getsockopt(*m_socket, SOL_SOCKET, SO_ERROR, &error, &length) != 0
+              || error != 0)) {
+        errno = error;
+        status = IoStatus::error;
+      }
+    } else {
+      status = IoStatus::error;
+    }
+
+    if (status == IoStatus::ok) {
+      setsockopt(*m_socket, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+      break;
+    }
+    const int saved_errno = errno;
+    disconnect();
+    errno = saved_errno;
+    if (status == IoStatus::timeout) {
+      break;
+    }
+  }
+  freeaddrinfo(addresses);
+
+  if (status == IoStatus::timeout) {
+    LOG("Timeout while connecting to {}:{}", m_host, m_port);
+  } else if (status != IoStatus::ok) {
+    LOG("Failed to connect to {}:{}: {}", m_host, m_port, strerror(errno));
+  }
+  return status;
+}
+
+void
+HttpStorage::disconnect()
+{
+  m_socket.close();
+  m_buffer.clear();
+}
+
+HttpStorage::IoStatus
+HttpStorage::send_request(const Request& request, Clock::time_point deadline)
+{
+  const bool ipv6_host = m_host.find(':') != std::string::npos;
+  std::string header =
+    FMT("{} {}/{} HTTP/1.1\r\nHost: {}{}{}{}\r\n",
+        request.method,
+        m_path,
+        request.key.to_string(),
+        ipv6_host ? "[" : "",
+        m_host,
+        ipv6_host ? "]" : "",
+        m_port == "80" ? "" : ":" + m_port);
+
+  Fd body_fd;
+  uint64_t body_size = 0;
+  if (request.method == "PUT") {
+    if (request.body_path.empty()) {
+      body_size = request.body.size();
+    } else {
+      body_fd = Fd(open(request.body_path.c_str(), O_RDONLY | O_BINARY));
+      struct stat st;
+      if (!body_fd || fstat(*body_fd, &st) != 0) {
+        LOG("Failed to open {}: {}", request.body_path, strerror(errno));
+        return IoStatus::local_error;
+      }
+      body_size = st.st_size;
+    }
+    header += FMT(
+      "Content-Type: application/octet-stream\r\nContent-Length: {}\r\n",
+      body_size);
+  }
+  if (!m_keep_alive) {
+    header += "Connection: close\r\n";
+  }
+  header += "\r\n";
+
+  auto status = send_data(header.data(), header.size(), deadline);
+  if (status != IoStatus::ok || body_size == 0) {
+    return status;
+  }
+  if (!body_fd) {
+    return send_data(request.body.data(), request.body.size(), deadline);
+  }
+
+  char buffer[k_read_buffer_size];
+  uint64_t sent = 0;
+  while (sent < body_size) {
+    const auto n = read(*body_fd, buffer, sizeof(buffer));
+    if (n == -1 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      LOG("Failed to read {}: {}",
+          request.body_path,
+          n == 0 ? "file truncated" : strerror(errno));
+      return IoStatus::local_error;
+    }
+    const auto to_send = std::min<uint64_t>(n, body_size - sent);
+    status = send_data(buffer, to_send, deadline);
+    if (status != IoStatus::ok) {
+      return status;
+    }
+    sent += to_send;
+  }
+  return IoStatus::ok;
+}
+
+HttpStorage::IoStatus
+HttpStorage::read_response(const Request& request,
+                           int& status,
+                           bool& close_connection,
+                           Clock::time_point deadline)
+{
+  m_response_started = false;
+
+  bool http_1_0 = false;
+  nonstd::optional<uint64_t> content_length;
+  bool chunked = false;
+  std::string connection;
+
+  // Skip interim (1xx) responses.
+  do {
+    std::string line;
+    auto io_status = read_line(line, deadline);
+    if (io_status != IoStatus::ok) {
+      return io_status;
+    }
+    m_response_started = true;
+
+    // Status line, e.g. "HTTP/1.1 200 OK".
+    if (!Util::starts_with(line, "HTTP/1.") || line.size() < 12
+        || line[8] != ' ') {
+      throw ::Error("malformed HTTP status line: {}", line);
+    }
+    http_1_0 = line[7] == '0';
+    status = static_cast<int>(Util::parse_unsigned(
+      line.substr(9, 3), 100, 999, "HTTP status code"));
+
+    content_length = nonstd::nullopt;
+    chunked = false;
+    connection.clear();
+    while (true) {
+      io_status = read_line(line, deadline);
+      if (io_status != IoStatus::ok) {
+        return io_status;
+      }
+      if (line.empty()) {
+        break;
+      }
+      const auto colon_pos = line.find(':');
+      if (colon_pos == std::string::npos) {
+        throw ::Error("malformed HTTP header: {}", line);
+      }
+      const auto name = Util::to_lowercase(line.substr(0, colon_pos));
+      const auto value = Util::strip_whitespace(line.substr(colon_pos + 1));
+      if (name == "content-length") {
+        content_length =
+          Util::parse_unsigned(value, nonstd::nullopt, nonstd::nullopt, name);
+      } else if (name == "transfer-encoding") {
+        chunked =
+          Util::to_lowercase(value).find("chunked") != std::string::npos;
+      } else if (name == "connection") {
+        connection = Util::to_lowercase(value);
+      }
+    }
+  } while (status < 200);
+
+  close_connection = http_1_0
+                       ? connection.find("keep-alive") == std::string::npos
+                       : connection.find("close") != std::string::npos;
+
+  const BodyReceiver& receiver = is_successful(status) && request.body_receiver
+                                   ? request.body_receiver
+                                   : BodyReceiver();
+  if (request.method == "HEAD" || status == 204 || status == 304) {
+    return IoStatus::ok;
+  } else if (chunked) {
+    return read_chunked_body(receiver, deadline);
+  } else if (content_length) {
+    return read_body(*content_length, receiver, deadline);
+  } else {
+    close_connection = true;
+    return read_body_until_close(receiver, deadline);
+  }
+}
+
+HttpStorage::IoStatus
+HttpStorage::wait_for(short events, Clock::time_point deadline, short* revents)
+{
+  while (true) {
+    if (cancellation_requested()) {
+      return IoStatus::error;
+    }
+    const auto now = Clock::now();
+    if (now >= deadline) {
+      return IoStatus::timeout;
+    }
+    const auto timeout = std::min(
+      std::chrono::duration_cast<std::chrono::milliseconds>(deadline - now),
+      k_poll_interval);
+
+    pollfd pfd;
+    pfd.fd = *m_socket;
+    pfd.events = events;
+    pfd.revents = 0;
+    const int result = poll(&pfd, 1, static_cast<int>(timeout.count()));
+    if (result > 0) {
+      if (revents) {
+        *revents = pfd.revents;
+      }
+      return IoStatus::ok;
+    } else if (result < 0 && errno != EINTR) {
+      return IoStatus::error;
+    }
+  }
+}
+
+HttpStorage::IoStatus
+HttpStorage::send_data(const char* data,
+                       size_t size,
+                       Clock::time_point deadline)
+{
+  while (size > 0) {
+    const auto sent = send(*m_socket, data, size, k_send_flags);
+    if (sent >= 0) {
+      data += sent;
+      size -= sent;
+      continue;
+    }
+    if (errno == EINTR) {
+      continue;
+    } else if (errno == EPIPE || errno == ECONNRESET) {
+      return IoStatus::closed;
+    } else if (!is_would_block(errno)) {
+      return IoStatus::error;
+    }
+
+    short revents = 0;
+    const auto status = wait_for(POLLIN | POLLOUT, deadline, &revents);
+    if (status != IoStatus::ok) {
+      return status;
+    }
+    if (revents & POLLIN) {
+      const auto receive_status = receive_more(deadline, false);
+      if (receive_status != IoStatus::ok) {
+        return receive_status;
+      }
+    }
+  }
+  return IoStatus::ok;
+}
+
+HttpStorage::IoStatus
+HttpStorage::receive_more(Clock::time_point deadline, bool wait)
+{
+  const auto old_size = m_buffer.size();
+  m_buffer.resize(old_size + k_read_buffer_size);
+  while (true) {
+    const auto received =
+      recv(*m_socket, &m_buffer[old_size], k_read_buffer_size, 0);
+    if (received > 0) {
+      m_buffer.resize(old_size + received);
+      return IoStatus::ok;
+    }
+    if (received == -1 && errno == EINTR) {
+      continue;
+    }
+    if (received == -1 && is_would_block(errno)) {
+      if (!wait) {
+        m_buffer.resize(old_size);
+        return IoStatus::ok;
+      }
+      const auto status = wait_for(POLLIN, deadline);
+      if (status == IoStatus::ok) {
+        continue;
+      }
+      m_buffer.resize(old_size);
+      return status;
+    }
+    m_buffer.resize(old_size);
+    return received == 0 || errno == ECONNRESET ? IoStatus::closed
+                                                : IoStatus::error;
+  }
+}
+
+HttpStorage::IoStatus
+HttpStorage::read_line(std::string& line, Clock::time_point deadline)
+{
+  size_t searched = 0;
+  while (true) {
+    const auto end_pos = m_buffer.find('\n', searched);
+    if (end_pos != std::string::npos) {
+      const auto length =
+        end_pos > 0 && m_buffer[end_pos - 1] == '\r' ? end_pos - 1 : end_pos;
+      line = m_buffer.substr(0, length);
+      m_buffer.erase(0, end_pos + 1);
+      return IoStatus::ok;
+    }
+    if (m_buffer.size() > k_max_line_length) {
+      throw ::Error("too long line in HTTP response");
+    }
+    searched = m_buffer.size();
+    const auto status = receive_more(deadline);
+    if (status != IoStatus::ok) {
+      return status;
+    }
+  }
+}
+
+HttpStorage::IoStatus
+HttpStorage::read_body(uint64_t size,
+                       const BodyReceiver& receiver,
+                       Clock::time_point deadline)
+{
+  while (size > 0) {
+    if (m_buffer.empty()) {
+      const auto status = receive_more(deadline);
+      if (status != IoStatus::ok) {
+        return status;
+      }
+    }
+    const auto n =
+      static_cast<size_t>(std::min<uint64_t>(size, m_buffer.size()));
+    if (receiver) {
+      receiver(m_buffer.data(), n);
+    }
+    m_buffer.erase(0, n);
+    size -= n;
+  }
+  return IoStatus::ok;
+}
+
+HttpStorage::IoStatus
+HttpStorage::read_chunked_body(const BodyReceiver& receiver,
+                               Clock::time_point deadline)
+{
+  std::string line;
+  while (true) {
+    auto status = read_line(line, deadline);
+    if (status != IoStatus::ok) {
+      return status;
+    }
+    // Ignore chunk extensions.
+    const auto chunk_size = Util::parse_unsigned(
+      Util::strip_whitespace(line.substr(0, line.find(';'))),
+      nonstd::nullopt,
+      nonstd::nullopt,
+      "HTTP chunk size",
+      16);
+    if (chunk_size == 0) {
+      break;
+    }
+    status = read_body(chunk_size, receiver, deadline);
+    if (status == IoStatus::ok) {
+      status = read_line(line, deadline);
+    }
+    if (status != IoStatus::ok) {
+      return status;
+    }
+  }
+
+  // Skip trailer fields.
+  do {
+    const auto status = read_line(line, deadline);
+    if (status != IoStatus::ok) {
+      return status;
+    }
+  } while (!line.empty());
+  return IoStatus::ok;
+}
+
+HttpStorage::IoStatus
+HttpStorage::read_body_until_close(const BodyReceiver& receiver,
+                                   Clock::time_point deadline)
+{
+  while (true) {
+    if (receiver && !m_buffer.empty()) {
+      receiver(m_buffer.data(), m_buffer.size());
+    }
+    m_buffer.clear();
+    const auto status = receive_more(deadline);
+    if (status != IoStatus::ok) {
+      return status == IoStatus::closed ? IoStatus::ok : status;
+    }
+  }
+}
+
+} // namespace secondary
+} // namespace storage
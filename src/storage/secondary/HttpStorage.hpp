@@ -0,0 +1,130 @@
+// Copyright (C) 2021 Joel Rosdahl and other contributors
+//
+// See doc/AUTHORS.adoc for a complete list of contributors.
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc., 51
+// Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#pragma once
+
+#include <Fd.hpp>
+#include <storage/SecondaryStorage.hpp>
+#include <storage/types.hpp>
+
+#include <chrono>
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace storage {
+namespace secondary {
+
+// Backend storing entries on an HTTP server using GET, HEAD, PUT and DELETE
+// requests. The connection to the server is kept alive between operations and
+// the requests of batch operations are pipelined.
+class HttpStorage : public storage::SecondaryStorage
+{
+public:
+  HttpStorage(const std::string& url, const AttributeMap& attributes);
+
+  nonstd::expected<nonstd::optional<std::string>, Error>
+  get(const Digest& key) override;
+  nonstd::expected<bool, Error> put(const Digest& key,
+                                    const std::string& value,
+                                    bool only_if_missing) override;
+  nonstd::expected<bool, Error> remove(const Digest& key) override;
+  nonstd::expected<bool, Error> get_to_file(const Digest& key,
+                                            const std::string& path) override;
+  nonstd::expected<bool, Error> put_from_file(const Digest& key,
+                                              const std::string& path,
+                                              bool only_if_missing) override;
+  nonstd::expected<std::vector<bool>, Error>
+  get_many_to_files(const std::vector<KeyAndPath>& entries) override;
+  nonstd::expected<std::vector<bool>, Error>
+  put_many_from_files(const std::vector<KeyAndPath>& entries,
+                      bool only_if_missing) override;
+
+private:
+  using Clock = std::chrono::steady_clock;
+  using BodyReceiver = std::function<void(const char* data, size_t size)>;
+
+  struct Request
+  {
+    std::string method;
+    Digest key;
+    // Request body, either `body` or the content of the file `body_path`.
+    std::string body;
+    std::string body_path;
+    // Receiver of the response body for successful (2xx) responses. The body
+    // is discarded if not set.
+    BodyReceiver body_receiver;
+    // Called before the request is sent again after part of the response body
+    // has been passed to `body_receiver`, which must then start over. Requests
+    // with a receiver but without this are not retried in that case.
+    std::function<void()> body_reset;
+  };
+
+  // `local_error` means that the body of a request could not be read.
+  enum class IoStatus { ok, timeout, error, closed, local_error };
+
+  std::string m_url;
+  std::string m_host;
+  std::string m_port;
+  std::string m_path;
+  std::chrono::milliseconds m_connect_timeout;
+  std::chrono::milliseconds m_operation_timeout;
+  bool m_keep_alive;
+
+  // The current connection and data received on it but not yet consumed.
+  Fd m_socket;
+  std::string m_buffer;
+  // Whether the status line of the response currently being read has been
+  // received, in which case the request must not be retried.
+  bool m_response_started = false;
+
+  // Send `requests` (pipelined) and return the HTTP status code of each
+  // response, or k_local_error_status for a request whose body could not be
+  // read.
+  nonstd::expected<std::vector<int>, Error>
+  execute(const std::vector<Request>& requests);
+
+  // Execute the PUT requests in `requests`, preceded by HEAD requests if
+  // `only_if_missing` is true. Returns whether each entry was stored.
+  nonstd::expected<std::vector<bool>, Error>
+  put_many(std::vector<Request>&& requests, bool only_if_missing);
+
+  IoStatus connect();
+  void disconnect();
+  IoStatus send_request(const Request& request, Clock::time_point deadline);
+  IoStatus read_response(const Request& request,
+                         int& status,
+                         bool& close_connection,
+                         Clock::time_point deadline);
+
+  IoStatus
+  wait_for(short events, Clock::time_point deadline, short* revents = nullptr);
+  IoStatus send_data(const char* data, size_t size, Clock::time_point deadline);
+  IoStatus receive_more(Clock::time_point deadline, bool wait = true);
+  IoStatus read_line(std::string& line, Clock::time_point deadline);
+  IoStatus read_body(uint64_t size,
+                     const BodyReceiver& receiver,
+                     Clock::time_point deadline);
+  IoStatus read_chunked_body(const BodyReceiver& receiver,
+                             Clock::time_point deadline);
+  IoStatus read_body_until_close(const BodyReceiver& receiver,
+                                 Clock::time_point deadline);
+};
+
+} // namespace secondary
+} // namespace storage
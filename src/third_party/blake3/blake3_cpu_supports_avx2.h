@@ -10,6 +10,8 @@ extern "C" {
 #endif
 
 bool blake3_cpu_supports_avx2();
+bool blake3_cpu_supports_sse2();
+bool blake3_cpu_supports_avx512bw();
 
 #ifdef __cplusplus
 }
@@ -8,3 +8,23 @@ bool blake3_cpu_supports_avx2()
 {
   return get_cpu_features() & AVX2;
 }
+
+bool blake3_cpu_supports_sse2()
+{
+  return get_cpu_features() & SSE2;
+}
+
+bool blake3_cpu_supports_avx512bw()
+{
+#if defined(IS_X86)
+  // AVX512F is only set if the OS saves the AVX-512 state.
+  if (!(get_cpu_features() & AVX512F)) {
+    return false;
+  }
+  uint32_t regs[4] = {0};
+  cpuidex(regs, 7, 0);
+  return regs[1] & (1UL << 30);
+#else
+  return false;
+#endif
+}
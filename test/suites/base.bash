@@ -611,6 +611,79 @@ fi
     expect_stat 'cache miss' 3
     expect_stat 'error hashing extra file' 1
 
+    # -------------------------------------------------------------------------
+    TEST "CCACHE_COMMONHASHCACHE"
+
+    echo "a" >a
+    export CCACHE_EXTRAFILES=a
+    export CCACHE_COMMONHASHCACHE=1
+
+    $CCACHE_COMPILE -c test1.c
+    expect_stat 'cache hit (preprocessed)' 0
+    expect_stat 'cache miss' 1
+    expect_file_count 1 '*' $CCACHE_DIR/common-hash
+
+    $CCACHE_COMPILE -c test1.c
+    expect_stat 'cache hit (preprocessed)' 1
+    expect_stat 'cache miss' 1
+
+    # The cached state must equal the one computed without the cache.
+    (unset CCACHE_COMMONHASHCACHE; $CCACHE_COMPILE -c test1.c)
+    expect_stat 'cache hit (preprocessed)' 2
+    expect_stat 'cache miss' 1
+
+    echo "a2" >a
+    $CCACHE_COMPILE -c test1.c
+    expect_stat 'cache hit (preprocessed)' 2
+    expect_stat 'cache miss' 2
+    expect_file_count 2 '*' $CCACHE_DIR/common-hash
+
+    # Old states are removed.
+    backdate $CCACHE_DIR/common-hash/* $CCACHE_DIR
+    $CCACHE_COMPILE -c test1.c
+    expect_stat 'cache hit (preprocessed)' 3
+    expect_stat 'cache miss' 2
+    expect_file_count 1 '*' $CCACHE_DIR/common-hash
+
+    $CCACHE -C >/dev/null
+    expect_missing $CCACHE_DIR/common-hash
+
+    # -------------------------------------------------------------------------
+    TEST "CCACHE_COMMONHASHCACHE with compiler check command"
+
+    cat >compiler.sh <<EOF
+#!/bin/sh
+CCACHE_DISABLE=1 # If $COMPILER happens to be a ccache symlink...
+export CCACHE_DISABLE
+exec $COMPILER "\$@"
+EOF
+    chmod +x compiler.sh
+    cat <<EOF >check.sh
+#!/bin/sh
+printf x >>check_count
+echo compiler version 1
+EOF
+    chmod +x check.sh
+    export CCACHE_COMPILERCHECK=./check.sh
+    export CCACHE_COMMONHASHCACHE=1
+
+    $CCACHE ./compiler.sh -c test1.c
+    expect_stat 'cache hit (preprocessed)' 0
+    expect_stat 'cache miss' 1
+    expect_content check_count x
+
+    # The check command isn't run for an unchanged compiler.
+    $CCACHE ./compiler.sh -c test1.c
+    expect_stat 'cache hit (preprocessed)' 1
+    expect_stat 'cache miss' 1
+    expect_content check_count x
+
+    echo "# Compiler rebuild" >>compiler.sh
+    $CCACHE ./compiler.sh -c test1.c
+    expect_stat 'cache hit (preprocessed)' 2
+    expect_stat 'cache miss' 1
+    expect_content check_count xx
+
     # -------------------------------------------------------------------------
     TEST "CCACHE_PREFIX"
 
@@ -995,6 +1068,84 @@ EOF
     expect_stat 'cache hit (preprocessed)' 2
     expect_stat 'cache miss' 2
 
+    # -------------------------------------------------------------------------
+    TEST "CCACHE_COMPILERCHECKCACHE"
+
+    cat >compiler.sh <<EOF
+#!/bin/sh
+CCACHE_DISABLE=1 # If $COMPILER happens to be a ccache symlink...
+export CCACHE_DISABLE
+exec $COMPILER "\$@"
+EOF
+    chmod +x compiler.sh
+    cat <<EOF >check.sh
+#!/bin/sh
+printf x >>check_count
+echo compiler version 1
+EOF
+    chmod +x check.sh
+    export CCACHE_COMPILERCHECK=./check.sh
+    export CCACHE_COMPILERCHECKCACHE=1
+
+    $CCACHE ./compiler.sh -c test1.c
+    expect_stat 'cache hit (preprocessed)' 0
+    expect_stat 'cache miss' 1
+    expect_content check_count x
+
+    $CCACHE ./compiler.sh -c test1.c
+    expect_stat 'cache hit (preprocessed)' 1
+    expect_stat 'cache miss' 1
+    expect_content check_count x
+
+    # The compiler changed but its identity didn't.
+    echo "# Compiler rebuild" >>compiler.sh
+    $CCACHE ./compiler.sh -c test1.c
+    expect_stat 'cache hit (preprocessed)' 2
+    expect_stat 'cache miss' 1
+    expect_content check_count xx
+    expect_file_count 2 '*' $CCACHE_DIR/compiler-identity
+
+    # Old identities are removed.
+    backdate $CCACHE_DIR/compiler-identity/* $CCACHE_DIR
+    $CCACHE ./compiler.sh -c test1.c
+    expect_stat 'cache hit (preprocessed)' 3
+    expect_stat 'cache miss' 1
+    expect_content check_count xxx
+    expect_file_count 1 '*' $CCACHE_DIR/compiler-identity
+
+    unset CCACHE_COMPILERCHECKCACHE
+    $CCACHE ./compiler.sh -c test1.c
+    expect_stat 'cache hit (preprocessed)' 3
+    expect_stat 'cache miss' 2
+    expect_content check_count xxxx
+
+    $CCACHE -C >/dev/null
+    expect_missing $CCACHE_DIR/compiler-identity
+
+    # -------------------------------------------------------------------------
+    TEST "CCACHE_COMPILERCHECKCACHE with debug"
+
+    unset CCACHE_NODIRECT
+    cat <<EOF >check.sh
+#!/bin/sh
+printf x >>check_count
+echo compiler version 1
+EOF
+    chmod +x check.sh
+    export CCACHE_COMPILERCHECK=./check.sh
+    export CCACHE_COMPILERCHECKCACHE=1
+
+    $CCACHE_COMPILE -c test1.c
+    expect_stat 'cache hit (direct)' 0
+    expect_stat 'cache miss' 1
+    expect_content check_count x
+
+    # Debug mode doesn't use the stored identity but gives the same key.
+    CCACHE_DEBUG=1 $CCACHE_COMPILE -c test1.c
+    expect_stat 'cache hit (direct)' 1
+    expect_stat 'cache miss' 1
+    expect_content check_count xx
+
     # -------------------------------------------------------------------------
     TEST "CCACHE_COMPILERCHECK=unknown_command"
 
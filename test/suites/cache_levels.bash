@@ -34,6 +34,9 @@ SUITE_cache_levels() {
     expect_stat 'files in cache' 2
     expect_on_level R 2
     expect_on_level M 2
+    for levels_file in $(find $CCACHE_DIR -name levels); do
+        expect_content $levels_file 2
+    done
 
     $CCACHE_COMPILE -c test1.c
     expect_stat 'cache hit (direct)' 1
@@ -121,4 +124,87 @@ SUITE_cache_levels() {
     expect_stat 'files in cache' $((files + 2))
     expect_on_level R 4
     expect_on_level M 4
+
+    # -------------------------------------------------------------------------
+    TEST "No levels file below level 3 for old cache"
+
+    files=$((16 * 16 * 100))
+    add_fake_files_counters $files
+
+    $CCACHE_COMPILE -c test1.c
+    expect_stat 'cache hit (direct)' 0
+    expect_stat 'cache miss' 1
+    expect_on_level R 2
+    expect_on_level M 2
+    expect_file_count 0 levels $CCACHE_DIR
+
+    $CCACHE_COMPILE -c test1.c
+    expect_stat 'cache hit (direct)' 1
+
+    # -------------------------------------------------------------------------
+    TEST "No move to a shallower level"
+
+    files=$((16 * 16 * 100))
+    add_fake_files_counters $files
+    for x in 0 1 2 3 4 5 6 7 8 9 a b c d e f; do
+        echo 3 >$CCACHE_DIR/$x/levels
+    done
+
+    $CCACHE_COMPILE -c test1.c
+    expect_stat 'cache hit (direct)' 0
+    expect_stat 'cache miss' 1
+    expect_on_level R 3
+    expect_on_level M 3
+    for x in 0 1 2 3 4 5 6 7 8 9 a b c d e f; do
+        expect_content $CCACHE_DIR/$x/levels 3
+    done
+
+    $CCACHE_COMPILE -c test1.c
+    expect_stat 'cache hit (direct)' 1
+
+    # -------------------------------------------------------------------------
+    TEST "Moving existing files to a deeper level"
+
+    files=$((16 * 16 * 2001))
+    add_fake_files_counters $files
+    for x in 0 1 2 3 4 5 6 7 8 9 a b c d e f; do
+        echo 2 >$CCACHE_DIR/$x/levels
+        mkdir -p $CCACHE_DIR/$x/0
+        echo old >$CCACHE_DIR/$x/0/123W
+    done
+
+    $CCACHE_COMPILE -c test1.c
+    expect_stat 'cache hit (direct)' 0
+    expect_stat 'cache miss' 1
+    expect_on_level R 3
+    expect_on_level M 3
+
+    # Wait for the background jobs to finish.
+    for i in $(seq 50); do
+        if ! grep -q ' ' $CCACHE_DIR/*/levels \
+               && [ -z "$(find $CCACHE_DIR -name relevel.lock)" ]; then
+            break
+        fi
+        sleep 0.1
+    done
+
+    moved=0
+    for x in 0 1 2 3 4 5 6 7 8 9 a b c d e f; do
+        if [ "$(cat $CCACHE_DIR/$x/levels)" = 3 ]; then
+            expect_exists $CCACHE_DIR/$x/0/1/23W
+            expect_missing $CCACHE_DIR/$x/0/123W
+            moved=$((moved + 1))
+        else
+            expect_content $CCACHE_DIR/$x/levels 2
+            expect_exists $CCACHE_DIR/$x/0/123W
+        fi
+    done
+    if [ $moved -eq 0 ]; then
+        test_failed "No files were moved to level 3"
+    fi
+    expect_contains $CCACHE_LOGFILE "to level 3 in the background"
+
+    $CCACHE_COMPILE -c test1.c
+    expect_stat 'cache hit (direct)' 1
+    expect_stat 'cache miss' 1
 }
@@ -66,6 +66,30 @@ SUITE_cleanup() {
     done
 
     # -------------------------------------------------------------------------
+    # -------------------------------------------------------------------------
+    TEST "Forced cache cleanup and clear, multiple jobs"
+
+    for x in 0 1 2 3 4 5 6 7 8 9 a b c d e f; do
+        prepare_cleanup_test_dir $CCACHE_DIR/$x
+    done
+
+    $CCACHE -F 80 -M 0 >/dev/null
+    $CCACHE -j 4 -c >/dev/null
+    expect_file_count 80 '*R' $CCACHE_DIR
+    expect_stat 'files in cache' 80
+    expect_stat 'cleanups performed' 16
+
+    touch $CCACHE_DIR/?/result[89]R
+    $CCACHE --jobs 4 --evict-older-than 1d >/dev/null
+    expect_file_count 32 '*R' $CCACHE_DIR
+    expect_stat 'files in cache' 32
+    expect_stat 'cleanups performed' 32
+
+    $CCACHE -j 4 -C >/dev/null
+    expect_file_count 0 '*R' $CCACHE_DIR
+    expect_stat 'files in cache' 0
+    expect_stat 'cleanups performed' 48
+
     if [ -n "$ENABLE_CACHE_CLEANUP_TESTS" ]; then
         TEST "Forced cache cleanup, size limit"
 
@@ -130,6 +154,107 @@ SUITE_cleanup() {
     expect_stat 'files in cache' 157
     expect_stat 'cleanups performed' 1
 
+    # -------------------------------------------------------------------------
+    TEST "Automatic background cleanup"
+
+    for x in 0 1 2 3 4 5 6 7 8 9 a b c d e f; do
+        prepare_cleanup_test_dir $CCACHE_DIR/$x
+    done
+
+    $CCACHE -F 160 -M 0 >/dev/null
+
+    touch empty.c
+    CCACHE_BACKGROUNDCLEANUP=1 CCACHE_LIMIT_MULTIPLE=0.9 \
+        $CCACHE_COMPILE -c empty.c -o empty.o
+
+    # Wait for the background cleanup to finish.
+    for i in $(seq 50); do
+        if [ $(find $CCACHE_DIR -name '*R' | wc -l) -eq 159 ] \
+               && [ -z "$(find $CCACHE_DIR -name cleanup.lock)" ]; then
+            break
+        fi
+        sleep 0.1
+    done
+    expect_file_count 159 '*R' $CCACHE_DIR
+    expect_stat 'files in cache' 159
+    expect_stat 'cleanups performed' 1
+    expect_contains $CCACHE_LOGFILE "in the background"
+    expect_not_contains $CCACHE_LOGFILE "Could not clean up in the background"
+
+    # -------------------------------------------------------------------------
+    TEST "Automatic cache cleanup using LRU index"
+
+    for ((i = 0; i < 32; ++i)); do
+        echo "int x$i;" >test$i.c
+        $CCACHE_COMPILE -c test$i.c
+    done
+    expect_stat 'files in cache' 32
+
+    $CCACHE -c >/dev/null
+    expect_file_count 16 'lru' $CCACHE_DIR
+    expect_stat 'cleanups performed' 0
+
+    $CCACHE -F 32 -M 0 >/dev/null
+    echo "int y;" >test.c
+    CCACHE_LIMIT_MULTIPLE=0.5 $CCACHE_COMPILE -c test.c
+    expect_stat 'cleanups performed' 1
+    expect_contains $CCACHE_LOGFILE "using LRU index"
+
+    # -------------------------------------------------------------------------
+    TEST "Forced cache cleanup, GDSF eviction policy"
+
+    prepare_cleanup_test_dir $CCACHE_DIR/a
+    # result0R is the least recently used but took long to compile.
+    printf '# ccache LRU index 2\n60 result0R 4096 10000 5\n' \
+        >$CCACHE_DIR/a/lru
+
+    $CCACHE -F 144 -M 0 -o eviction_policy=gdsf >/dev/null
+    $CCACHE -c >/dev/null
+    expect_exists $CCACHE_DIR/a/result0R
+    expect_missing $CCACHE_DIR/a/result1R
+    expect_file_count 9 '*R' $CCACHE_DIR
+    expect_stat 'files in cache' 9
+    expect_contains $CCACHE_DIR/a/lru "result0R 4096 10000 5"
+
+    # -------------------------------------------------------------------------
+    TEST "Eviction simulation"
+
+    mkdir -p $CCACHE_DIR/a
+    cat <<EOF >$CCACHE_DIR/a/lru
+# ccache LRU index 2
+100 bR 4096 10000 0
+110 aR 4096 100 0
+120 cR 4096 100 0
+130 bR
+140 aR
+150 cR
+160 bR
+EOF
+
+    $CCACHE --simulate-eviction 8Ki >simulation.txt
+    awk '{print $1, $2, $3, $4}' simulation.txt >counts.txt
+    expect_content counts.txt "policy hits misses evictions
+lru 0 7 5
+gdsf 2 5 3"
+    expect_contains simulation.txt "20.0 s"
+
+    # -------------------------------------------------------------------------
+    TEST "Eviction simulation of compacted index"
+
+    mkdir -p $CCACHE_DIR/a
+    cat <<EOF >$CCACHE_DIR/a/lru
+# ccache LRU index 2
+100 aR 4096 1000 3
+110 bR 4096 1000 0
+EOF
+
+    $CCACHE --simulate-eviction 4Ki >simulation.txt
+    awk '{print $1, $2, $3, $4}' simulation.txt >counts.txt
+    expect_content counts.txt "policy hits misses evictions
+lru 3 2 1
+gdsf 3 2 1"
+    expect_contains simulation.txt "3.0 s"
+
     # -------------------------------------------------------------------------
     TEST "No cleanup of new unknown file"
 
@@ -102,6 +102,43 @@ SUITE_direct() {
     expect_stat 'cache hit (preprocessed)' 0
     expect_stat 'cache miss' 2
 
+    # -------------------------------------------------------------------------
+    TEST "Many include files"
+
+    # Enough include files to make the manifest verification hash them on
+    # worker threads.
+    rm -f many.c
+    for i in $(seq -w 1 32); do
+        echo "int h$i;" >h$i.h
+        echo "#include \"h$i.h\"" >>many.c
+    done
+    backdate h*.h
+
+    $CCACHE_COMPILE -c many.c
+    expect_stat 'cache hit (direct)' 0
+    expect_stat 'cache miss' 1
+
+    $CCACHE_COMPILE -c many.c
+    expect_stat 'cache hit (direct)' 1
+    expect_stat 'cache miss' 1
+
+    # Same size but different content.
+    echo "int x17;" >h17.h
+    backdate h17.h
+    $CCACHE_COMPILE -c many.c
+    expect_stat 'cache hit (direct)' 1
+    expect_stat 'cache miss' 2
+
+    $CCACHE_COMPILE -c many.c
+    expect_stat 'cache hit (direct)' 2
+    expect_stat 'cache miss' 2
+
+    echo "int h17;" >h17.h
+    backdate h17.h
+    $CCACHE_COMPILE -c many.c
+    expect_stat 'cache hit (direct)' 3
+    expect_stat 'cache miss' 2
+
     # -------------------------------------------------------------------------
     TEST "Removed but previously compiled header file"
 
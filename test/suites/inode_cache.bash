@@ -25,8 +25,9 @@ expect_inode_cache_type() {
     local expected=$1
     local source_file=$2
     local type=$3
+    local compiled_file=${4:-$source_file}
 
-    local log_file=$(echo $source_file | sed 's/\.c$/.o.ccache-log/')
+    local log_file=$(echo $compiled_file | sed 's/\.c$/.o.ccache-log/')
     local actual=$(grep -c "inode cache $type: $source_file" "$log_file")
     if [ $actual -ne $expected ]; then
         test_failed "Found $actual (expected $expected) $type for $source_file"
@@ -34,9 +35,9 @@ expect_inode_cache_type() {
 }
 
 expect_inode_cache() {
-    expect_inode_cache_type $1 $4 hit
-    expect_inode_cache_type $2 $4 miss
-    expect_inode_cache_type $3 $4 insert
+    expect_inode_cache_type $1 $4 hit $5
+    expect_inode_cache_type $2 $4 miss $5
+    expect_inode_cache_type $3 $4 insert $5
 }
 
 inode_cache_tests() {
@@ -98,4 +99,18 @@ inode_cache_tests() {
     echo "// replace" > test1.c
     $CCACHE_COMPILE -c test1.c
     expect_inode_cache 0 1 1 test1.c
+
+    # -------------------------------------------------------------------------
+    TEST "Include file in manifest"
+
+    echo "// include file" > test.h
+    backdate test.h
+    echo '#include "test.h"' > test1.c
+    $CCACHE_COMPILE -c test1.c
+    expect_stat 'cache miss' 1
+    expect_inode_cache 0 1 1 test.h test1.c
+
+    $CCACHE_COMPILE -c test1.c
+    expect_stat 'cache hit (direct)' 1
+    expect_inode_cache 1 0 0 test.h test1.c
 }
@@ -68,6 +68,96 @@ SUITE_secondary_file() {
     expect_file_count 1 '*' secondary # CACHEDIR.TAG
     expect_file_count 3 '*' secondary_2 # CACHEDIR.TAG + result + manifest
 
+    # -------------------------------------------------------------------------
+    TEST "Priority"
+
+    mkdir secondary_2
+    CCACHE_SECONDARY_STORAGE+=" file://$PWD/secondary_2|priority=1"
+
+    $CCACHE_COMPILE -c test.c
+    expect_stat 'cache hit (direct)' 0
+    expect_stat 'cache miss' 1
+    expect_file_count 3 '*' secondary # CACHEDIR.TAG + result + manifest
+    expect_file_count 3 '*' secondary_2 # CACHEDIR.TAG + result + manifest
+
+    $CCACHE -C >/dev/null
+    rm -r secondary_2/??
+
+    CCACHE_DEBUG=1 $CCACHE_COMPILE -c test.c
+    expect_stat 'cache hit (direct)' 1
+    expect_stat 'cache miss' 1
+    expect_not_contains test.o.ccache-log "in parallel"
+
+    CCACHE_SECONDARY_STORAGE="file://$PWD/secondary file://$PWD/secondary_2"
+
+    CCACHE_DEBUG=1 $CCACHE_COMPILE -c test.c
+    expect_stat 'cache hit (direct)' 2
+    expect_stat 'cache miss' 1
+    expect_contains test.o.ccache-log "in parallel"
+
+    # -------------------------------------------------------------------------
+    TEST "Asynchronous upload"
+
+    export CCACHE_SECONDARY_STORAGE_ASYNC_UPLOAD=1
+
+    $CCACHE_COMPILE -c test.c
+    expect_stat 'cache hit (direct)' 0
+    expect_stat 'cache miss' 1
+    expect_stat 'files in cache' 2
+    expect_stat 'secondary storage uploads queued' 2
+
+    # Wait for the background upload to finish.
+    for i in $(seq 50); do
+        if [ $(find secondary -type f | wc -l) -eq 3 ] \
+               && [ -z "$(ls $CCACHE_DIR/upload-queue)" ]; then
+            break
+        fi
+        sleep 0.1
+    done
+    expect_file_count 3 '*' secondary # CACHEDIR.TAG + result + manifest
+    expect_file_count 0 '*' $CCACHE_DIR/upload-queue
+
+    $CCACHE -C >/dev/null
+    expect_stat 'files in cache' 0
+
+    $CCACHE_COMPILE -c test.c
+    expect_stat 'cache hit (direct)' 1
+    expect_stat 'cache miss' 1
+    expect_stat 'files in cache' 0
+    expect_stat 'secondary storage uploads queued' 2
+
+    unset CCACHE_SECONDARY_STORAGE_ASYNC_UPLOAD
+
+    # -------------------------------------------------------------------------
+    TEST "Asynchronous upload, left-over queue entries"
+
+    export CCACHE_SECONDARY_STORAGE_ASYNC_UPLOAD=1
+
+    # The queue time is part of the name, not the file's timestamps.
+    mkdir -p $CCACHE_DIR/upload-queue
+    now=$(date +%s)
+    old_key=$(printf '1%.0s' $(seq 40))
+    retry_key=$(printf '2%.0s' $(seq 40))
+    echo old >$CCACHE_DIR/upload-queue/$old_key-$((now - 2 * 86400))
+    echo retry >$CCACHE_DIR/upload-queue/$retry_key-$((now - 120))
+
+    $CCACHE_COMPILE -c test.c
+    expect_stat 'cache miss' 1
+
+    # Wait for the background upload to finish.
+    for i in $(seq 50); do
+        if [ -z "$(ls $CCACHE_DIR/upload-queue)" ]; then
+            break
+        fi
+        sleep 0.1
+    done
+    expect_file_count 0 '*' $CCACHE_DIR/upload-queue
+    # CACHEDIR.TAG + result + manifest + retried entry
+    expect_file_count 4 '*' secondary
+    expect_stat 'secondary storage uploads lost' 1
+
+    unset CCACHE_SECONDARY_STORAGE_ASYNC_UPLOAD
+
     # -------------------------------------------------------------------------
     TEST "Read-only"
 
@@ -96,6 +186,115 @@ SUITE_secondary_file() {
     expect_stat 'files in cache' 2
     expect_file_count 3 '*' secondary # CACHEDIR.TAG + result + manifest
 
+    # -------------------------------------------------------------------------
+    TEST "Negative lookup cache"
+
+    export CCACHE_SECONDARY_STORAGE_NEGATIVE_CACHE_TTL=3600
+
+    $CCACHE_COMPILE -c test.c
+    expect_stat 'cache hit (direct)' 0
+    expect_stat 'cache miss' 1
+    expect_file_count 3 '*' secondary # CACHEDIR.TAG + result + manifest
+
+    # The misses were forgotten when the entries were stored.
+    $CCACHE -C >/dev/null
+    $CCACHE_COMPILE -c test.c
+    expect_stat 'cache hit (direct)' 1
+    expect_stat 'cache miss' 1
+
+    CCACHE_SECONDARY_STORAGE+="|read-only"
+    echo 'int x;' >> test.c
+
+    CCACHE_DEBUG=1 $CCACHE_COMPILE -c test.c
+    expect_stat 'cache hit (direct)' 1
+    expect_stat 'cache miss' 2
+    expect_not_contains test.o.ccache-log "recently missing"
+
+    $CCACHE -C >/dev/null
+    CCACHE_DEBUG=1 $CCACHE_COMPILE -c test.c
+    expect_stat 'cache hit (direct)' 1
+    expect_stat 'cache miss' 3
+    expect_contains test.o.ccache-log "recently missing"
+
+    $CCACHE -C >/dev/null
+    CCACHE_SECONDARY_STORAGE_NEGATIVE_CACHE_TTL=0 CCACHE_DEBUG=1 \
+        $CCACHE_COMPILE -c test.c
+    expect_stat 'cache miss' 4
+    expect_not_contains test.o.ccache-log "recently missing"
+
+    # -------------------------------------------------------------------------
+    TEST "Compression level attribute"
+
+    CCACHE_SECONDARY_STORAGE+="|compression-level=19"
+
+    $CCACHE_COMPILE -c test.c
+    expect_stat 'cache miss' 1
+    expect_file_count 3 '*' secondary # CACHEDIR.TAG + result + manifest
+    for file in $(find secondary $CCACHE_DIR -type f -name '[0-9a-f]*'); do
+        if $CCACHE --dump-result $file >dump.out 2>&1 \
+            || $CCACHE --dump-manifest $file >dump.out 2>&1; then
+            case $file in
+                secondary/*) expected=19 ;;
+                *) expected=1 ;;
+            esac
+            expect_contains dump.out "Compression level: $expected"
+        fi
+    done
+
+    $CCACHE -C >/dev/null
+    $CCACHE_COMPILE -c test.c
+    expect_stat 'cache hit (direct)' 1
+    expect_stat 'cache miss' 1
+
+    # -------------------------------------------------------------------------
+    TEST "Levels and resharding"
+
+    CCACHE_SECONDARY_STORAGE+="|levels=3|level-width=1"
+
+    $CCACHE_COMPILE -c test.c
+    expect_stat 'cache miss' 1
+    expect_file_count 3 '*' secondary # CACHEDIR.TAG + result + manifest
+    if [ "$(find secondary -mindepth 4 -type f | wc -l)" -ne 2 ]; then
+        test_failed "Expected entries to be stored three levels down"
+    fi
+
+    export CCACHE_SECONDARY_STORAGE="file://$PWD/secondary|levels=0"
+    $CCACHE --reshard >reshard.out
+    expect_contains reshard.out "Moved 2 entries"
+    expect_file_count 3 '*' secondary # CACHEDIR.TAG + result + manifest
+    if [ -n "$(find secondary -mindepth 1 -type d)" ]; then
+        test_failed "Expected no directories to be left after resharding"
+    fi
+
+    $CCACHE --reshard >reshard.out
+    expect_contains reshard.out "Moved 0 entries"
+
+    $CCACHE -C >/dev/null
+    $CCACHE_COMPILE -c test.c
+    expect_stat 'cache hit (direct)' 1
+    expect_stat 'cache miss' 1
+
+    # -------------------------------------------------------------------------
+if ! $HOST_OS_WINDOWS; then
+    TEST "Pack files"
+
+    CCACHE_SECONDARY_STORAGE+="|pack=true"
+
+    $CCACHE_COMPILE -c test.c
+    expect_stat 'cache hit (direct)' 0
+    expect_stat 'cache miss' 1
+    expect_exists secondary/CACHEDIR.TAG
+    expect_file_count 2 '*.idx' secondary/pack # result + manifest
+    expect_file_count 2 '*.pack' secondary/pack # result + manifest
+    expect_file_count 5 '*' secondary
+
+    $CCACHE -C >/dev/null
+    $CCACHE_COMPILE -c test.c
+    expect_stat 'cache hit (direct)' 1
+    expect_stat 'cache miss' 1
+    expect_file_count 5 '*' secondary
+fi
+
     # -------------------------------------------------------------------------
     TEST "umask"
 
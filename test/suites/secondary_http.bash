@@ -0,0 +1,179 @@
+HTTP_SERVER="$(cd "$(dirname "$0")" && pwd)/http-server"
+
+start_http_server() {
+    local port="$1"
+    local cache_dir="$2"
+    shift 2
+
+    mkdir "${cache_dir}"
+    "${HTTP_SERVER}" --bind localhost --directory "${cache_dir}" "$@" \
+        "${port}" >http-server.log 2>&1 &
+    for _ in $(seq 50); do
+        if grep -q "^Serving HTTP" http-server.log 2>/dev/null; then
+            return
+        fi
+        sleep 0.1
+    done
+    test_failed_internal "Failed to start HTTP server on port ${port}"
+}
+
+connection_count() {
+    grep -c "new connection" http-server.log
+}
+
+request_count() {
+    grep -c '"[A-Z]* /' http-server.log
+}
+
+SUITE_secondary_http_PROBE() {
+    if ! "${HTTP_SERVER}" --help >/dev/null 2>&1; then
+        echo "cannot execute ${HTTP_SERVER} - Python 3 might be missing"
+    fi
+}
+
+SUITE_secondary_http_SETUP() {
+    unset CCACHE_NODIRECT
+
+    generate_code 1 test.c
+}
+
+SUITE_secondary_http() {
+    # -------------------------------------------------------------------------
+    TEST "Base case"
+
+    start_http_server 12780 secondary
+    export CCACHE_SECONDARY_STORAGE="http://localhost:12780/"
+
+    $CCACHE_COMPILE -c test.c
+    expect_stat 'cache hit (direct)' 0
+    expect_stat 'cache miss' 1
+    expect_stat 'files in cache' 2
+    expect_file_count 2 '*' secondary # result + manifest
+
+    $CCACHE_COMPILE -c test.c
+    expect_stat 'cache hit (direct)' 1
+    expect_stat 'cache miss' 1
+    expect_stat 'files in cache' 2
+    expect_file_count 2 '*' secondary # result + manifest
+
+    $CCACHE -C >/dev/null
+    expect_stat 'files in cache' 0
+    expect_file_count 2 '*' secondary # result + manifest
+
+    $CCACHE_COMPILE -c test.c
+    expect_stat 'cache hit (direct)' 2
+    expect_stat 'cache miss' 1
+    expect_stat 'files in cache' 0
+    expect_file_count 2 '*' secondary # result + manifest
+
+    # -------------------------------------------------------------------------
+    TEST "Path prefix"
+
+    start_http_server 12780 secondary
+    export CCACHE_SECONDARY_STORAGE="http://localhost:12780/some/dir"
+
+    $CCACHE_COMPILE -c test.c
+    expect_stat 'cache miss' 1
+    expect_file_count 2 '*' secondary/some/dir # result + manifest
+
+    $CCACHE -C >/dev/null
+    $CCACHE_COMPILE -c test.c
+    expect_stat 'cache hit (direct)' 1
+    expect_stat 'cache miss' 1
+
+    # -------------------------------------------------------------------------
+    TEST "Keep-alive"
+
+    start_http_server 12780 secondary
+    export CCACHE_SECONDARY_STORAGE="http://localhost:12780"
+
+    $CCACHE_COMPILE -c test.c
+    expect_stat 'cache miss' 1
+    expect_file_count 2 '*' secondary # result + manifest
+    if [ "$(connection_count)" -ne 1 ]; then
+        test_failed "Expected 1 connection, got $(connection_count)"
+    fi
+
+    CCACHE_SECONDARY_STORAGE+="|keep-alive=false"
+    $CCACHE -C >/dev/null
+    $CCACHE_COMPILE -c test.c
+    expect_stat 'cache hit (direct)' 1
+    # Manifest + result, one connection each.
+    if [ "$(connection_count)" -ne 3 ] || [ "$(request_count)" -ne 6 ]; then
+        test_failed "Expected one connection per request"
+    fi
+
+    # -------------------------------------------------------------------------
+    TEST "Operation timeout"
+
+    start_http_server 12780 secondary --delay 1
+    export CCACHE_SECONDARY_STORAGE="http://localhost:12780|operation-timeout=100"
+    export CCACHE_DEBUG=1
+
+    $CCACHE_COMPILE -c test.c
+    expect_stat 'cache hit (direct)' 0
+    expect_stat 'cache miss' 1
+    expect_stat 'files in cache' 2
+    expect_contains test.o.ccache-log "Timeout while communicating"
+
+    # -------------------------------------------------------------------------
+    TEST "Unreachable server"
+
+    export CCACHE_SECONDARY_STORAGE="http://localhost:12781"
+    export CCACHE_DEBUG=1
+
+    $CCACHE_COMPILE -c test.c
+    expect_stat 'cache hit (direct)' 0
+    expect_stat 'cache miss' 1
+    expect_stat 'files in cache' 2
+    expect_contains test.o.ccache-log "Failed to connect"
+    expect_stat 'secondary storage errors' 3 # get manifest, put result+manifest
+
+    # -------------------------------------------------------------------------
+    TEST "Circuit breaker"
+
+    export CCACHE_SECONDARY_STORAGE="http://localhost:12781"
+    export CCACHE_SECONDARY_STORAGE_FAILURE_THRESHOLD=1
+    export CCACHE_DEBUG=1
+
+    $CCACHE_COMPILE -c test.c
+    expect_stat 'cache miss' 1
+    expect_stat 'secondary storage errors' 1
+    expect_stat 'secondary storage skipped' 2
+    expect_exists $CCACHE_DIR/secondary-health
+
+    $CCACHE_COMPILE -c test.c
+    expect_stat 'cache hit (direct)' 1
+    expect_stat 'secondary storage errors' 1
+    expect_stat 'secondary storage skipped' 2
+    expect_not_contains test.o.ccache-log "Failed to connect"
+
+    $CCACHE -C >/dev/null
+    $CCACHE_COMPILE -c test.c
+    expect_stat 'cache miss' 2
+    expect_stat 'secondary storage errors' 1
+    expect_stat 'secondary storage skipped' 5
+    expect_contains test.o.ccache-log "since it has failed 1 times in a row"
+
+    # After the cool-down period the backend is tried again.
+    $CCACHE -C >/dev/null
+    CCACHE_SECONDARY_STORAGE_COOL_DOWN=0 $CCACHE_COMPILE -c test.c
+    expect_stat 'cache miss' 3
+    expect_stat 'secondary storage errors' 4
+    expect_stat 'secondary storage skipped' 5
+
+    # -------------------------------------------------------------------------
+    TEST "Latency budget"
+
+    start_http_server 12780 secondary --delay 0.5
+    export CCACHE_SECONDARY_STORAGE="http://localhost:12780"
+    export CCACHE_SECONDARY_STORAGE_LATENCY_BUDGET=100
+    export CCACHE_DEBUG=1
+
+    $CCACHE_COMPILE -c test.c
+    expect_stat 'cache miss' 1
+    expect_stat 'files in cache' 2
+    expect_contains test.o.ccache-log "latency budget"
+    expect_stat 'secondary storage timeouts' 1 # get manifest cut short
+    expect_stat 'secondary storage skipped' 2
+}
@@ -39,10 +39,13 @@ TEST_CASE("Config: default values")
 {
   Config config;
 
+  CHECK(!config.background_cleanup());
   CHECK(config.base_dir().empty());
   CHECK(config.cache_dir().empty()); // Set later
+  CHECK(!config.common_hash_cache());
   CHECK(config.compiler().empty());
   CHECK(config.compiler_check() == "mtime");
+  CHECK(!config.compiler_check_cache());
   CHECK(config.compiler_type() == CompilerType::auto_guess);
   CHECK(config.compression());
   CHECK(config.compression_level() == 0);
@@ -52,6 +55,7 @@ TEST_CASE("Config: default values")
   CHECK(!config.depend_mode());
   CHECK(config.direct_mode());
   CHECK(!config.disable());
+  CHECK(config.eviction_policy() == EvictionPolicy::lru);
   CHECK(config.extra_files_to_hash().empty());
   CHECK(!config.file_clone());
   CHECK(!config.hard_link());
@@ -92,14 +96,17 @@ TEST_CASE("Config::update_from_file")
 
   Util::write_file(
     "ccache.conf",
+    "background_cleanup = true\n"
     "base_dir = " + base_dir + "\n"
     "cache_dir=\n"
     "cache_dir = $USER$/${USER}/.ccache\n"
+    "common_hash_cache = true\n"
     "\n"
     "\n"
     "  #A comment\n"
     "\t compiler = foo\n"
     "compiler_check = none\n"
+    "compiler_check_cache = true\n"
     "compiler_type = pump\n"
     "compression=false\n"
     "compression_level= 2\n"
@@ -107,6 +114,7 @@ TEST_CASE("Config::update_from_file")
     "depend_mode = true\n"
     "direct_mode = false\n"
     "disable = true\n"
+    "eviction_policy = gdsf\n"
     "extra_files_to_hash = a:b c:$USER\n"
     "file_clone = true\n"
     "hard_link = true\n"
@@ -135,10 +143,13 @@ TEST_CASE("Config::update_from_file")
 
   Config config;
   REQUIRE(config.update_from_file("ccache.conf"));
+  CHECK(config.background_cleanup());
   CHECK(config.base_dir() == base_dir);
   CHECK(config.cache_dir() == FMT("{0}$/{0}/.ccache", user));
+  CHECK(config.common_hash_cache());
   CHECK(config.compiler() == "foo");
   CHECK(config.compiler_check() == "none");
+  CHECK(config.compiler_check_cache());
   CHECK(config.compiler_type() == CompilerType::pump);
   CHECK_FALSE(config.compression());
   CHECK(config.compression_level() == 2);
@@ -146,6 +157,7 @@ TEST_CASE("Config::update_from_file")
   CHECK(config.depend_mode());
   CHECK_FALSE(config.direct_mode());
   CHECK(config.disable());
+  CHECK(config.eviction_policy() == EvictionPolicy::gdsf);
   CHECK(config.extra_files_to_hash() == FMT("a:b c:{}", user));
   CHECK(config.file_clone());
   CHECK(config.hard_link());
@@ -364,14 +376,17 @@ TEST_CASE("Config::visit_items")
   Util::write_file(
     "test.conf",
     "absolute_paths_in_stderr = true\n"
+    "background_cleanup = true\n"
 #ifndef _WIN32
     "base_dir = /bd\n"
 #else
     "base_dir = C:/bd\n"
 #endif
     "cache_dir = cd\n"
+    "common_hash_cache = true\n"
     "compiler = c\n"
     "compiler_check = cc\n"
+    "compiler_check_cache = true\n"
     "compiler_type = clang\n"
     "compression = true\n"
     "compression_level = 8\n"
@@ -381,6 +396,7 @@ TEST_CASE("Config::visit_items")
     "depend_mode = true\n"
     "direct_mode = false\n"
     "disable = true\n"
+    "eviction_policy = gdsf\n"
     "extra_files_to_hash = efth\n"
     "file_clone = true\n"
     "hard_link = true\n"
@@ -402,6 +418,11 @@ TEST_CASE("Config::visit_items")
     "recache = true\n"
     "run_second_cpp = false\n"
     "secondary_storage = ss\n"
+    "secondary_storage_async_upload = true\n"
+    "secondary_storage_cool_down = 30\n"
+    "secondary_storage_failure_threshold = 5\n"
+    "secondary_storage_latency_budget = 500\n"
+    "secondary_storage_negative_cache_ttl = 600\n"
     "sloppiness = include_file_mtime, include_file_ctime, time_macros,"
     " file_stat_matches, file_stat_matches_ctime, pch_defines, system_headers,"
     " clang_index_store, ivfsoverlay\n"
@@ -422,14 +443,17 @@ TEST_CASE("Config::visit_items")
 
   std::vector<std::string> expected = {
     "(test.conf) absolute_paths_in_stderr = true",
+    "(test.conf) background_cleanup = true",
 #ifndef _WIN32
     "(test.conf) base_dir = /bd",
 #else
     "(test.conf) base_dir = C:/bd",
 #endif
     "(test.conf) cache_dir = cd",
+    "(test.conf) common_hash_cache = true",
     "(test.conf) compiler = c",
     "(test.conf) compiler_check = cc",
+    "(test.conf) compiler_check_cache = true",
     "(test.conf) compiler_type = clang",
     "(test.conf) compression = true",
     "(test.conf) compression_level = 8",
@@ -439,6 +463,7 @@ TEST_CASE("Config::visit_items")
     "(test.conf) depend_mode = true",
     "(test.conf) direct_mode = false",
     "(test.conf) disable = true",
+    "(test.conf) eviction_policy = gdsf",
     "(test.conf) extra_files_to_hash = efth",
     "(test.conf) file_clone = true",
     "(test.conf) hard_link = true",
@@ -460,6 +485,11 @@ TEST_CASE("Config::visit_items")
     "(test.conf) recache = true",
     "(test.conf) run_second_cpp = false",
     "(test.conf) secondary_storage = ss",
+    "(test.conf) secondary_storage_async_upload = true",
+    "(test.conf) secondary_storage_cool_down = 30",
+    "(test.conf) secondary_storage_failure_threshold = 5",
+    "(test.conf) secondary_storage_latency_budget = 500",
+    "(test.conf) secondary_storage_negative_cache_ttl = 600",
     "(test.conf) sloppiness = include_file_mtime, include_file_ctime,"
     " time_macros, pch_defines, file_stat_matches, file_stat_matches_ctime,"
     " system_headers, clang_index_store, ivfsoverlay",
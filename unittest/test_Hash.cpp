@@ -20,6 +20,37 @@
 
 #include "third_party/doctest.h"
 
+#include <chrono>
+#include <string>
+
+namespace {
+
+std::string
+pseudo_random_data(size_t size)
+{
+  std::string data(size, 0);
+  uint32_t x = 4711;
+  for (auto& c : data) {
+    x = x * 1103515245 + 12345;
+    c = static_cast<char>(x >> 16);
+  }
+  return data;
+}
+
+Digest
+serial_digest(nonstd::string_view prefix, nonstd::string_view data)
+{
+  blake3_hasher hasher;
+  blake3_hasher_init(&hasher);
+  blake3_hasher_update(&hasher, prefix.data(), prefix.size());
+  blake3_hasher_update(&hasher, data.data(), data.size());
+  Digest digest;
+  blake3_hasher_finalize(&hasher, digest.bytes(), digest.size());
+  return digest;
+}
+
+} // namespace
+
 TEST_SUITE_BEGIN("Hash");
 
 TEST_CASE("known strings")
@@ -73,6 +104,19 @@ TEST_CASE("Hash::digest should be idempotent")
   CHECK(h.digest().to_string() == "af1396svbud1kqg40jfa6reciicrpcisi");
 }
 
+TEST_CASE("Hash::set_state")
+{
+  Hash h1;
+  h1.hash("message");
+  const std::string state = h1.state();
+
+  Hash h2;
+  CHECK(!h2.set_state(state.substr(1)));
+  REQUIRE(h2.set_state(state));
+  h2.hash(" digest");
+  CHECK(h2.digest().to_string() == "7bc2kbnbinerv6ruptldpdrb8ko93hcdo");
+}
+
 TEST_CASE("Digest::bytes")
 {
   Digest d = Hash().hash("message digest").digest();
@@ -83,4 +127,44 @@ TEST_CASE("Digest::bytes")
   CHECK(memcmp(d.bytes(), expected, Digest::size()) == 0);
 }
 
+TEST_CASE("Large input is hashed like serial BLAKE3")
+{
+  const std::string data = pseudo_random_data(9 * 1024 * 1024 + 4711);
+
+  for (size_t prefix_size : {0, 1, 64, 1000, 1024, 1025, 3072, 70000}) {
+    for (size_t size : {4 * 1024 * 1024,
+                        4 * 1024 * 1024 + 1,
+                        5 * 1024 * 1024 - 1024,
+                        9 * 1024 * 1024 + 4711}) {
+      CAPTURE(prefix_size);
+      CAPTURE(size);
+      const nonstd::string_view prefix(data.data(), prefix_size);
+      const nonstd::string_view input(data.data(), size);
+
+      Hash h;
+      h.hash(prefix);
+      h.hash(input);
+      CHECK(h.digest() == serial_digest(prefix, input));
+    }
+  }
+}
+
+TEST_CASE("Benchmark of large input hashing" * doctest::skip())
+{
+  const std::string data = pseudo_random_data(256 * 1024 * 1024);
+
+  const auto t0 = std::chrono::steady_clock::now();
+  const Digest serial = serial_digest("", data);
+  const auto t1 = std::chrono::steady_clock::now();
+  const Digest parallel = Hash().hash(data).digest();
+  const auto t2 = std::chrono::steady_clock::now();
+
+  CHECK(serial == parallel);
+  MESSAGE("serial: "
+          << std::chrono::duration<double, std::milli>(t1 - t0).count()
+          << " ms, parallel: "
+          << std::chrono::duration<double, std::milli>(t2 - t1).count()
+          << " ms");
+}
+
 TEST_SUITE_END();
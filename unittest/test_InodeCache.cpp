@@ -21,6 +21,7 @@
 #include "../src/Hash.hpp"
 #include "../src/InodeCache.hpp"
 #include "../src/Util.hpp"
+#include "../src/fmtmacros.hpp"
 #include "TestUtil.hpp"
 
 #include "third_party/doctest.h"
@@ -133,6 +134,35 @@ TEST_CASE("Test put and lookup")
   CHECK(ctx.inode_cache.get_errors() == 0);
 }
 
+TEST_CASE("Test lookup with stat")
+{
+  TestContext test_context;
+
+  Context ctx;
+  init(ctx);
+  ctx.inode_cache.drop();
+  Util::write_file("a", "a text");
+
+  CHECK(put(ctx, "a", "a text", 1));
+
+  Digest digest;
+  int return_value;
+
+  const auto st = Stat::stat("a");
+  CHECK(ctx.inode_cache.get(
+    "a", st, InodeCache::ContentType::code, digest, &return_value));
+  CHECK(digest == Hash().hash("a text").digest());
+  CHECK(return_value == 1);
+
+  Util::write_file("a", "something else");
+
+  // The stale file status still refers to the old content.
+  CHECK(ctx.inode_cache.get(
+    "a", st, InodeCache::ContentType::code, digest, &return_value));
+  CHECK(!ctx.inode_cache.get(
+    "a", Stat::stat("a"), InodeCache::ContentType::code, digest));
+}
+
 TEST_CASE("Drop file")
 {
   TestContext test_context;
@@ -194,4 +224,84 @@ TEST_CASE("Test content type")
   CHECK(return_value == 3);
 }
 
+TEST_CASE("Test eviction and growth")
+{
+  TestContext test_context;
+
+  Context ctx;
+  init(ctx);
+  ctx.inode_cache.drop();
+
+  // Two buckets with room for 8 entries in total.
+  InodeCache cache(ctx.config, 2);
+  InodeCache other_cache(ctx.config, 2);
+  CHECK(cache.get_capacity() == 8);
+  CHECK(cache.get_occupancy() == 0);
+  CHECK(cache.get_evictions() == 0);
+  CHECK(other_cache.get_capacity() == 8);
+
+  for (int i = 0; i < 64; ++i) {
+    const auto path = FMT("file{}", i);
+    Util::write_file(path, path);
+    CHECK(cache.put(path,
+                    InodeCache::ContentType::code,
+                    Hash().hash(path).digest(),
+                    i));
+  }
+
+  const int64_t capacity = cache.get_capacity();
+  CHECK(capacity > 8);
+  CHECK(cache.get_occupancy() > 8);
+  CHECK(cache.get_occupancy() <= capacity);
+
+  // Another instance that mapped the original file switches to the new one.
+  CHECK(other_cache.get_capacity() == capacity);
+
+  // The most recently inserted entry survives growing.
+  Digest digest;
+  int return_value;
+  CHECK(other_cache.get(
+    "file63", InodeCache::ContentType::code, digest, &return_value));
+  CHECK(digest == Hash().hash("file63").digest());
+  CHECK(return_value == 63);
+}
+
+TEST_CASE("Old file is removed")
+{
+  TestContext test_context;
+
+  Context ctx;
+  init(ctx);
+  ctx.inode_cache.drop();
+  const auto old_file =
+    FMT("{}/inode-cache.v1", Util::dir_name(ctx.inode_cache.get_file()));
+  Util::ensure_dir_exists(Util::dir_name(old_file));
+  Util::write_file(old_file, "");
+  Util::write_file("a", "a text");
+
+  CHECK(put(ctx, "a", "a text", 1));
+  CHECK(!Stat::stat(old_file));
+}
+
+TEST_CASE("Test put replaces existing entry")
+{
+  TestContext test_context;
+
+  Context ctx;
+  init(ctx);
+  ctx.inode_cache.drop();
+  Util::write_file("a", "a text");
+
+  CHECK(put(ctx, "a", "a text", 1));
+  CHECK(put(ctx, "a", "a text", 2));
+  CHECK(ctx.inode_cache.get_occupancy() == 1);
+  CHECK(ctx.inode_cache.get_evictions() == 0);
+
+  Digest digest;
+  int return_value;
+  CHECK(ctx.inode_cache.get(
+    "a", InodeCache::ContentType::code, digest, &return_value));
+  CHECK(return_value == 2);
+}
+
 TEST_SUITE_END();
@@ -0,0 +1,99 @@
+// Copyright (C) 2021 Joel Rosdahl and other contributors
+//
+// See doc/AUTHORS.adoc for a complete list of contributors.
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc., 51
+// Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#include "../src/MappedFile.hpp"
+#include "../src/Util.hpp"
+#include "TestUtil.hpp"
+
+#include "third_party/doctest.h"
+
+using TestUtil::TestContext;
+
+TEST_SUITE_BEGIN("MappedFile");
+
+TEST_CASE("Small file")
+{
+  TestContext test_context;
+
+  Util::write_file("test", "hello");
+  MappedFile file("test");
+  CHECK(!file.is_mapped());
+  CHECK(file.size() == 5);
+  CHECK(file.view() == "hello");
+  CHECK(file.data()[5] == '\0');
+}
+
+TEST_CASE("Empty file")
+{
+  TestContext test_context;
+
+  Util::write_file("test", "");
+  MappedFile file("test");
+  CHECK(file.size() == 0);
+  CHECK(file.view() == "");
+  CHECK(file.data()[0] == '\0');
+}
+
+TEST_CASE("Large file")
+{
+  TestContext test_context;
+
+  // A multiple of the page size so that there is no slack after the content.
+  std::string content(256 * 1024, 'x');
+  content[4711] = 'y';
+  Util::write_file("test", content);
+
+  SUBCASE("Mapped")
+  {
+    MappedFile file("test", 0, MappedFile::Mapping::if_large);
+#ifndef _WIN32
+    CHECK(file.is_mapped());
+#endif
+    CHECK(file.size() == content.size());
+    CHECK(file.view() == content);
+    CHECK(file.data()[content.size()] == '\0');
+
+    file.data()[0] = 'z';
+    CHECK(file.view()[0] == 'z');
+    CHECK(Util::read_file("test") == content);
+  }
+
+  SUBCASE("Not requested")
+  {
+    MappedFile file("test");
+    CHECK(!file.is_mapped());
+    CHECK(file.view() == content);
+    CHECK(file.data()[content.size()] == '\0');
+  }
+
+  SUBCASE("Small size hint")
+  {
+    MappedFile file("test", 100, MappedFile::Mapping::if_large);
+    CHECK(!file.is_mapped());
+    CHECK(file.view() == content);
+  }
+}
+
+TEST_CASE("Missing file")
+{
+  TestContext test_context;
+
+  CHECK_THROWS_AS(MappedFile("does-not-exist"), Error);
+}
+
+TEST_SUITE_END();
@@ -19,6 +19,7 @@
 #include "../src/Config.hpp"
 #include "../src/Fd.hpp"
 #include "../src/Util.hpp"
+#include "../src/exceptions.hpp"
 #include "../src/fmtmacros.hpp"
 #include "TestUtil.hpp"
 
@@ -26,6 +27,8 @@
 #include "third_party/nonstd/optional.hpp"
 
 #include <algorithm>
+#include <atomic>
+#include <mutex>
 
 using doctest::Approx;
 using nonstd::nullopt;
@@ -246,12 +249,6 @@ TEST_CASE("Util::fallocate")
 
 TEST_CASE("Util::for_each_level_1_subdir")
 {
-  std::vector<std::string> actual;
-  Util::for_each_level_1_subdir(
-    "cache_dir",
-    [&](const auto& subdir, const auto&) { actual.push_back(subdir); },
-    [](double) {});
-
   std::vector<std::string> expected = {
     "cache_dir/0",
     "cache_dir/1",
@@ -270,7 +267,57 @@ TEST_CASE("Util::for_each_level_1_subdir")
     "cache_dir/e",
     "cache_dir/f",
   };
-  CHECK(actual == expected);
+
+  SUBCASE("Serial")
+  {
+    std::vector<std::string> actual;
+    Util::for_each_level_1_subdir(
+      "cache_dir",
+      [&](const auto& subdir, const auto&) { actual.push_back(subdir); },
+      [](double) {});
+    CHECK(actual == expected);
+  }
+
+  SUBCASE("Parallel")
+  {
+    std::mutex mutex;
+    std::vector<std::string> actual;
+    std::vector<double> progress;
+    Util::for_each_level_1_subdir(
+      "cache_dir",
+      [&](const auto& subdir, const auto& sub_progress_receiver) {
+        {
+          std::lock_guard<std::mutex> lock(mutex);
+          actual.push_back(subdir);
+        }
+        sub_progress_receiver(0.5);
+        sub_progress_receiver(1.0);
+      },
+      [&](double p) { progress.push_back(p); },
+      4);
+
+    std::sort(actual.begin(), actual.end());
+    CHECK(actual == expected);
+    CHECK(std::is_sorted(progress.begin(), progress.end()));
+    CHECK(progress.back() == 1.0);
+  }
+
+  SUBCASE("Parallel with exception")
+  {
+    std::atomic<int> visited(0);
+    CHECK_THROWS_WITH(Util::for_each_level_1_subdir(
+                        "cache_dir",
+                        [&](const auto& subdir, const auto&) {
+                          ++visited;
+                          if (subdir == "cache_dir/7") {
+                            throw Error("failed");
+                          }
+                        },
+                        [](double) {},
+                        4),
+                      "failed");
+    CHECK(visited == 16);
+  }
 }
 
 TEST_CASE("Util::format_argv_for_logging")
@@ -17,11 +17,14 @@
 // Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
 
 #include "../src/Hash.hpp"
+#include "../src/Util.hpp"
 #include "../src/hashutil.hpp"
 #include "TestUtil.hpp"
 
 #include "third_party/doctest.h"
 
+#include <chrono>
+
 using nonstd::string_view;
 using TestUtil::TestContext;
 
@@ -230,4 +233,137 @@ TEST_CASE("check_for_temporal_macros")
   }
 }
 
+TEST_CASE("check_for_temporal_macros with all scanners")
+{
+  const std::string padding(150, 'x');
+
+  for (auto scanner : {TemporalMacroScanner::bmh,
+                       TemporalMacroScanner::sse2,
+                       TemporalMacroScanner::avx2,
+                       TemporalMacroScanner::avx512bw}) {
+    if (!temporal_macro_scanner_supported(scanner)) {
+      continue;
+    }
+    CAPTURE(static_cast<int>(scanner));
+
+    CHECK(!check_for_temporal_macros(padding, scanner));
+    for (size_t i = 0; i <= padding.size(); ++i) {
+      CAPTURE(i);
+      std::string str = padding;
+      str.insert(i, " __TIME__ ");
+      CHECK(check_for_temporal_macros(str, scanner)
+            == HASH_SOURCE_CODE_FOUND_TIME);
+
+      str = padding;
+      str.insert(i, " __TIMESTAMP__ __DATE__ ");
+      CHECK(check_for_temporal_macros(str, scanner)
+            == (HASH_SOURCE_CODE_FOUND_TIMESTAMP
+                | HASH_SOURCE_CODE_FOUND_DATE));
+
+      // Part of an identifier.
+      str = padding;
+      str.insert(i, "__DATE__");
+      CHECK(check_for_temporal_macros(str, scanner) == 0);
+      CHECK(check_for_temporal_macros(string_view(str).substr(i), scanner)
+            == (i == padding.size() ? HASH_SOURCE_CODE_FOUND_DATE : 0));
+    }
+  }
+}
+
+// Measures the throughput of each temporal macro scanner. Set
+// CCACHE_BENCHMARK_CORPUS to a file (e.g. a concatenation of representative
+// headers) to use instead of the built-in sample.
+TEST_CASE("Benchmark of check_for_temporal_macros" * doctest::skip())
+{
+  std::string corpus;
+  const char* corpus_path = getenv("CCACHE_BENCHMARK_CORPUS");
+  if (corpus_path) {
+    corpus = Util::read_file(corpus_path);
+  } else {
+    const std::string sample =
+      "#ifndef FOO_H\n"
+      "#define FOO_H\n"
+      "\n"
+      "// Return the __size__ of the EXAMPLE_STRUCT.\n"
+      "static inline size_t foo_get_size(const struct foo *self) {\n"
+      "  return self->_size + FOO_EXTRA_SIZE;\n"
+      "}\n"
+      "\n"
+      "#endif // FOO_H\n";
+    while (corpus.size() < 64 * 1024 * 1024) {
+      corpus += sample;
+    }
+  }
+
+  const std::pair<TemporalMacroScanner, const char*> scanners[] = {
+    {TemporalMacroScanner::bmh, "bmh"},
+    {TemporalMacroScanner::sse2, "sse2"},
+    {TemporalMacroScanner::avx2, "avx2"},
+    {TemporalMacroScanner::avx512bw, "avx512bw"},
+  };
+  for (const auto& item : scanners) {
+    const auto scanner = item.first;
+    if (!temporal_macro_scanner_supported(scanner)) {
+      continue;
+    }
+    const auto start = std::chrono::steady_clock::now();
+    const int rounds = 10;
+    int result = 0;
+    for (int i = 0; i < rounds; ++i) {
+      result |= check_for_temporal_macros(corpus, scanner);
+    }
+    const std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+    MESSAGE(item.second << ": "
+                        << rounds * corpus.size() / elapsed.count() / 1e9
+                        << " GB/s (result " << result << ")");
+  }
+}
+
+TEST_CASE("find_preprocessed_directive")
+{
+  // Long enough for a few 32 byte blocks.
+  const std::string padding(70, 'x');
+
+  SUBCASE("hash first on line")
+  {
+    CHECK(find_preprocessed_directive("# 1 \"x\"", 0, false) == 0);
+    CHECK(find_preprocessed_directive("a# 1", 0, false) == 4);
+
+    const std::string str = padding + "\n# 1 \"x\"\n" + padding + "#";
+    CHECK(find_preprocessed_directive(str, 0, false) == 71);
+    CHECK(find_preprocessed_directive(str, 71, false) == 71);
+    CHECK(find_preprocessed_directive(str, 72, false) == str.length());
+  }
+
+  SUBCASE("incbin")
+  {
+    const std::string str = padding + ".incbin" + padding;
+    CHECK(find_preprocessed_directive(str, 0, false) == 70);
+    CHECK(find_preprocessed_directive(str, 71, false) == str.length());
+    CHECK(find_preprocessed_directive(padding + ".", 0, false) == 71);
+  }
+
+  SUBCASE("pump")
+  {
+    const std::string str = padding + "__" + padding;
+    CHECK(find_preprocessed_directive(str, 0, false) == str.length());
+    CHECK(find_preprocessed_directive(str, 0, true) == 70);
+  }
+
+  SUBCASE("every position")
+  {
+    for (size_t i = 0; i < 100; ++i) {
+      std::string str(100, 'x');
+      str[i] = '#';
+      if (i > 0) {
+        CHECK(find_preprocessed_directive(str, 0, false) == str.length());
+        str[i - 1] = '\n';
+      }
+      CHECK(find_preprocessed_directive(str, 0, false) == i);
+      CHECK(find_preprocessed_directive(str, i, false) == i);
+    }
+  }
+}
+
 TEST_SUITE_END();
@@ -0,0 +1,124 @@
+// Copyright (C) 2020 Joel Rosdahl and other contributors
+//
+// See doc/AUTHORS.adoc for a complete list of contributors.
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc., 51
+// Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#include "../src/Config.hpp"
+#include "../src/Hash.hpp"
+#include "../src/Stat.hpp"
+#include "../src/Util.hpp"
+#include "../src/storage/NegativeLookupCache.hpp"
+#include "TestUtil.hpp"
+
+#include "third_party/doctest.h"
+
+using storage::NegativeLookupCache;
+using TestUtil::TestContext;
+
+namespace {
+
+const std::string k_url_1 = "http://localhost:8080";
+const std::string k_url_2 = "file:///shared";
+
+void
+init(Config& config, uint32_t ttl)
+{
+  config.set_cache_dir(Util::get_actual_cwd());
+  config.set_secondary_storage_negative_cache_ttl(ttl);
+}
+
+} // namespace
+
+TEST_SUITE_BEGIN("storage::NegativeLookupCache");
+
+TEST_CASE("Disabled")
+{
+  TestContext test_context;
+
+  Config config;
+  init(config, 0);
+  NegativeLookupCache cache(config);
+  const auto key = Hash().hash("a").digest();
+
+  CHECK(!cache.remember_miss(k_url_1, key));
+  CHECK(!cache.is_missing(k_url_1, key));
+  CHECK(!Stat::stat(cache.get_file()));
+}
+
+TEST_CASE("Remember and forget")
+{
+  TestContext test_context;
+
+  Config config;
+  init(config, 60);
+  NegativeLookupCache cache(config);
+  const auto key_a = Hash().hash("a").digest();
+  const auto key_b = Hash().hash("b").digest();
+
+  CHECK(!cache.is_missing(k_url_1, key_a));
+  CHECK(cache.remember_miss(k_url_1, key_a));
+  CHECK(cache.is_missing(k_url_1, key_a));
+  CHECK(!cache.is_missing(k_url_2, key_a));
+  CHECK(!cache.is_missing(k_url_1, key_b));
+
+  // Another instance sees the same cache file.
+  NegativeLookupCache cache_2(config);
+  CHECK(cache_2.is_missing(k_url_1, key_a));
+
+  cache.forget(k_url_1, key_a);
+  CHECK(!cache.is_missing(k_url_1, key_a));
+  CHECK(!cache_2.is_missing(k_url_1, key_a));
+}
+
+TEST_CASE("Expiry")
+{
+  TestContext test_context;
+
+  Config config;
+  init(config, 60);
+  NegativeLookupCache cache(config);
+  const auto key = Hash().hash("a").digest();
+
+  CHECK(cache.remember_miss(k_url_1, key, 1000));
+  CHECK(cache.is_missing(k_url_1, key, 1000));
+  CHECK(cache.is_missing(k_url_1, key, 1059));
+  CHECK(!cache.is_missing(k_url_1, key, 1060));
+
+  // A miss recorded in the future (e.g. due to clock skew) is not trusted.
+  CHECK(!cache.is_missing(k_url_1, key, 999));
+
+  // Recording the miss again renews it.
+  CHECK(cache.remember_miss(k_url_1, key, 2000));
+  CHECK(cache.is_missing(k_url_1, key, 2030));
+}
+
+TEST_CASE("Drop")
+{
+  TestContext test_context;
+
+  Config config;
+  init(config, 60);
+  NegativeLookupCache cache(config);
+  const auto key = Hash().hash("a").digest();
+
+  CHECK(cache.remember_miss(k_url_1, key));
+  CHECK(Stat::stat(cache.get_file()));
+  CHECK(cache.drop());
+  CHECK(!Stat::stat(cache.get_file()));
+  CHECK(!cache.is_missing(k_url_1, key));
+}
+
+TEST_SUITE_END();
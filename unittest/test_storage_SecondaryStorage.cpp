@@ -0,0 +1,148 @@
+// Copyright (C) 2021 Joel Rosdahl and other contributors
+//
+// See doc/AUTHORS.adoc for a complete list of contributors.
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc., 51
+// Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#include "../src/Hash.hpp"
+#include "../src/Util.hpp"
+#include "../src/storage/SecondaryStorage.hpp"
+#include "TestUtil.hpp"
+
+#include "third_party/doctest.h"
+
+#include <map>
+
+using storage::SecondaryStorage;
+using TestUtil::TestContext;
+
+namespace {
+
+// A backend that stores entries in memory and fails for keys in `failing`.
+class FakeStorage : public SecondaryStorage
+{
+public:
+  std::map<std::string, std::string> entries;
+  std::map<std::string, Error> failing;
+
+  nonstd::expected<nonstd::optional<std::string>, Error>
+  get(const Digest& key) override
+  {
+    const auto failure = failing.find(key.to_string());
+    if (failure != failing.end()) {
+      return nonstd::make_unexpected(failure->second);
+    }
+    const auto it = entries.find(key.to_string());
+    if (it == entries.end()) {
+      return nonstd::nullopt;
+    }
+    return it->second;
+  }
+
+  nonstd::expected<bool, Error>
+  put(const Digest& key, const std::string& value, bool) override
+  {
+    const auto failure = failing.find(key.to_string());
+    if (failure != failing.end()) {
+      return nonstd::make_unexpected(failure->second);
+    }
+    entries[key.to_string()] = value;
+    return true;
+  }
+
+  nonstd::expected<bool, Error>
+  remove(const Digest& key) override
+  {
+    return entries.erase(key.to_string()) > 0;
+  }
+};
+
+} // namespace
+
+TEST_SUITE_BEGIN("storage::SecondaryStorage");
+
+TEST_CASE("put_many_from_files")
+{
+  TestContext test_context;
+
+  FakeStorage storage;
+  const auto a = Hash().hash("a").digest();
+  const auto b = Hash().hash("b").digest();
+  const auto c = Hash().hash("c").digest();
+  const auto d = Hash().hash("d").digest();
+  Util::write_file("a", "value a");
+  Util::write_file("c", "value c");
+  Util::write_file("d", "value d");
+
+  SUBCASE("Failing entries don't stop the batch")
+  {
+    storage.failing[c.to_string()] = SecondaryStorage::Error::error;
+
+    // b can't be read, which is not the backend's fault.
+    const auto stored =
+      storage.put_many_from_files({{a, "a"}, {b, "b"}, {c, "c"}, {d, "d"}});
+    REQUIRE(stored);
+    CHECK(*stored == std::vector<bool>{true, false, false, true});
+    CHECK(storage.entries.size() == 2);
+  }
+
+  SUBCASE("Only local failures")
+  {
+    const auto stored = storage.put_many_from_files({{b, "b"}});
+    REQUIRE(stored);
+    CHECK(*stored == std::vector<bool>{false});
+  }
+
+  SUBCASE("All entries fail")
+  {
+    storage.failing[a.to_string()] = SecondaryStorage::Error::error;
+    storage.failing[c.to_string()] = SecondaryStorage::Error::error;
+
+    const auto stored = storage.put_many_from_files({{a, "a"}, {c, "c"}});
+    REQUIRE(!stored);
+    CHECK(stored.error() == SecondaryStorage::Error::error);
+  }
+
+  SUBCASE("Timeout skips remaining entries")
+  {
+    storage.failing[a.to_string()] = SecondaryStorage::Error::timeout;
+
+    const auto stored = storage.put_many_from_files({{a, "a"}, {c, "c"}});
+    REQUIRE(!stored);
+    CHECK(stored.error() == SecondaryStorage::Error::timeout);
+    CHECK(storage.entries.empty());
+  }
+}
+
+TEST_CASE("get_many_to_files")
+{
+  TestContext test_context;
+
+  FakeStorage storage;
+  const auto a = Hash().hash("a").digest();
+  const auto b = Hash().hash("b").digest();
+  const auto c = Hash().hash("c").digest();
+  storage.entries[a.to_string()] = "value a";
+  storage.entries[c.to_string()] = "value c";
+  storage.failing[b.to_string()] = SecondaryStorage::Error::error;
+
+  const auto found =
+    storage.get_many_to_files({{a, "a"}, {b, "b"}, {c, "nonexistent/c"}});
+  REQUIRE(found);
+  CHECK(*found == std::vector<bool>{true, false, false});
+  CHECK(Util::read_file("a") == "value a");
+}
+
+TEST_SUITE_END();
@@ -0,0 +1,122 @@
+// Copyright (C) 2021 Joel Rosdahl and other contributors
+//
+// See doc/AUTHORS.adoc for a complete list of contributors.
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc., 51
+// Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#include "../src/Stat.hpp"
+#include "../src/Util.hpp"
+#include "../src/storage/SecondaryStorageHealth.hpp"
+#include "TestUtil.hpp"
+
+#include "third_party/doctest.h"
+
+using storage::SecondaryStorage;
+using storage::SecondaryStorageHealth;
+using TestUtil::TestContext;
+
+TEST_SUITE_BEGIN("storage::SecondaryStorageHealth");
+
+TEST_CASE("Disabled")
+{
+  TestContext test_context;
+
+  SecondaryStorageHealth health("health/a", 0, 60);
+  health.record_failure(SecondaryStorage::Error::error, 1000);
+  health.record_failure(SecondaryStorage::Error::error, 1000);
+  CHECK(!health.should_skip(1000));
+  CHECK(!Stat::stat("health/a"));
+}
+
+TEST_CASE("Threshold and cool-down")
+{
+  TestContext test_context;
+
+  SecondaryStorageHealth health("health/a", 2, 60);
+  CHECK(!health.should_skip(1000));
+  CHECK(!Stat::stat("health/a"));
+
+  health.record_failure(SecondaryStorage::Error::error, 1000);
+  CHECK(!health.should_skip(1000));
+  health.record_failure(SecondaryStorage::Error::timeout, 1010);
+  CHECK(health.errors() == 1);
+  CHECK(health.timeouts() == 1);
+  CHECK(health.last_failure_time() == 1010);
+
+  CHECK(health.should_skip(1010));
+  CHECK(health.should_skip(1069));
+  CHECK(!health.should_skip(1070));
+
+  // A clock that has gone backwards should not keep the backend disabled.
+  CHECK(!health.should_skip(1009));
+}
+
+TEST_CASE("Success resets failures")
+{
+  TestContext test_context;
+
+  SecondaryStorageHealth health("health/a", 1, 60);
+  health.record_failure(SecondaryStorage::Error::error, 1000);
+  CHECK(health.should_skip(1000));
+
+  health.record_success();
+  CHECK(health.errors() == 0);
+  CHECK(health.timeouts() == 0);
+  CHECK(!health.should_skip(1000));
+}
+
+TEST_CASE("Shared between instances")
+{
+  TestContext test_context;
+
+  SecondaryStorageHealth health_1("health/a", 2, 60);
+  SecondaryStorageHealth health_2("health/a", 2, 60);
+  SecondaryStorageHealth other("health/b", 2, 60);
+
+  health_1.record_failure(SecondaryStorage::Error::error, 1000);
+  health_2.record_failure(SecondaryStorage::Error::error, 1001);
+  CHECK(health_2.errors() == 2);
+
+  SecondaryStorageHealth health_3("health/a", 2, 60);
+  CHECK(health_3.should_skip(1001));
+  CHECK(!other.should_skip(1001));
+}
+
+TEST_CASE("Success after failure recorded by another process")
+{
+  TestContext test_context;
+
+  SecondaryStorageHealth health_1("health/a", 1, 60);
+  SecondaryStorageHealth health_2("health/a", 1, 60);
+
+  CHECK(!health_1.should_skip(1000));
+  health_2.record_failure(SecondaryStorage::Error::error, 1000);
+  health_1.record_success();
+
+  SecondaryStorageHealth health_3("health/a", 1, 60);
+  CHECK(!health_3.should_skip(1000));
+}
+
+TEST_CASE("Malformed file")
+{
+  TestContext test_context;
+
+  Util::write_file("health", "garbage");
+  SecondaryStorageHealth health("health", 1, 60);
+  CHECK(!health.should_skip(1000));
+  CHECK(health.errors() == 0);
+}
+
+TEST_SUITE_END();
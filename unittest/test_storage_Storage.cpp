@@ -0,0 +1,108 @@
+// Copyright (C) 2021 Joel Rosdahl and other contributors
+//
+// See doc/AUTHORS.adoc for a complete list of contributors.
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc., 51
+// Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#include "../src/Config.hpp"
+#include "../src/Hash.hpp"
+#include "../src/Util.hpp"
+#include "../src/storage/Storage.hpp"
+#include "TestUtil.hpp"
+
+#include "third_party/doctest.h"
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+using storage::SecondaryStorage;
+using TestUtil::TestContext;
+
+namespace {
+
+// Backend that has every entry, optionally after a delay that it doesn't
+// shorten when cancelled.
+class DelayedStorage : public SecondaryStorage
+{
+public:
+  explicit DelayedStorage(std::chrono::milliseconds delay) : m_delay(delay)
+  {
+  }
+
+  nonstd::expected<nonstd::optional<std::string>, Error>
+  get(const Digest& /*key*/) override
+  {
+    ++lookups;
+    std::this_thread::sleep_for(m_delay);
+    return std::string("value");
+  }
+
+  nonstd::expected<bool, Error>
+  put(const Digest& /*key*/,
+      const std::string& /*value*/,
+      bool /*only_if_missing*/) override
+  {
+    return true;
+  }
+
+  nonstd::expected<bool, Error>
+  remove(const Digest& /*key*/) override
+  {
+    return true;
+  }
+
+  std::atomic<int> lookups{0};
+
+private:
+  const std::chrono::milliseconds m_delay;
+};
+
+} // namespace
+
+TEST_SUITE_BEGIN("storage::Storage");
+
+TEST_CASE("Lookup doesn't wait for slow backend of earlier lookup")
+{
+  TestContext test_context;
+
+  Config config;
+  config.set_cache_dir(Util::get_actual_cwd());
+  config.set_secondary_storage_negative_cache_ttl(0);
+
+  storage::Storage storage(config);
+  storage.initialize();
+
+  auto slow_backend =
+    std::make_unique<DelayedStorage>(std::chrono::milliseconds(1000));
+  auto fast_backend =
+    std::make_unique<DelayedStorage>(std::chrono::milliseconds(0));
+  auto& slow = *slow_backend;
+  auto& fast = *fast_backend;
+  storage.add_secondary_storage("file:///slow", std::move(slow_backend));
+  storage.add_secondary_storage("file:///fast", std::move(fast_backend));
+
+  CHECK(storage.get(Hash().hash("a").digest(), core::CacheEntryType::result));
+  CHECK(fast.lookups == 1);
+
+  const auto start = std::chrono::steady_clock::now();
+  CHECK(storage.get(Hash().hash("b").digest(), core::CacheEntryType::result));
+  CHECK(std::chrono::steady_clock::now() - start
+        < std::chrono::milliseconds(500));
+  CHECK(fast.lookups == 2);
+  CHECK(slow.lookups == 1);
+}
+
+TEST_SUITE_END();
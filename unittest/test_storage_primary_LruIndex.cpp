@@ -0,0 +1,166 @@
+// Copyright (C) 2021 Joel Rosdahl and other contributors
+//
+// See doc/AUTHORS.adoc for a complete list of contributors.
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc., 51
+// Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#include "../src/Util.hpp"
+#include "../src/storage/primary/LruIndex.hpp"
+#include "TestUtil.hpp"
+
+#include "third_party/doctest.h"
+
+using storage::primary::LruIndex;
+using TestUtil::TestContext;
+
+TEST_SUITE_BEGIN("storage::primary::LruIndex");
+
+TEST_CASE("No index")
+{
+  TestContext test_context;
+
+  LruIndex index(".");
+  index.touch("aR", 1);
+  CHECK(!index.read());
+  CHECK(!Stat::stat(index.path()));
+}
+
+TEST_CASE("Invalid index")
+{
+  TestContext test_context;
+
+  Util::write_file("lru", "1 aR\n");
+  LruIndex index(".");
+  CHECK(!index.read());
+}
+
+TEST_CASE("Write, touch and read")
+{
+  TestContext test_context;
+
+  LruIndex index(".");
+  index.write({{"aR", 10}, {"bM", 20}, {"cR", 30}});
+  index.touch("aR", 40);
+  index.touch("dR", 5);
+  index.touch("bM", 15);
+
+  const auto entries = index.read();
+  REQUIRE(entries);
+  REQUIRE(entries->size() == 4);
+  CHECK((*entries)[0].name == "dR");
+  CHECK((*entries)[0].time == 5);
+  CHECK((*entries)[1].name == "bM");
+  CHECK((*entries)[1].time == 20);
+  CHECK((*entries)[2].name == "cR");
+  CHECK((*entries)[3].name == "aR");
+  CHECK((*entries)[3].time == 40);
+}
+
+TEST_CASE("Record, touch and read")
+{
+  TestContext test_context;
+
+  LruIndex index(".");
+  index.write({{"aR", 10, 4096, 500, 2}, {"bR", 20}});
+  index.touch("aR", 30);
+  index.touch("bR", 40);
+  index.record({"bR", 50, 8192, 1500, 0});
+  index.touch("bR", 60);
+
+  const auto entries = index.read();
+  REQUIRE(entries);
+  REQUIRE(entries->size() == 2);
+  CHECK((*entries)[0].name == "aR");
+  CHECK((*entries)[0].time == 30);
+  CHECK((*entries)[0].size == 4096);
+  CHECK((*entries)[0].cost == 500);
+  CHECK((*entries)[0].hits == 3);
+  CHECK((*entries)[1].name == "bR");
+  CHECK((*entries)[1].time == 60);
+  CHECK((*entries)[1].size == 8192);
+  CHECK((*entries)[1].cost == 1500);
+  CHECK((*entries)[1].hits == 1);
+
+  const auto lines = index.read_lines();
+  REQUIRE(lines);
+  REQUIRE(lines->size() == 6);
+  CHECK((*lines)[0].name == "aR");
+  CHECK((*lines)[0].hits == 2);
+  CHECK((*lines)[3].name == "bR");
+  CHECK((*lines)[3].time == 40);
+  CHECK((*lines)[3].size == 0);
+  CHECK((*lines)[4].size == 8192);
+}
+
+TEST_CASE("Lines appended after read are kept")
+{
+  TestContext test_context;
+
+  LruIndex index(".");
+  index.write({{"aR", 10}, {"bR", 20}});
+  auto entries = index.read();
+  REQUIRE(entries);
+
+  // Another process records a use, including a line that is not complete yet.
+  LruIndex(".").touch("cR", 30);
+  Util::write_file("lru", Util::read_file("lru") + "40 d");
+
+  entries->erase(entries->begin());
+  index.write(*entries);
+
+  const auto content = Util::read_file("lru");
+  CHECK(content.find(" aR\n") == std::string::npos);
+  CHECK(Util::ends_with(content, "20 bR 0 0 0\n30 cR\n40 d"));
+
+  const auto new_entries = index.read();
+  REQUIRE(new_entries);
+  REQUIRE(new_entries->size() == 2);
+  CHECK((*new_entries)[0].name == "bR");
+  CHECK((*new_entries)[1].name == "cR");
+}
+
+TEST_CASE("Partial index")
+{
+  TestContext test_context;
+
+  LruIndex index(".");
+  index.create_partial();
+  CHECK(!index.read());
+  CHECK(!index.read_lines());
+
+  index.record({"aR", 10, 4096, 500, 0});
+  index.touch("aR", 20);
+  index.record({"bR", 30, 8192, 1500, 0});
+
+  auto stored = index.read_stored_since(10);
+  REQUIRE(stored.size() == 2);
+  stored = index.read_stored_since(30);
+  REQUIRE(stored.size() == 1);
+  CHECK(stored[0].name == "bR");
+  CHECK(stored[0].size == 8192);
+  CHECK(index.read_stored_since(31).empty());
+
+  index.write(stored);
+  const auto entries = index.read();
+  REQUIRE(entries);
+  REQUIRE(entries->size() == 1);
+  CHECK((*entries)[0].name == "bR");
+
+  // An existing index is left alone.
+  index.create_partial();
+  CHECK(index.read());
+}
+
+TEST_SUITE_END();
@@ -0,0 +1,181 @@
+// Copyright (C) 2021 Joel Rosdahl and other contributors
+//
+// See doc/AUTHORS.adoc for a complete list of contributors.
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc., 51
+// Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#include "../src/Hash.hpp"
+#include "../src/Stat.hpp"
+#include "../src/Util.hpp"
+#include "../src/fmtmacros.hpp"
+#include "../src/storage/secondary/FilePackStore.hpp"
+#include "TestUtil.hpp"
+
+#include "third_party/doctest.h"
+
+using storage::secondary::FilePackStore;
+using TestUtil::TestContext;
+
+namespace {
+
+// Keys in the same partition.
+Digest
+make_key(uint8_t n)
+{
+  Digest key = Hash().hash("x").digest();
+  key.bytes()[Digest::size() - 1] = n;
+  return key;
+}
+
+std::string
+segment_path(const Digest& key, uint32_t segment)
+{
+  return FMT("pack/{}-{}.pack", key.to_string().substr(0, 2), segment);
+}
+
+} // namespace
+
+TEST_SUITE_BEGIN("storage::secondary::FilePackStore");
+
+TEST_CASE("Put, get and remove")
+{
+  TestContext test_context;
+
+  FilePackStore store(Util::get_actual_cwd(), 1024 * 1024);
+  const auto key_a = make_key(1);
+  const auto key_b = make_key(2);
+
+  CHECK(!*store.get(key_a));
+  CHECK(*store.put(key_a, "a", false));
+  CHECK(*store.put(key_b, "bb", false));
+  CHECK(Stat::stat("CACHEDIR.TAG"));
+  CHECK(*store.get(key_a) == "a");
+  CHECK(*store.get(key_b) == "bb");
+  CHECK(!*store.get(Hash().hash("y").digest()));
+
+  CHECK(!*store.put(key_a, "aa", true));
+  CHECK(*store.get(key_a) == "a");
+  CHECK(*store.put(key_a, "aa", false));
+  CHECK(*store.get(key_a) == "aa");
+
+  CHECK(*store.remove(key_a));
+  CHECK(!*store.get(key_a));
+  CHECK(!*store.remove(key_a));
+  CHECK(*store.get(key_b) == "bb");
+
+  // All data ends up in the same segment.
+  CHECK(Stat::stat(segment_path(key_a, 0)).size()
+        == 3 * Digest::size() + 1 + 2 + 2);
+
+  // Another instance sees the same data.
+  FilePackStore store_2(Util::get_actual_cwd(), 1024 * 1024);
+  CHECK(*store_2.get(key_b) == "bb");
+}
+
+TEST_CASE("Segment rollover and compaction")
+{
+  TestContext test_context;
+
+  FilePackStore store(Util::get_actual_cwd(), 100);
+  const auto key_a = make_key(1);
+  const auto key_b = make_key(2);
+  const std::string value(100 - Digest::size(), 'x');
+
+  // Fills segment 0.
+  CHECK(*store.put(key_a, value, false));
+  CHECK(Stat::stat(segment_path(key_a, 0)));
+
+  // Goes to segment 1 and fills it. No compaction since there is no garbage.
+  CHECK(*store.put(key_b, value, false));
+  CHECK(Stat::stat(segment_path(key_a, 0)));
+  CHECK(Stat::stat(segment_path(key_a, 1)));
+
+  // Create garbage so that most data is garbage when segment 2 is full.
+  CHECK(*store.remove(key_b));
+  CHECK(*store.put(key_a, "a", false));
+  CHECK(*store.put(key_a, value, false));
+
+  // Compacted into segment 3, the old segments are gone.
+  CHECK(!Stat::stat(segment_path(key_a, 0)));
+  CHECK(!Stat::stat(segment_path(key_a, 1)));
+  CHECK(!Stat::stat(segment_path(key_a, 2)));
+  CHECK(Stat::stat(segment_path(key_a, 3)).size() == 100);
+  CHECK(*store.get(key_a) == value);
+  CHECK(!*store.get(key_b));
+
+  // New entries go to a new segment since segment 3 is full.
+  CHECK(*store.put(make_key(3), "c", false));
+  CHECK(Stat::stat(segment_path(key_a, 4)));
+  CHECK(*store.get(make_key(3)) == "c");
+  CHECK(*store.get(key_a) == value);
+}
+
+TEST_CASE("Get to file and put from file")
+{
+  TestContext test_context;
+
+  FilePackStore store(Util::get_actual_cwd(), 1024 * 1024);
+  const auto key_a = make_key(1);
+  const auto key_b = make_key(2);
+
+  // Larger than the chunks that are copied at a time.
+  std::string value(200000, 'x');
+  value[0] = 'a';
+  value[value.size() - 1] = 'z';
+  Util::write_file("in", value);
+
+  CHECK(!*store.get_to_file(key_a, "out"));
+  CHECK(*store.put_from_file(key_a, "in", false));
+  CHECK(!*store.put_from_file(key_a, "in", true));
+  CHECK(*store.get(key_a) == value);
+  CHECK(*store.get_to_file(key_a, "out"));
+  CHECK(Util::read_file("out") == value);
+
+  // A missing source file is not a storage error.
+  const auto result = store.put_from_file(key_b, "missing", false);
+  REQUIRE(result);
+  CHECK(!*result);
+  CHECK(!*store.get(key_b));
+
+  // Records for key_a are found behind many newer records.
+  for (int i = 0; i < 300; ++i) {
+    CHECK(*store.put(key_b, FMT("{}", i), false));
+  }
+  CHECK(*store.get_to_file(key_a, "out"));
+  CHECK(Util::read_file("out") == value);
+  CHECK(*store.get(key_b) == "299");
+}
+
+TEST_CASE("Partially written index record")
+{
+  TestContext test_context;
+
+  FilePackStore store(Util::get_actual_cwd(), 1024 * 1024);
+  const auto key_a = make_key(1);
+  const auto key_b = make_key(2);
+  CHECK(*store.put(key_a, "a", false));
+
+  const auto index_path = FMT("pack/{}.idx", key_a.to_string().substr(0, 2));
+  Util::write_file(index_path, "garbage", std::ios::app | std::ios::binary);
+  CHECK(*store.get(key_a) == "a");
+  CHECK(!*store.get(key_b));
+
+  // The garbage is overwritten by the next record.
+  CHECK(*store.put(key_b, "b", false));
+  CHECK(*store.get(key_a) == "a");
+  CHECK(*store.get(key_b) == "b");
+}
+
+TEST_SUITE_END();